@@ -0,0 +1,123 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "algebra.h"
+
+static const char *errors[ALG_EMAX] = {
+	"Success",
+	"Invalid argument",
+	"Out of memory",
+	"Workspace too small",
+	"Cannot parse a number",
+	"Rows of different length",
+	"Cannot read the input",
+	"Singular matrix",
+	"No convergence",
+	"Dimensions do not fit",
+	"Not an integer",
+	"Too big",
+	"Code of dimension 0"
+};
+
+/* Set up a context with the given workspace. With a NULL workspace,
+ * the library allocates one itself and grows it as needed;
+ * a workspace given by the caller is never reallocated,
+ * and the calls fail with ALG_ESPACE if it is too small.
+ * It must be aligned for doubles. */
+void
+alginit(struct alg *ctx, void *work, size_t size)
+{
+	memset(ctx, 0, sizeof(struct alg));
+	ctx->work = work;
+	ctx->size = work ? size : 0;
+	ctx->own = NULL == work;
+	ctx->mixed = 0;
+	ctx->degree = 1;
+	ctx->far = 1;
+	ctx->weight = NULL;
+	ctx->jobs = 1;
+}
+
+void
+algfree(struct alg *ctx)
+{
+	if (ctx && ctx->own) {
+		free(ctx->work);
+		ctx->work = NULL;
+		ctx->size = 0;
+	}
+}
+
+/* Make sure the workspace has at least size bytes,
+ * and start handing them out from the beginning again.
+ * This invalidates whatever the previous call left in there.
+ * Return ALG_OK, ALG_ESPACE or ALG_ENOMEM. */
+int
+algwork(struct alg *ctx, size_t size)
+{
+	void *work;
+	if (NULL == ctx)
+		return ALG_EINVAL;
+	ctx->used = 0;
+	if (size <= ctx->size)
+		return ALG_OK;
+	if (0 == ctx->own)
+		return ALG_ESPACE;
+	if (NULL == (work = realloc(ctx->work, size)))
+		return ALG_ENOMEM;
+	ctx->work = work;
+	ctx->size = size;
+	return ALG_OK;
+}
+
+/* Hand out the next size bytes of the workspace, zeroed.
+ * The caller has reserved enough of them with algwork(). */
+void*
+algtake(struct alg *ctx, size_t size)
+{
+	char *p;
+	size = ALGSIZE(size);
+	if (ctx->used + size > ctx->size)
+		return NULL;
+	p = (char*) ctx->work + ctx->used;
+	ctx->used += size;
+	memset(p, 0, size);
+	return p;
+}
+
+/* Run work on each of the n jobs, size bytes apart from job on:
+ * the first one here, the others on threads of their own. A job no
+ * thread can be had for, even for want of memory for the thread ids,
+ * is run here as well; a size of zero gives them all the same job.
+ * Return when all of them are done. */
+void
+algjobs(void *(*work)(void*), void *job, size_t size, int n)
+{
+	pthread_t *tid = NULL;
+	char *arg = job;
+	int *made = NULL, t;
+	if (n > 1) {
+		tid = calloc(n, sizeof(pthread_t));
+		made = calloc(n, sizeof(int));
+	}
+	for (t = 1; t < n; t++)
+		if (NULL == tid || NULL == made || 0 == (made[t]
+		    = !pthread_create(&tid[t], NULL, work, arg + t * size)))
+			work(arg + t * size);
+	work(job);
+	for (t = 1; t < n; t++)
+		if (made && made[t])
+			pthread_join(tid[t], NULL);
+	free(tid);
+	free(made);
+}
+
+const char*
+algerr(int e)
+{
+	if (e < 0 || e >= ALG_EMAX)
+		return "Unknown error";
+	return errors[e];
+}
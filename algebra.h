@@ -0,0 +1,48 @@
+#ifndef _ALGEBRA_ALGEBRA_H_
+#define _ALGEBRA_ALGEBRA_H_
+
+#include <stddef.h>
+
+/* The error codes returned by the library calls. */
+#define ALG_OK		0	/* success */
+#define ALG_EINVAL	1	/* invalid argument */
+#define ALG_ENOMEM	2	/* out of memory */
+#define ALG_ESPACE	3	/* the workspace is too small */
+#define ALG_EPARSE	4	/* cannot parse a number */
+#define ALG_ESHAPE	5	/* rows of different length */
+#define ALG_EIO		6	/* cannot read the input */
+#define ALG_ESING	7	/* singular matrix */
+#define ALG_ECONV	8	/* the iteration does not converge */
+#define ALG_EDIM	9	/* the dimensions do not fit */
+#define ALG_EINT	10	/* not an integer */
+#define ALG_EBIG	11	/* too big to do */
+#define ALG_EEMPTY	12	/* a code of dimension 0 */
+#define ALG_EMAX	13
+
+/* The context of the library calls: the workspace they carve
+ * their temporaries and results from, and the settings of the fit.
+ * Nothing else is shared, so each thread can have its own context. */
+struct alg {
+	void	*work;		/* the workspace */
+	size_t	 size;		/* its size in bytes */
+	size_t	 used;		/* bytes handed out of it */
+	int	 own;		/* the workspace is ours to grow */
+	int	 mixed;		/* factor in single precision and refine */
+	int	 degree;	/* of the fitted polynomial */
+	double	 far;		/* the argument of the weight function */
+	double	(*weight)(double, double);	/* NULL for a global fit */
+	int	 jobs;		/* threads summing up a fit */
+};
+
+/* Round a size up for the workspace, so that doubles stay aligned. */
+#define ALGSIZE(n) \
+	(((n) + sizeof(double) - 1) / sizeof(double) * sizeof(double))
+
+void		alginit(struct alg*, void*, size_t);
+void		algfree(struct alg*);
+int		algwork(struct alg*, size_t);
+void*		algtake(struct alg*, size_t);
+void		algjobs(void *(*)(void*), void*, size_t, int);
+const char*	algerr(int);
+
+#endif
@@ -0,0 +1,348 @@
+/* Solve a stream of systems of linear equations on a pool of threads.
+ * The systems are read in groups, small enough to stay in the cache
+ * and big enough to make the handover cheap; each group is solved
+ * by one thread, and the solutions are written in the input order. */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
+#include "lineq.h"
+#include "batch.h"
+
+/* Close a group when it has this many numbers, bytes of text,
+ * or systems. */
+#define GROUPNUM	8192
+#define GROUPTEXT	65536
+#define GROUPSYS	256
+
+/* Let this many groups per thread be read ahead of the output. */
+#define AHEAD		4
+
+struct group {
+	long	 first;		/* the index of its first system */
+	long	 num;		/* systems in the group */
+	long	 bad;		/* systems that failed */
+	char	*text;		/* the systems as text, left to the workers */
+	size_t	 tlen;
+	size_t	 tsize;
+	size_t	 off[GROUPSYS + 1];	/* where each system starts */
+	long	 rows[GROUPSYS];	/* or the shape of each system */
+	long	 cols[GROUPSYS];
+	double	*a;		/* and its numbers, system after system */
+	size_t	 len;		/* numbers in use */
+	size_t	 size;		/* numbers allocated */
+	char	*out;		/* the solutions, as text */
+	size_t	 outlen;
+	int	 done;
+};
+
+struct pool {
+	pthread_mutex_t	  lock;
+	pthread_cond_t	  work;	/* a group has been read */
+	pthread_cond_t	  done;	/* a group has been solved */
+	struct group	**ring;
+	long		  nring;
+	long		  head;	/* groups read */
+	long		  next;	/* groups taken by the workers */
+	long		  tail;	/* groups written */
+	long		  bad;	/* systems that failed */
+	int		  eof;
+	int		  mixed;	/* solve in mixed precision */
+	char		 *line;	/* the reader's line buffer */
+	size_t		  lsize;
+};
+
+static struct group*
+newgroup(long first)
+{
+	struct group *g;
+	if (NULL == (g = calloc(1, sizeof(struct group))))
+		err(1, NULL);
+	g->first = first;
+	return g;
+}
+
+static void
+freegroup(struct group *g)
+{
+	if (g) {
+		free(g->text);
+		free(g->a);
+		free(g->out);
+		free(g);
+	}
+}
+
+/* Make room for k more numbers in the group. */
+static double*
+reserve(struct group *g, size_t k)
+{
+	size_t size = g->size ? g->size : GROUPNUM;
+	double *a;
+	if (k > SIZE_MAX / sizeof(double) - g->len)
+		return NULL;
+	while (size < g->len + k)
+		size *= 2;
+	if (size > g->size) {
+		if (NULL == (a = reallocarray(g->a, size, sizeof(double))))
+			err(1, NULL);
+		g->a = a;
+		g->size = size;
+	}
+	return g->a + g->len;
+}
+
+/* Read the next system of a text stream into the group,
+ * up to a blank line; the parsing is left to the workers.
+ * Return 1 if there was one, 0 at the end, -1 on error. */
+static int
+rdtext(FILE *fp, struct group *g, struct pool *p)
+{
+	ssize_t len;
+	size_t start = g->tlen;
+	char *t;
+	while ((len = getline(&p->line, &p->lsize, fp)) != -1) {
+		if ((size_t) len == strspn(p->line, " \t\r\n")) {
+			if (g->tlen > start)
+				break;
+			continue;
+		}
+		if (g->tlen + len > g->tsize) {
+			g->tsize = g->tsize ? 2 * g->tsize : GROUPTEXT;
+			while (g->tsize < g->tlen + len)
+				g->tsize *= 2;
+			if (NULL == (t = realloc(g->text, g->tsize)))
+				err(1, NULL);
+			g->text = t;
+		}
+		memcpy(g->text + g->tlen, p->line, len);
+		g->tlen += len;
+	}
+	if (ferror(fp)) {
+		warnx("System %ld: %s", g->first + g->num + 1,
+		    algerr(ALG_EIO));
+		return -1;
+	}
+	if (g->tlen == start)
+		return 0;
+	g->off[g->num++] = start;
+	g->off[g->num] = g->tlen;
+	return 1;
+}
+
+/* Read the next frame of a binary stream into the group:
+ * the number of rows and columns as two 32-bit integers,
+ * followed by the rows x cols doubles, row by row.
+ * Return 1 if there was one, 0 at the end, -1 on error. */
+static int
+rdbin(FILE *fp, struct group *g)
+{
+	uint32_t dim[2];
+	double *a;
+	size_t k, n;
+	long sys = g->first + g->num + 1;
+	if (0 == (n = fread(dim, sizeof(uint32_t), 2, fp)) && feof(fp))
+		return 0;
+	if (2 != n) {
+		warnx("System %ld: truncated frame", sys);
+		return -1;
+	}
+	if (0 == dim[0] || 0 == dim[1]) {
+		warnx("System %ld: %u x %u matrix", sys, dim[0], dim[1]);
+		return -1;
+	}
+	if (dim[0] > SIZE_MAX / sizeof(double) / dim[1]
+	|| NULL == (a = reserve(g, k = (size_t) dim[0] * dim[1])))
+		errx(1, "System %ld is too big", sys);
+	if (k != fread(a, sizeof(double), k, fp)) {
+		warnx("System %ld: truncated frame", sys);
+		return -1;
+	}
+	g->rows[g->num] = dim[0];
+	g->cols[g->num] = dim[1];
+	g->len += k;
+	g->num++;
+	return 1;
+}
+
+/* Read the next group of systems, setting *r to -1 on error.
+ * Return NULL if there are no more systems. */
+static struct group*
+rdgroup(FILE *fp, int binary, struct pool *p, long first, int *r)
+{
+	struct group *g = newgroup(first);
+	while (g->num < GROUPSYS && g->len < GROUPNUM && g->tlen < GROUPTEXT)
+		if (1 != (*r = binary ? rdbin(fp, g) : rdtext(fp, g, p)))
+			break;
+	if (0 == g->num) {
+		freegroup(g);
+		return NULL;
+	}
+	return g;
+}
+
+/* Solve the systems of the group, writing the solutions into its
+ * output; a system without a solution gets an empty line. */
+static void
+solve(struct group *g, struct alg *ctx, double ***rowp, long *nrowp)
+{
+	struct matrix mtx;
+	struct linsol sol;
+	double **p, *a;
+	FILE *fp;
+	long i;
+	int e;
+	if (NULL == (fp = open_memstream(&g->out, &g->outlen)))
+		err(1, NULL);
+	for (i = 0, a = g->a; i < g->num; i++) {
+		if (g->text) {
+			e = parsemtx(g->text + g->off[i],
+			    g->off[i + 1] - g->off[i], &mtx);
+		} else {
+			if (g->rows[i] > *nrowp) {
+				if (NULL == (p = reallocarray(*rowp,
+				    g->rows[i], sizeof(double*))))
+					err(1, NULL);
+				*rowp = p;
+				*nrowp = g->rows[i];
+			}
+			e = mtxinit(&mtx, a, g->rows[i], g->cols[i], *rowp);
+			a += g->rows[i] * g->cols[i];
+		}
+		if (ALG_OK == e)
+			e = linsolve(ctx, &mtx, &sol);
+		if (ALG_OK != e) {
+			warnx("System %ld: %s", g->first + i + 1, algerr(e));
+			g->bad++;
+		}
+		if (ALG_OK != e || NULL == sol.par)
+			putc('\n', fp);
+		else
+			fprsol(fp, &sol);
+		if (g->text)
+			freemtx(&mtx);
+	}
+	if (fclose(fp))
+		err(1, NULL);
+}
+
+static void*
+worker(void *arg)
+{
+	struct pool *p = arg;
+	struct group *g;
+	struct alg ctx;
+	double **rowp = NULL;
+	long nrow = 0;
+	alginit(&ctx, NULL, 0);
+	ctx.mixed = p->mixed;
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+		while (p->next == p->head && 0 == p->eof)
+			pthread_cond_wait(&p->work, &p->lock);
+		if (p->next == p->head) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		g = p->ring[p->next++ % p->nring];
+		pthread_mutex_unlock(&p->lock);
+		solve(g, &ctx, &rowp, &nrow);
+		pthread_mutex_lock(&p->lock);
+		g->done = 1;
+		pthread_cond_broadcast(&p->done);
+		pthread_mutex_unlock(&p->lock);
+	}
+	algfree(&ctx);
+	free(rowp);
+	return NULL;
+}
+
+/* Write out the solved groups in order. Wait for them
+ * if all of them are to be written, or if the ring is full. */
+static void
+flush(struct pool *p, FILE *out, int all)
+{
+	struct group *g;
+	pthread_mutex_lock(&p->lock);
+	while (p->tail < p->head) {
+		g = p->ring[p->tail % p->nring];
+		if (0 == g->done) {
+			if (0 == all && p->head - p->tail < p->nring)
+				break;
+			pthread_cond_wait(&p->done, &p->lock);
+			continue;
+		}
+		p->tail++;
+		p->bad += g->bad;
+		pthread_mutex_unlock(&p->lock);
+		fwrite(g->out, 1, g->outlen, out);
+		freegroup(g);
+		pthread_mutex_lock(&p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+/* Solve the systems of linear equations read from in,
+ * either matrices separated by blank lines or binary frames,
+ * writing their solutions to out, one per line, in the input order,
+ * in mixed precision if asked to. Return 0 on success,
+ * -1 if the input could not be read or some of the systems
+ * could not be solved. */
+int
+batch(FILE *in, FILE *out, int binary, int mixed, int jobs)
+{
+	struct pool p;
+	struct group *g;
+	pthread_t *tid;
+	long sys = 0;
+	int t, r = 0;
+
+	memset(&p, 0, sizeof(struct pool));
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.work, NULL);
+	pthread_cond_init(&p.done, NULL);
+	p.mixed = mixed;
+	p.nring = AHEAD * jobs;
+	if (NULL == (p.ring = calloc(p.nring, sizeof(struct group*)))
+	||  NULL == (tid = calloc(jobs, sizeof(pthread_t))))
+		err(1, NULL);
+	for (t = 0; t < jobs; t++)
+		if (pthread_create(&tid[t], NULL, worker, &p))
+			err(1, "pthread_create");
+
+	while (NULL != (g = rdgroup(in, binary, &p, sys, &r))) {
+		sys += g->num;
+		flush(&p, out, 0);
+		pthread_mutex_lock(&p.lock);
+		p.ring[p.head++ % p.nring] = g;
+		pthread_cond_signal(&p.work);
+		pthread_mutex_unlock(&p.lock);
+		if (-1 == r)
+			break;
+	}
+	if (ferror(in))
+		r = -1;
+
+	pthread_mutex_lock(&p.lock);
+	p.eof = 1;
+	pthread_cond_broadcast(&p.work);
+	pthread_mutex_unlock(&p.lock);
+	flush(&p, out, 1);
+	for (t = 0; t < jobs; t++)
+		pthread_join(tid[t], NULL);
+
+	pthread_mutex_destroy(&p.lock);
+	pthread_cond_destroy(&p.work);
+	pthread_cond_destroy(&p.done);
+	free(p.line);
+	free(p.ring);
+	free(tid);
+	return p.bad ? -1 : r;
+}
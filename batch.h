@@ -0,0 +1,8 @@
+#ifndef _ALGEBRA_BATCH_H_
+#define _ALGEBRA_BATCH_H_
+
+#include <stdio.h>
+
+int	batch(FILE*, FILE*, int, int, int);
+
+#endif
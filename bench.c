@@ -0,0 +1,519 @@
+/* Time the hot paths of le(1), lsq(1) and lc(1) on generated workloads
+ * of increasing size and report the results as JSON, optionally
+ * comparing them to a saved baseline. */
+
+#include <sys/resource.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
+#include "lineq.h"
+#include "lincode.h"
+#include "fit.h"
+
+extern const char* __progname;
+
+int qflag = 0;
+double tolerance = 20;
+
+/* Run each benchmark for at least this long. */
+#define MINTIME	0.2
+#define MAXREPS	1000
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	"usage: %s [-q] [-c baseline] [-t percent] [results]\n"
+	"       %s -g dense|sparse|deficient|code|data size\n",
+		__progname, __progname);
+}
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, so that the workloads are the same everywhere */
+static double
+rnd(void)
+{
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return (seed * 0x2545f4914f6cdd1dULL >> 11) / 9007199254740992.0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long
+maxrss(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+static struct matrix*
+newmtx(long rows, long cols)
+{
+	struct matrix *mtx;
+	long r;
+	if (NULL == (mtx = calloc(1, sizeof(struct matrix)))
+	||  NULL == (mtx->m = calloc(rows, sizeof(double*))))
+		err(1, NULL);
+	for (r = 0; r < rows; r++)
+		if (NULL == (mtx->m[r] = calloc(cols, sizeof(double))))
+			err(1, NULL);
+	mtx->rows = rows;
+	mtx->cols = cols;
+	mtx->nrow = rows;
+	return mtx;
+}
+
+static struct matrix*
+cpmtx(struct matrix *mtx)
+{
+	struct matrix *cp;
+	long r;
+	cp = newmtx(mtx->rows, mtx->cols);
+	for (r = 0; r < mtx->rows; r++)
+		memcpy(cp->m[r], mtx->m[r], mtx->cols * sizeof(double));
+	return cp;
+}
+
+static void
+rmmtx(struct matrix *mtx)
+{
+	freemtx(mtx);
+	free(mtx);
+}
+
+/* A regular n x n system with a random right hand side. */
+static struct matrix*
+gendense(long n)
+{
+	struct matrix *mtx = newmtx(n, n + 1);
+	long r, c;
+	for (r = 0; r < n; r++)
+		for (c = 0; c <= n; c++)
+			mtx->m[r][c] = 2 * rnd() - 1;
+	return mtx;
+}
+
+/* About five nonzeros per row, plus a dominant diagonal. */
+static struct matrix*
+gensparse(long n)
+{
+	struct matrix *mtx = newmtx(n, n + 1);
+	long r, k;
+	for (r = 0; r < n; r++) {
+		for (k = 0; k < 5; k++)
+			mtx->m[r][(long) (rnd() * n)] = 2 * rnd() - 1;
+		mtx->m[r][r] = 10;
+		mtx->m[r][n] = 2 * rnd() - 1;
+	}
+	return mtx;
+}
+
+/* A consistent system of rank n/2: the lower rows
+ * are combinations of the upper rows. */
+static struct matrix*
+gendeficient(long n)
+{
+	struct matrix *mtx = gendense(n);
+	long r, c, h = n / 2;
+	double a, b;
+	for (r = h; r < n; r++) {
+		a = 2 * rnd() - 1;
+		b = 2 * rnd() - 1;
+		for (c = 0; c <= n; c++)
+			mtx->m[r][c] = a * mtx->m[r - h][c]
+			    + b * mtx->m[(r - h + 1) % h][c];
+	}
+	return mtx;
+}
+
+/* A random binary [2k, k] code. */
+static struct matrix*
+gencode(long k)
+{
+	struct matrix *mtx = newmtx(k, 2 * k);
+	long r, c;
+	for (r = 0; r < k; r++)
+		for (c = 0; c < 2 * k; c++)
+			mtx->m[r][c] = rnd() < 0.5 ? 0 : 1;
+	return mtx;
+}
+
+/* N noisy samples of sin(6x) on [0,1]. */
+static struct data*
+gendata(long N)
+{
+	struct data *data;
+	long n;
+	if (NULL == (data = calloc(1, sizeof(struct data)))
+	||  NULL == (data->points = calloc(N, sizeof(struct pt))))
+		err(1, NULL);
+	for (n = 0; n < N; n++) {
+		data->points[n].x = (double) n / N;
+		data->points[n].y = sin(6.0 * n / N) + (rnd() - 0.5) / 10;
+	}
+	data->num = N;
+	return data;
+}
+
+static int first = 1;
+
+/* Print a result; flops and points are per one run, either can be 0. */
+static void
+report(const char *bench, const char *kind, long size, double secs,
+	double flops, double points)
+{
+	printf("%s\n{\"bench\": \"%s\", \"kind\": \"%s\", \"size\": %ld, "
+	    "\"ns\": %.0f, \"gflops\": %.3f, \"ns_per_point\": %.3f, "
+	    "\"maxrss_kb\": %ld}", first ? "[" : ",", bench, kind, size,
+	    secs * 1e9, flops ? flops / secs / 1e9 : 0,
+	    points ? secs * 1e9 / points : 0, maxrss());
+	first = 0;
+	fflush(stdout);
+}
+
+static void
+bmatrix(const char *kind, struct matrix *(*gen)(long), long n)
+{
+	struct alg ctx;
+	struct matrix *mtx, *cp;
+	struct linsol sol;
+	double t, best, total, lu = 2.0 * n * n * n / 3;
+	long reps;
+	alginit(&ctx, NULL, 0);
+	mtx = gen(n);
+	for (best = HUGE_VAL, total = 0, reps = 0;
+	    reps < MAXREPS && total < MINTIME; reps++) {
+		cp = cpmtx(mtx);
+		t = now();
+		gem(cp);
+		t = now() - t;
+		total += t;
+		best = t < best ? t : best;
+		rmmtx(cp);
+	}
+	report("gem", kind, n, best, lu, 0);
+	for (best = HUGE_VAL, total = 0, reps = 0;
+	    reps < MAXREPS && total < MINTIME; reps++) {
+		cp = cpmtx(mtx);
+		t = now();
+		linsolve(&ctx, cp, &sol);
+		t = now() - t;
+		total += t;
+		best = t < best ? t : best;
+		rmmtx(cp);
+	}
+	report("linsolve", kind, n, best, lu + 2.0 * n * n, 0);
+	ctx.mixed = 1;
+	for (best = HUGE_VAL, total = 0, reps = 0;
+	    reps < MAXREPS && total < MINTIME; reps++) {
+		cp = cpmtx(mtx);
+		t = now();
+		linsolve(&ctx, cp, &sol);
+		t = now() - t;
+		total += t;
+		best = t < best ? t : best;
+		rmmtx(cp);
+	}
+	report("mixsolve", kind, n, best, lu + 2.0 * n * n, 0);
+	rmmtx(mtx);
+	algfree(&ctx);
+}
+
+static void
+breadmtx(long n)
+{
+	struct matrix *mtx, rd;
+	char file[] = "/tmp/bench.XXXXXXXXXX";
+	double t, best, total;
+	long reps, r, c;
+	FILE *fp;
+	int fd;
+	if (-1 == (fd = mkstemp(file)) || NULL == (fp = fdopen(fd, "w")))
+		err(1, "%s", file);
+	mtx = gendense(n);
+	for (r = 0; r < mtx->rows; r++)
+		for (c = 0; c < mtx->cols; c++)
+			fprintf(fp, "% e%c", mtx->m[r][c],
+			    c == mtx->cols - 1 ? '\n' : ' ');
+	fclose(fp);
+	for (best = HUGE_VAL, total = 0, reps = 0;
+	    reps < MAXREPS && total < MINTIME; reps++) {
+		t = now();
+		readmtx(file, &rd);
+		t = now() - t;
+		total += t;
+		best = t < best ? t : best;
+		freemtx(&rd);
+	}
+	report("readmtx", "dense", n, best, 0, (double) n * (n + 1));
+	unlink(file);
+	rmmtx(mtx);
+}
+
+static void
+bfit(long N, int degree)
+{
+	struct alg ctx;
+	struct data *data;
+	struct matrix mtx;
+	struct linsol sol;
+	double t, best, total, v = 0, coef[] = { 1, -2, 3, -4, 5, -6, 7, -8 };
+	long reps, n;
+	alginit(&ctx, NULL, 0);
+	ctx.degree = degree;
+	data = gendata(N);
+	for (best = HUGE_VAL, total = 0, reps = 0;
+	    reps < MAXREPS && total < MINTIME; reps++) {
+		t = now();
+		mkmtx(&ctx, data, 0, &mtx);
+		t = now() - t;
+		total += t;
+		best = t < best ? t : best;
+	}
+	report("mkmtx", "data", N, best, 0, N);
+	ctx.weight = weight;
+	ctx.far = 0.1;
+	for (best = HUGE_VAL, total = 0, reps = 0;
+	    reps < MAXREPS && total < MINTIME; reps++) {
+		t = now();
+		wsol(&ctx, data, 0.5, &sol);
+		t = now() - t;
+		total += t;
+		best = t < best ? t : best;
+	}
+	report("wsol", "data", N, best, 0, N);
+	for (best = HUGE_VAL, total = 0, reps = 0;
+	    reps < MAXREPS && total < MINTIME; reps++) {
+		t = now();
+		for (n = 0; n < N; n++)
+			v += eval(coef, degree + 1, data->points[n].x);
+		t = now() - t;
+		total += t;
+		best = t < best ? t : best;
+	}
+	if (v == 42)
+		putchar('\n');
+	report("eval", "data", N, best, 0, N);
+	free(data->points);
+	free(data);
+	algfree(&ctx);
+}
+
+static void
+bcode(long k)
+{
+	struct matrix *mtx;
+	struct lincode *lc;
+	double t, best, total;
+	long reps;
+	mtx = gencode(k);
+	for (best = HUGE_VAL, total = 0, reps = 0;
+	    reps < MAXREPS && total < MINTIME; reps++) {
+		t = now();
+		lc = mkcode(mtx, NULL);
+		t = now() - t;
+		total += t;
+		best = t < best ? t : best;
+		freecode(lc);
+	}
+	report("mkcode", "code", k, best, 0, 0);
+	rmmtx(mtx);
+}
+
+static void
+run(void)
+{
+	const long nq[] = { 50, 100, 200, 0 };
+	const long nf[] = { 50, 100, 200, 400, 800, 0 };
+	const long Nq[] = { 1000, 10000, 0 };
+	const long Nf[] = { 1000, 10000, 100000, 1000000, 0 };
+	const long *n = qflag ? nq : nf, *N = qflag ? Nq : Nf;
+	long i;
+	for (i = 0; n[i]; i++) {
+		bmatrix("dense", gendense, n[i]);
+		bmatrix("sparse", gensparse, n[i]);
+		bmatrix("deficient", gendeficient, n[i]);
+		breadmtx(n[i]);
+		bcode(n[i]);
+	}
+	for (i = 0; N[i]; i++)
+		bfit(N[i], 3);
+	printf("\n]\n");
+}
+
+struct result {
+	char	bench[32];
+	char	kind[32];
+	long	size;
+	double	ns;
+};
+
+/* Read the results printed by report(), one per line. */
+static struct result*
+rdresults(const char *file, long *num)
+{
+	struct result *res = NULL, r;
+	char *line = NULL;
+	size_t size = 0;
+	FILE *fp;
+	if (NULL == (fp = fopen(file, "r")))
+		err(1, "%s", file);
+	*num = 0;
+	while (getline(&line, &size, fp) != -1) {
+		if (4 != sscanf(line, "{\"bench\": \"%31[^\"]\", \"kind\": "
+		    "\"%31[^\"]\", \"size\": %ld, \"ns\": %lf",
+		    r.bench, r.kind, &r.size, &r.ns))
+			continue;
+		if (NULL == (res = reallocarray(res, *num + 1, sizeof(r))))
+			err(1, NULL);
+		res[(*num)++] = r;
+	}
+	free(line);
+	fclose(fp);
+	return res;
+}
+
+/* Compare the results with the baseline. Return the number
+ * of benchmarks that got slower by more than the tolerance. */
+static int
+compare(const char *base, const char *file)
+{
+	struct result *b, *r;
+	long nb, nr, i, j;
+	int bad = 0;
+	double ratio;
+	b = rdresults(base, &nb);
+	r = rdresults(file, &nr);
+	for (i = 0; i < nr; i++) {
+		for (j = 0; j < nb; j++)
+			if (0 == strcmp(r[i].bench, b[j].bench)
+			&& 0 == strcmp(r[i].kind, b[j].kind)
+			&& r[i].size == b[j].size)
+				break;
+		if (j == nb || 0 == b[j].ns)
+			continue;
+		ratio = r[i].ns / b[j].ns;
+		if (ratio > 1 + tolerance / 100)
+			bad++;
+		fprintf(stderr, "%-10s %-10s %8ld %8.3fx%s\n",
+		    r[i].bench, r[i].kind, r[i].size, ratio,
+		    ratio > 1 + tolerance / 100 ? "  REGRESSION" : "");
+	}
+	free(b);
+	free(r);
+	return bad;
+}
+
+static int
+generate(const char *kind, long n)
+{
+	struct matrix *mtx;
+	struct data *data;
+	long r, c;
+	if (0 == strcmp(kind, "data")) {
+		data = gendata(n);
+		for (r = 0; r < n; r++)
+			printf("% e % e\n", data->points[r].x, data->points[r].y);
+		return 0;
+	}
+	if (0 == strcmp(kind, "dense"))
+		mtx = gendense(n);
+	else if (0 == strcmp(kind, "sparse"))
+		mtx = gensparse(n);
+	else if (0 == strcmp(kind, "deficient"))
+		mtx = gendeficient(n);
+	else if (0 == strcmp(kind, "code"))
+		mtx = gencode(n);
+	else {
+		warnx("Unknown workload '%s'", kind);
+		return 1;
+	}
+	for (r = 0; r < mtx->rows; r++)
+		for (c = 0; c < mtx->cols; c++)
+			printf(0 == strcmp(kind, "code") ? "%.0f%c" : "% e%c",
+			    mtx->m[r][c], c == mtx->cols - 1 ? '\n' : ' ');
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	const char *base = NULL, *gen = NULL, *errstr;
+	char file[] = "/tmp/bench.XXXXXXXXXX";
+	long n;
+	int c, fd, bad;
+
+	while ((c = getopt(argc, argv, "c:g:qt:")) != -1) switch (c) {
+		case 'c':
+			base = optarg;
+			break;
+		case 'g':
+			gen = optarg;
+			break;
+		case 'q':
+			qflag = 1;
+			break;
+		case 't':
+			tolerance = strtod(optarg, NULL);
+			break;
+		default:
+			usage();
+			return 1;
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (gen) {
+		if (1 != argc) {
+			usage();
+			return 1;
+		}
+		n = strtonum(*argv, 1, 100000000, &errstr);
+		if (errstr)
+			errx(1, "%s size: %s", errstr, *argv);
+		return generate(gen, n);
+	}
+
+	if (argc > 1 || (argc == 1 && NULL == base)) {
+		usage();
+		return 1;
+	}
+
+	if (NULL == base) {
+		run();
+		return 0;
+	}
+
+	if (argc == 1)
+		return compare(base, *argv) ? 1 : 0;
+
+	/* run, keep the results, and compare */
+	if (-1 == (fd = mkstemp(file)) || NULL == freopen(file, "w", stdout))
+		err(1, "%s", file);
+	close(fd);
+	run();
+	fclose(stdout);
+	bad = compare(base, file);
+	unlink(file);
+	return bad ? 1 : 0;
+}
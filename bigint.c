@@ -0,0 +1,354 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "bigint.h"
+
+/* The calls that may need more limbs return ALG_OK or ALG_ENOMEM;
+ * on failure, the result is left undefined, but can be freed. */
+
+/* Make room for at least n limbs. */
+static int
+grow(struct big *x, long n)
+{
+	uint32_t *d;
+	if (n <= x->size)
+		return ALG_OK;
+	if (n < 2 * x->size)
+		n = 2 * x->size;
+	if (NULL == (d = reallocarray(x->d, n, sizeof(uint32_t))))
+		return ALG_ENOMEM;
+	x->d = d;
+	x->size = n;
+	return ALG_OK;
+}
+
+/* Drop the leading zero limbs. */
+static void
+trim(struct big *x)
+{
+	while (x->n > 0 && 0 == x->d[x->n - 1])
+		x->n--;
+}
+
+void
+bigfree(struct big *x)
+{
+	if (x) {
+		free(x->d);
+		memset(x, 0, sizeof(struct big));
+	}
+}
+
+int
+bigset(struct big *x, uint32_t w)
+{
+	if (ALG_OK != grow(x, 1))
+		return ALG_ENOMEM;
+	x->d[0] = w;
+	x->n = w ? 1 : 0;
+	return ALG_OK;
+}
+
+int
+bigcpy(struct big *x, const struct big *y)
+{
+	if (x == y)
+		return ALG_OK;
+	if (ALG_OK != grow(x, y->n))
+		return ALG_ENOMEM;
+	if (y->n)
+		memcpy(x->d, y->d, y->n * sizeof(uint32_t));
+	x->n = y->n;
+	return ALG_OK;
+}
+
+int
+bigcmp(const struct big *x, const struct big *y)
+{
+	long i;
+	if (x->n != y->n)
+		return x->n < y->n ? -1 : 1;
+	for (i = x->n - 1; i >= 0; i--)
+		if (x->d[i] != y->d[i])
+			return x->d[i] < y->d[i] ? -1 : 1;
+	return 0;
+}
+
+long
+bigbits(const struct big *x)
+{
+	uint32_t top;
+	long b;
+	if (0 == x->n)
+		return 0;
+	for (b = 0, top = x->d[x->n - 1]; top; top >>= 1)
+		b++;
+	return 32 * (x->n - 1) + b;
+}
+
+/* Return x mod w. */
+uint32_t
+bigmodw(const struct big *x, uint32_t w)
+{
+	uint64_t r = 0;
+	long i;
+	for (i = x->n - 1; i >= 0; i--)
+		r = ((r << 32) | x->d[i]) % w;
+	return r;
+}
+
+/* x = x * m + a */
+int
+bigmulw(struct big *x, uint32_t m, uint32_t a)
+{
+	uint64_t c = a;
+	long i;
+	for (i = 0; i < x->n; i++) {
+		c += (uint64_t) x->d[i] * m;
+		x->d[i] = c;
+		c >>= 32;
+	}
+	if (c) {
+		if (ALG_OK != grow(x, x->n + 1))
+			return ALG_ENOMEM;
+		x->d[x->n++] = c;
+	}
+	return ALG_OK;
+}
+
+/* x = x + y * w */
+int
+bigaddmul(struct big *x, const struct big *y, uint32_t w)
+{
+	uint64_t c = 0;
+	long i, n = y->n > x->n ? y->n : x->n;
+	if (ALG_OK != grow(x, n + 1))
+		return ALG_ENOMEM;
+	for (i = x->n; i <= n; i++)
+		x->d[i] = 0;
+	for (i = 0; i < n; i++) {
+		c += x->d[i] + (i < y->n ? (uint64_t) y->d[i] * w : 0);
+		x->d[i] = c;
+		c >>= 32;
+	}
+	x->d[n] = c;
+	x->n = n + 1;
+	trim(x);
+	return ALG_OK;
+}
+
+/* x = x - y, which must not be negative. */
+void
+bigsub(struct big *x, const struct big *y)
+{
+	int64_t t, b = 0;
+	long i;
+	for (i = 0; i < x->n; i++) {
+		t = (int64_t) x->d[i] - (i < y->n ? y->d[i] : 0) - b;
+		b = t < 0;
+		x->d[i] = t;
+	}
+	trim(x);
+}
+
+/* r = x * y */
+int
+bigmul(struct big *r, const struct big *x, const struct big *y)
+{
+	struct big z;
+	uint64_t c;
+	long i, j;
+	memset(&z, 0, sizeof(struct big));
+	if (ALG_OK != grow(&z, x->n + y->n + 1))
+		return ALG_ENOMEM;
+	memset(z.d, 0, (x->n + y->n + 1) * sizeof(uint32_t));
+	for (i = 0; i < x->n; i++) {
+		for (c = 0, j = 0; j < y->n; j++) {
+			c += z.d[i + j] + (uint64_t) x->d[i] * y->d[j];
+			z.d[i + j] = c;
+			c >>= 32;
+		}
+		z.d[i + y->n] = c;
+	}
+	z.n = x->n + y->n;
+	trim(&z);
+	bigfree(r);
+	*r = z;
+	return ALG_OK;
+}
+
+/* Divide a by b, which must not be zero, into the quotient q
+ * and the remainder r; either can be NULL. This is the classical
+ * algorithm D of Knuth, TAOCP 4.3.1. */
+int
+bigdiv(struct big *q, struct big *r, const struct big *a, const struct big *b)
+{
+	struct big u, v, w;
+	uint64_t num, qhat, rhat, p, c;
+	int64_t t, k;
+	long n = b->n, m, i, j, s;
+	int e = ALG_OK;
+	memset(&u, 0, sizeof(struct big));
+	memset(&v, 0, sizeof(struct big));
+	memset(&w, 0, sizeof(struct big));
+	if (bigcmp(a, b) < 0) {
+		if (r && ALG_OK != bigcpy(r, a))
+			return ALG_ENOMEM;
+		if (q && ALG_OK != bigset(q, 0))
+			return ALG_ENOMEM;
+		return ALG_OK;
+	}
+	m = a->n - n;
+	if (ALG_OK != (e = grow(&w, m + 1)))
+		goto done;
+	memset(w.d, 0, (m + 1) * sizeof(uint32_t));
+	w.n = m + 1;
+	if (1 == n) {
+		for (c = 0, i = a->n - 1; i >= 0; i--) {
+			num = (c << 32) | a->d[i];
+			w.d[i] = num / b->d[0];
+			c = num % b->d[0];
+		}
+		trim(&w);
+		if (r)
+			e = bigset(r, c);
+		goto done;
+	}
+	/* normalize, so that the top limb of v has its top bit set */
+	for (s = 0; 0 == ((b->d[n - 1] << s) & 0x80000000U); s++)
+		;
+	if (ALG_OK != (e = grow(&u, a->n + 1))
+	||  ALG_OK != (e = grow(&v, n)))
+		goto done;
+	for (i = n - 1; i > 0; i--)
+		v.d[i] = (b->d[i] << s)
+		    | (s ? (uint64_t) b->d[i - 1] >> (32 - s) : 0);
+	v.d[0] = b->d[0] << s;
+	v.n = n;
+	u.d[a->n] = s ? (uint64_t) a->d[a->n - 1] >> (32 - s) : 0;
+	for (i = a->n - 1; i > 0; i--)
+		u.d[i] = (a->d[i] << s)
+		    | (s ? (uint64_t) a->d[i - 1] >> (32 - s) : 0);
+	u.d[0] = a->d[0] << s;
+	u.n = a->n + 1;
+	for (j = m; j >= 0; j--) {
+		num = ((uint64_t) u.d[j + n] << 32) | u.d[j + n - 1];
+		qhat = num / v.d[n - 1];
+		rhat = num % v.d[n - 1];
+		while (qhat >> 32
+		|| qhat * v.d[n - 2] > ((rhat << 32) | u.d[j + n - 2])) {
+			qhat--;
+			rhat += v.d[n - 1];
+			if (rhat >> 32)
+				break;
+		}
+		/* multiply and subtract */
+		for (k = 0, c = 0, i = 0; i < n; i++) {
+			p = qhat * v.d[i] + c;
+			c = p >> 32;
+			t = (int64_t) u.d[i + j] - (uint32_t) p - k;
+			u.d[i + j] = t;
+			k = t < 0;
+		}
+		t = (int64_t) u.d[j + n] - c - k;
+		u.d[j + n] = t;
+		if (t < 0) {
+			/* add back */
+			qhat--;
+			for (c = 0, i = 0; i < n; i++) {
+				c += (uint64_t) u.d[i + j] + v.d[i];
+				u.d[i + j] = c;
+				c >>= 32;
+			}
+			u.d[j + n] += c;
+		}
+		w.d[j] = qhat;
+	}
+	trim(&w);
+	if (r && ALG_OK == (e = grow(r, n))) {
+		for (i = 0; i < n - 1; i++)
+			r->d[i] = (u.d[i] >> s)
+			    | (s ? (uint64_t) u.d[i + 1] << (32 - s) : 0);
+		r->d[n - 1] = u.d[n - 1] >> s;
+		r->n = n;
+		trim(r);
+	}
+done:
+	if (q && ALG_OK == e) {
+		bigfree(q);
+		*q = w;
+	} else
+		bigfree(&w);
+	bigfree(&u);
+	bigfree(&v);
+	return e;
+}
+
+/* g = gcd(x, y) */
+int
+biggcd(struct big *g, const struct big *x, const struct big *y)
+{
+	struct big a, b, r;
+	int e;
+	memset(&a, 0, sizeof(struct big));
+	memset(&b, 0, sizeof(struct big));
+	memset(&r, 0, sizeof(struct big));
+	e = bigcpy(&a, x);
+	if (ALG_OK == e)
+		e = bigcpy(&b, y);
+	while (ALG_OK == e && b.n) {
+		if (ALG_OK == (e = bigdiv(NULL, &r, &a, &b))
+		&&  ALG_OK == (e = bigcpy(&a, &b)))
+			e = bigcpy(&b, &r);
+	}
+	if (ALG_OK == e)
+		e = bigcpy(g, &a);
+	bigfree(&a);
+	bigfree(&b);
+	bigfree(&r);
+	return e;
+}
+
+/* Return the decimal representation of x, or NULL if out of memory.
+ * It is the caller's responsibility to free it. */
+char*
+bigstr(const struct big *x)
+{
+	struct big y;
+	uint64_t num;
+	uint32_t *chunk, t;
+	char *s, *p;
+	long n = 0, i;
+	memset(&y, 0, sizeof(struct big));
+	if (ALG_OK != bigcpy(&y, x))
+		return NULL;
+	if (NULL == (chunk = calloc(x->n * 2 + 1, sizeof(uint32_t)))) {
+		bigfree(&y);
+		return NULL;
+	}
+	/* peel off nine decimal digits at a time */
+	do {
+		for (t = 0, i = y.n - 1; i >= 0; i--) {
+			num = ((uint64_t) t << 32) | y.d[i];
+			y.d[i] = num / 1000000000;
+			t = num % 1000000000;
+		}
+		trim(&y);
+		chunk[n++] = t;
+	} while (y.n);
+	if (NULL == (s = p = calloc(9 * n + 1, sizeof(char)))) {
+		free(chunk);
+		bigfree(&y);
+		return NULL;
+	}
+	p += sprintf(p, "%u", chunk[n - 1]);
+	for (i = n - 2; i >= 0; i--)
+		p += sprintf(p, "%09u", chunk[i]);
+	free(chunk);
+	bigfree(&y);
+	return s;
+}
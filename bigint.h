@@ -0,0 +1,27 @@
+#ifndef _ALGEBRA_BIGINT_H_
+#define _ALGEBRA_BIGINT_H_
+
+#include <stdint.h>
+
+/* A natural number of arbitrary size, 32 bits per limb. */
+struct big {
+	long		n;	/* limbs in use; zero is n == 0 */
+	long		size;	/* limbs allocated */
+	uint32_t	*d;	/* least significant limb first */
+};
+
+void		bigfree(struct big*);
+int		bigset(struct big*, uint32_t);
+int		bigcpy(struct big*, const struct big*);
+int		bigcmp(const struct big*, const struct big*);
+long		bigbits(const struct big*);
+uint32_t	bigmodw(const struct big*, uint32_t);
+int		bigmulw(struct big*, uint32_t, uint32_t);
+int		bigaddmul(struct big*, const struct big*, uint32_t);
+void		bigsub(struct big*, const struct big*);
+int		bigmul(struct big*, const struct big*, const struct big*);
+int		bigdiv(struct big*, struct big*, const struct big*, const struct big*);
+int		biggcd(struct big*, const struct big*, const struct big*);
+char*		bigstr(const struct big*);
+
+#endif
@@ -0,0 +1,638 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
+#include "bigint.h"
+#include "exact.h"
+
+/* Solve an integer system exactly: eliminate modulo a number of word
+ * sized primes, put the reduced row echelon forms together with the CRT
+ * and recover the rational entries by rational reconstruction.
+ * The reduced row echelon form over Q is unique, so it is enough
+ * to stop once the reconstructed entries do not change anymore;
+ * the Hadamard bound tells us when they cannot change anymore. */
+
+/* The elimination modulo one prime. */
+struct prime {
+	uint32_t	p;
+	uint32_t	pinv;	/* -1/p mod 2^32 */
+	uint32_t	r2;	/* 2^64 mod p */
+	long		rank;
+	long		*piv;	/* pivot columns */
+	uint32_t	*rref;	/* rank reduced rows */
+};
+
+struct xjob {
+	const int64_t	*a;	/* the integer matrix */
+	long		rows;
+	long		cols;
+	struct prime	*pr;	/* the primes of this batch */
+	long		num;
+	long		first;
+	long		step;
+	int		err;	/* ALG_OK, or why a prime failed */
+};
+
+/* Montgomery reduction: T / 2^32 mod p, for T < p 2^32. */
+static inline uint32_t
+redc(uint64_t T, uint32_t p, uint32_t pinv)
+{
+	uint32_t m = (uint32_t) T * pinv;
+	uint64_t t = (T + (uint64_t) m * p) >> 32;
+	return t >= p ? t - p : t;
+}
+
+static uint32_t
+mpow(uint32_t b, uint32_t e, const struct prime *pr)
+{
+	uint32_t r = redc(pr->r2, pr->p, pr->pinv);
+	for (; e; e >>= 1, b = redc((uint64_t) b * b, pr->p, pr->pinv))
+		if (e & 1)
+			r = redc((uint64_t) r * b, pr->p, pr->pinv);
+	return r;
+}
+
+/* B -= f * A, all in the Montgomery form. There are no dependencies
+ * between the iterations, so the compiler can vectorize this. */
+static void
+axpy(uint32_t *restrict B, const uint32_t *restrict A, uint32_t f, long n,
+	uint32_t p, uint32_t pinv)
+{
+	uint32_t y;
+	long j;
+	for (j = 0; j < n; j++) {
+		y = redc((uint64_t) f * A[j], p, pinv);
+		B[j] = B[j] >= y ? B[j] - y : B[j] + p - y;
+	}
+}
+
+static void
+scale(uint32_t *A, uint32_t f, long n, uint32_t p, uint32_t pinv)
+{
+	long j;
+	for (j = 0; j < n; j++)
+		A[j] = redc((uint64_t) f * A[j], p, pinv);
+}
+
+/* Compute the reduced row echelon form of the matrix modulo a prime.
+ * Return ALG_OK or ALG_ENOMEM. */
+static int
+modrref(const int64_t *a, long rows, long cols, struct prime *pr)
+{
+	uint32_t *M, *A, *B, t, p = pr->p, pinv = pr->pinv;
+	int64_t x;
+	long i, j, r, c;
+	if (NULL == (M = calloc(rows * cols, sizeof(uint32_t))))
+		return ALG_ENOMEM;
+	if (NULL == (pr->piv = calloc(rows + 1, sizeof(long)))) {
+		free(M);
+		return ALG_ENOMEM;
+	}
+	for (i = 0; i < rows * cols; i++) {
+		if ((x = a[i] % (int64_t) p) < 0)
+			x += p;
+		M[i] = redc((uint64_t) x * pr->r2, p, pinv);
+	}
+	pr->rank = 0;
+	for (c = 0; c < cols && pr->rank < rows; c++) {
+		for (r = pr->rank; r < rows; r++)
+			if (M[r * cols + c])
+				break;
+		if (r == rows)
+			continue;
+		A = M + pr->rank * cols;
+		if (r != pr->rank) {
+			for (B = M + r * cols, j = c; j < cols; j++) {
+				t = A[j];
+				A[j] = B[j];
+				B[j] = t;
+			}
+		}
+		scale(A + c, mpow(A[c], p - 2, pr), cols - c, p, pinv);
+		for (r = 0; r < rows; r++) {
+			B = M + r * cols;
+			if (r != pr->rank && B[c])
+				axpy(B + c, A + c, B[c], cols - c, p, pinv);
+		}
+		pr->piv[pr->rank++] = c;
+	}
+	for (i = 0; i < pr->rank * cols; i++)
+		M[i] = redc(M[i], p, pinv);
+	pr->rref = M;
+	return ALG_OK;
+}
+
+static void*
+xwork(void *arg)
+{
+	struct xjob *job = arg;
+	long i;
+	job->err = ALG_OK;
+	for (i = job->first; i < job->num && ALG_OK == job->err; i += job->step)
+		job->err = modrref(job->a, job->rows, job->cols, &job->pr[i]);
+	return NULL;
+}
+
+static int
+isprime(uint32_t n)
+{
+	const uint64_t base[] = { 2, 7, 61 };
+	uint64_t d, x, b, e;
+	int i, s, r;
+	if (n < 2 || 0 == n % 2)
+		return n == 2;
+	for (d = n - 1, s = 0; 0 == d % 2; d /= 2)
+		s++;
+	for (i = 0; i < 3; i++) {
+		if (base[i] % n == 0)
+			continue;
+		for (x = 1, b = base[i], e = d; e; e >>= 1, b = b * b % n)
+			if (e & 1)
+				x = x * b % n;
+		if (x == 1 || x == n - 1)
+			continue;
+		for (r = 1; r < s && x != n - 1; r++)
+			x = x * x % n;
+		if (x != n - 1)
+			return 0;
+	}
+	return 1;
+}
+
+/* Set up the next prime below p. */
+static void
+mkprime(struct prime *pr, uint32_t p)
+{
+	uint32_t inv;
+	int i;
+	for (p -= 1 + p % 2; !isprime(p); p -= 2)
+		;
+	memset(pr, 0, sizeof(struct prime));
+	pr->p = p;
+	for (inv = p, i = 0; i < 5; i++)
+		inv *= 2 - p * inv;
+	pr->pinv = -inv;
+	pr->r2 = (UINT64_MAX % p + 1) % p;
+}
+
+/* Compare the rank profiles: a prime that loses rank,
+ * or finds its pivots later than others, is unlucky. */
+static int
+better(const struct prime *a, const struct prime *b)
+{
+	long i;
+	if (a->rank != b->rank)
+		return a->rank > b->rank;
+	for (i = 0; i < a->rank; i++)
+		if (a->piv[i] != b->piv[i])
+			return a->piv[i] < b->piv[i];
+	return 0;
+}
+
+static void
+ratfree(struct rat *q)
+{
+	bigfree(&q->num);
+	bigfree(&q->den);
+}
+
+static int
+rateq(const struct rat *a, const struct rat *b)
+{
+	return a->neg == b->neg
+	    && 0 == bigcmp(&a->num, &b->num)
+	    && 0 == bigcmp(&a->den, &b->den);
+}
+
+/* Find a/b = x mod M with |a|, b < 2^h by the extended Euclid;
+ * the cofactors alternate in sign, so only their sizes are kept.
+ * Return ALG_OK, ALG_ECONV if there is no such fraction,
+ * or ALG_ENOMEM. */
+static int
+ratrec(const struct big *x, const struct big *M, long h, struct rat *q)
+{
+	struct big r0, r1, t0, t1, k, r;
+	int neg = 0, e;
+	memset(&r0, 0, sizeof(struct big));
+	memset(&r1, 0, sizeof(struct big));
+	memset(&t0, 0, sizeof(struct big));
+	memset(&t1, 0, sizeof(struct big));
+	memset(&k, 0, sizeof(struct big));
+	memset(&r, 0, sizeof(struct big));
+	if (ALG_OK != (e = bigcpy(&r0, M))
+	||  ALG_OK != (e = bigcpy(&r1, x))
+	||  ALG_OK != (e = bigset(&t1, 1)))
+		goto out;
+	while (bigbits(&r1) > h) {
+		if (ALG_OK != (e = bigdiv(&k, &r, &r0, &r1))
+		||  ALG_OK != (e = bigcpy(&r0, &r1))
+		||  ALG_OK != (e = bigcpy(&r1, &r))
+		||  ALG_OK != (e = bigmul(&k, &k, &t1))
+		||  ALG_OK != (e = bigaddmul(&k, &t0, 1))
+		||  ALG_OK != (e = bigcpy(&t0, &t1))
+		||  ALG_OK != (e = bigcpy(&t1, &k)))
+			goto out;
+		neg = !neg;
+	}
+	e = ALG_ECONV;
+	if (t1.n && bigbits(&t1) <= h) {
+		if (ALG_OK != (e = bigcpy(&q->num, &r1))
+		||  ALG_OK != (e = bigcpy(&q->den, &t1)))
+			goto out;
+		q->neg = neg && r1.n;
+	}
+out:
+	bigfree(&r0);
+	bigfree(&r1);
+	bigfree(&t0);
+	bigfree(&t1);
+	bigfree(&k);
+	bigfree(&r);
+	return e;
+}
+
+/* Reconstruct the n rationals from their residues modulo M.
+ * They all share a denominator dividing the pivot minor, so once
+ * a denominator is known, most entries times it are just small
+ * integers. Return ALG_OK, ALG_ECONV if M is not big enough yet,
+ * or ALG_ENOMEM. */
+static int
+recon(struct big *X, long n, const struct big *M, struct rat *q)
+{
+	struct big d, y, t;
+	struct rat z;
+	long i, h = (bigbits(M) - 2) / 2;
+	int e;
+	memset(&d, 0, sizeof(struct big));
+	memset(&y, 0, sizeof(struct big));
+	memset(&t, 0, sizeof(struct big));
+	memset(&z, 0, sizeof(struct rat));
+	e = bigset(&d, 1);
+	for (i = 0; i < n && ALG_OK == e; i++) {
+		if (ALG_OK != (e = bigmul(&y, &X[i], &d))
+		||  ALG_OK != (e = bigdiv(NULL, &y, &y, M))
+		||  ALG_OK != (e = bigcpy(&t, &y))
+		||  ALG_OK != (e = bigmulw(&t, 2, 0)))
+			break;
+		if (bigcmp(&t, M) > 0) {
+			if (ALG_OK != (e = bigcpy(&t, M)))
+				break;
+			bigsub(&t, &y);
+			q[i].neg = 1;
+		} else {
+			if (ALG_OK != (e = bigcpy(&t, &y)))
+				break;
+			q[i].neg = 0;
+		}
+		if (bigbits(&t) <= h) {
+			if (ALG_OK != (e = bigcpy(&q[i].num, &t))
+			||  ALG_OK != (e = bigcpy(&q[i].den, &d)))
+				break;
+			q[i].neg = q[i].neg && t.n;
+			continue;
+		}
+		if (ALG_OK != (e = ratrec(&y, M, h, &z))
+		||  ALG_OK != (e = bigmul(&d, &d, &z.den)))
+			break;
+		if (bigbits(&d) > h) {
+			e = ALG_ECONV;
+			break;
+		}
+		if (ALG_OK != (e = bigcpy(&q[i].num, &z.num))
+		||  ALG_OK != (e = bigcpy(&q[i].den, &d)))
+			break;
+		q[i].neg = z.neg;
+	}
+	bigfree(&d);
+	bigfree(&y);
+	bigfree(&t);
+	ratfree(&z);
+	return e;
+}
+
+/* Put the residues modulo a new prime into X, which is modulo M.
+ * Return ALG_OK or ALG_ENOMEM. */
+static int
+crt(struct big *X, long n, struct big *M, const struct prime *pr,
+	long cols, const long *fcol, long nfree)
+{
+	uint64_t m, inv, x, r, p = pr->p;
+	long e;
+	m = bigmodw(M, p);
+	for (inv = 1, x = m, r = p - 2; r; r >>= 1, x = x * x % p)
+		if (r & 1)
+			inv = inv * x % p;
+	for (e = 0; e < n; e++) {
+		r = pr->rref[(e / nfree) * cols + fcol[e % nfree]];
+		x = bigmodw(&X[e], p);
+		if (ALG_OK != bigaddmul(&X[e], M, (r + p - x) % p * inv % p))
+			return ALG_ENOMEM;
+	}
+	return bigmulw(M, p, 0);
+}
+
+static int
+reduce(struct rat *q)
+{
+	struct big g;
+	int e;
+	memset(&g, 0, sizeof(struct big));
+	if (0 == q->num.n)
+		return bigset(&q->den, 1);
+	if (ALG_OK == (e = biggcd(&g, &q->num, &q->den))
+	&&  ALG_OK == (e = bigdiv(&q->num, NULL, &q->num, &g)))
+		e = bigdiv(&q->den, NULL, &q->den, &g);
+	bigfree(&g);
+	return e;
+}
+
+static int
+ratcpy(struct rat *a, const struct rat *b, int neg)
+{
+	a->neg = neg ? !b->neg && b->num.n : b->neg;
+	if (ALG_OK != bigcpy(&a->num, &b->num))
+		return ALG_ENOMEM;
+	return bigcpy(&a->den, &b->den);
+}
+
+/* Solve a system of linear equations with integer entries exactly.
+ * The rightmost column is taken as the right hand vector. Use the
+ * given number of threads to eliminate modulo different primes;
+ * the primes no thread can be had for are eliminated here.
+ * Return an xsol structure (even if there is no solution), or NULL
+ * on error, with ALG_OK or the error code in err unless it is NULL:
+ * ALG_EINVAL for an empty matrix, ALG_EINT for entries other than
+ * integers, ALG_ECONV if the solution cannot be reconstructed,
+ * or ALG_ENOMEM. */
+struct xsol*
+xsolve(struct matrix *mtx, int jobs, int *err)
+{
+	struct prime *pr = NULL, best;
+	struct xjob *job = NULL;
+	struct xsol *sol = NULL;
+	struct big *X = NULL, M;
+	struct rat *cur = NULL, *prev = NULL, *t;
+	int64_t *a = NULL;
+	double norm, hbits = 0;
+	long r, c, i, j, n = 0, nfree = 0, *fcol = NULL, used = 0, maxp;
+	uint32_t p = UINT32_C(1) << 31;
+	int done = 0, stable = 0, e = ALG_OK;
+	memset(&best, 0, sizeof(struct prime));
+	memset(&M, 0, sizeof(struct big));
+	if (NULL == mtx || 0 == mtx->rows || mtx->cols < 2) {
+		e = ALG_EINVAL;
+		goto out;
+	}
+	if (NULL == (a = calloc(mtx->rows * mtx->cols, sizeof(int64_t)))) {
+		e = ALG_ENOMEM;
+		goto out;
+	}
+	for (r = 0; r < mtx->rows; r++) {
+		for (norm = 0, c = 0; c < mtx->cols; c++) {
+			if (mtx->m[r][c] != floor(mtx->m[r][c])
+			|| fabs(mtx->m[r][c]) >= 9007199254740992.0) {
+				e = ALG_EINT;
+				goto out;
+			}
+			a[r * mtx->cols + c] = mtx->m[r][c];
+			norm += mtx->m[r][c] * mtx->m[r][c];
+		}
+		if (norm > 1)
+			hbits += log2(norm) / 2;
+	}
+	/* the entries are quotients of minors, bounded by Hadamard */
+	maxp = (2 * hbits + 2) / 30 + 2;
+	if (jobs < 2)
+		jobs = 2;
+	if (NULL == (pr = calloc(jobs, sizeof(struct prime)))
+	||  NULL == (job = calloc(jobs, sizeof(struct xjob)))) {
+		e = ALG_ENOMEM;
+		goto out;
+	}
+	while (!done) {
+		for (i = 0; i < jobs; i++) {
+			mkprime(&pr[i], p);
+			p = pr[i].p;
+			job[i].a = a;
+			job[i].rows = mtx->rows;
+			job[i].cols = mtx->cols;
+			job[i].pr = pr;
+			job[i].num = jobs;
+			job[i].first = i;
+			job[i].step = jobs;
+		}
+		algjobs(xwork, job, sizeof(struct xjob), jobs);
+		for (i = 0; i < jobs && ALG_OK == e; i++)
+			e = job[i].err;
+		for (i = 0; i < jobs && ALG_OK == e; i++) {
+			if (0 == best.p || better(&pr[i], &best)) {
+				/* start over with the better profile */
+				free(best.piv);
+				best = pr[i];
+				if (NULL == (best.piv = calloc(best.rank + 1,
+				    sizeof(long)))) {
+					e = ALG_ENOMEM;
+					break;
+				}
+				memcpy(best.piv, pr[i].piv, best.rank * sizeof(long));
+				for (j = 0; j < n; j++) {
+					bigfree(&X[j]);
+					ratfree(&cur[j]);
+					ratfree(&prev[j]);
+				}
+				free(X);
+				free(cur);
+				free(prev);
+				free(fcol);
+				X = NULL;
+				cur = prev = NULL;
+				fcol = NULL;
+				n = 0;
+				/* the non-pivot columns, including the right side */
+				if (NULL == (fcol = calloc(mtx->cols, sizeof(long)))) {
+					e = ALG_ENOMEM;
+					break;
+				}
+				for (nfree = 0, c = 0, j = 0; c < mtx->cols; c++) {
+					if (j < best.rank && best.piv[j] == c)
+						j++;
+					else
+						fcol[nfree++] = c;
+				}
+				n = nfree && fcol[nfree - 1] == mtx->cols - 1
+				    ? best.rank * nfree : 0;
+				if (NULL == (X = calloc(n + 1, sizeof(struct big)))
+				||  NULL == (cur = calloc(n + 1, sizeof(struct rat)))
+				||  NULL == (prev = calloc(n + 1, sizeof(struct rat)))
+				||  ALG_OK != bigset(&M, 1)) {
+					n = 0;
+					e = ALG_ENOMEM;
+					break;
+				}
+				used = stable = 0;
+			}
+			if (0 == better(&best, &pr[i])) {
+				if (n && ALG_OK != (e = crt(X, n, &M, &pr[i],
+				    mtx->cols, fcol, nfree)))
+					break;
+				used++;
+			}
+		}
+		for (i = 0; i < jobs; i++) {
+			free(pr[i].piv);
+			free(pr[i].rref);
+		}
+		if (ALG_OK != e)
+			goto out;
+		if (0 == n) {
+			/* no solution, or nothing to reconstruct */
+			done = used >= 2;
+			continue;
+		}
+		if (ALG_ECONV == (e = recon(X, n, &M, cur))) {
+			if (used > 2 * maxp)
+				goto out;
+			e = ALG_OK;
+			continue;
+		}
+		if (ALG_OK != e)
+			goto out;
+		for (stable = 1, j = 0; j < n && stable; j++)
+			stable = rateq(&cur[j], &prev[j]);
+		done = stable || used >= maxp;
+		t = prev;
+		prev = cur;
+		cur = t;
+	}
+
+	if (NULL == (sol = calloc(1, sizeof(struct xsol)))) {
+		e = ALG_ENOMEM;
+		goto out;
+	}
+	sol->len = mtx->cols - 1;
+	if (0 == nfree || fcol[nfree - 1] != mtx->cols - 1)
+		goto out;
+	for (j = 0; j < n && ALG_OK == e; j++)
+		e = reduce(&prev[j]);
+	if (ALG_OK != e)
+		goto out;
+	sol->dim = nfree - 1;
+	if (NULL == (sol->par = calloc(sol->len, sizeof(struct rat)))
+	||  NULL == (sol->hom = calloc(sol->dim * sol->len + 1, sizeof(struct rat)))) {
+		e = ALG_ENOMEM;
+		goto out;
+	}
+	for (c = 0; c < sol->len * (sol->dim + 1) && ALG_OK == e; c++)
+		e = bigset(c < sol->len ? &sol->par[c].den
+		    : &sol->hom[c - sol->len].den, 1);
+	for (r = 0; r < best.rank && ALG_OK == e; r++) {
+		e = ratcpy(&sol->par[best.piv[r]], &prev[r * nfree + nfree - 1], 0);
+		for (j = 0; j < sol->dim && ALG_OK == e; j++)
+			e = ratcpy(&sol->hom[j * sol->len + best.piv[r]],
+			    &prev[r * nfree + j], 1);
+	}
+	for (j = 0; j < sol->dim && ALG_OK == e; j++)
+		e = bigset(&sol->hom[j * sol->len + fcol[j]].num, 1);
+out:
+	for (j = 0; j < n; j++) {
+		bigfree(&X[j]);
+		ratfree(&cur[j]);
+		ratfree(&prev[j]);
+	}
+	free(X);
+	free(cur);
+	free(prev);
+	free(fcol);
+	free(best.piv);
+	bigfree(&M);
+	free(pr);
+	free(job);
+	free(a);
+	if (ALG_OK != e) {
+		freexsol(sol);
+		sol = NULL;
+	}
+	if (err)
+		*err = e;
+	return sol;
+}
+
+static int
+prrat(const struct rat *q)
+{
+	char *s;
+	if (q->neg)
+		putchar('-');
+	if (NULL == (s = bigstr(&q->num)))
+		return ALG_ENOMEM;
+	printf("%s", s);
+	free(s);
+	if (q->num.n && !(1 == q->den.n && 1 == q->den.d[0])) {
+		if (NULL == (s = bigstr(&q->den)))
+			return ALG_ENOMEM;
+		printf("/%s", s);
+		free(s);
+	}
+	return ALG_OK;
+}
+
+static int
+prxvec(const struct rat *vec, long len)
+{
+	long c;
+	int e = ALG_OK;
+	putchar('(');
+	for (c = 0; c < len && ALG_OK == e; c++) {
+		if (c > 0)
+			printf(", ");
+		e = prrat(&vec[c]);
+	}
+	putchar(')');
+	return e;
+}
+
+/* Print the solution as prsol() does.
+ * Return ALG_OK, or an error code. */
+int
+prxsol(struct xsol *sol)
+{
+	long g;
+	int e;
+	if (NULL == sol)
+		return ALG_EINVAL;
+	if (NULL == sol->par)
+		return ALG_OK;
+	e = prxvec(sol->par, sol->len);
+	if (0 == sol->dim) {
+		putchar('\n');
+		return e;
+	}
+	printf(" + <");
+	for (g = 0; g < sol->dim && ALG_OK == e; g++) {
+		if (g > 0)
+			printf(", ");
+		e = prxvec(sol->hom + g * sol->len, sol->len);
+	}
+	printf(">\n");
+	return e;
+}
+
+void
+freexsol(struct xsol *sol)
+{
+	long i;
+	if (sol) {
+		for (i = 0; sol->par && i < sol->len; i++)
+			ratfree(&sol->par[i]);
+		for (i = 0; sol->hom && i < sol->dim * sol->len; i++)
+			ratfree(&sol->hom[i]);
+		free(sol->par);
+		free(sol->hom);
+		free(sol);
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef _ALGEBRA_EXACT_H_
+#define _ALGEBRA_EXACT_H_
+
+#include "bigint.h"
+#include "matrix.h"
+
+/* A rational number num/den. */
+struct rat {
+	int		neg;
+	struct big	num;
+	struct big	den;
+};
+
+/* Like struct linsol, with exact rational entries. */
+struct xsol {
+	long		len; /* length of vectors: Q^n */
+	long		dim; /* dimension of the hom solution */
+	struct rat*	par; /* a particular solution */
+	struct rat*	hom; /* dim generators, one after another */
+};
+
+struct xsol*	xsolve(struct matrix*, int, int*);
+void		freexsol(struct xsol*);
+int		prxsol(struct xsol*);
+
+#endif
@@ -0,0 +1,738 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
+#include "lineq.h"
+#include "fit.h"
+#include "prof.h"
+
+/* The degrees with a fixed-size Cholesky kernel. */
+#define CHOLDEG		8
+
+/* A pivot of the Cholesky factorization counts as zero
+ * within the rounding error of the diagonal entry. */
+#define CHOLEPS(d)	(((d) + 1) * DBL_EPSILON)
+
+/* Where the row i of a lower triangle packed row by row starts. */
+#define PACKED(i)	((i) * ((i) + 1) / 2)
+
+/* The points in a leaf of the tree of power sums. */
+#define CHUNK		512
+
+/* Give each thread at least this many points and about JOBTREES
+ * subtrees to sum; MAXJOBS threads at most. */
+#define JOBPTS		(1L << 16)
+#define JOBTREES	4
+#define MAXJOBS		256
+
+/* The sums of the weighted powers of the abscissas over num rows:
+ * s[j] of x^j for j up to twice the degree, then t[j] of x^j y
+ * for j up to the degree, for each of the k values of a row. */
+struct acc {
+	const struct pt	*pt;	/* the data points, or */
+	const double	*v;	/* the rows of a series */
+	double		(*w)(double, double);
+	double		 x;	/* the point weighted at */
+	double		 far;
+	long		 d;	/* the degree */
+	long		 k;	/* values in a row */
+	long		 start;	/* the first row summed */
+	long		 step;	/* and every step-th after it */
+	long		 num;	/* rows summed */
+	long		 len;	/* numbers in the sums */
+};
+
+struct ajob {
+	const struct acc	*a;
+	const long		*lo;	/* the subtrees, by their leaves */
+	const long		*hi;
+	double			*sum;	/* their sums, one after another */
+	long			 ntree;
+	long			 first;	/* the subtrees summed here */
+	long			 step;
+	double			*buf;	/* the scratch of this job */
+};
+
+/* Read the data points from a file, appending them to the data.
+ * Return ALG_OK or an error code. */
+int
+rdata(FILE *fp, struct data *data)
+{
+	struct pt p, *new;
+	int e = ALG_OK;
+	if (NULL == fp || NULL == data)
+		return ALG_EINVAL;
+	PROF_START(ST_PARSE);
+	while (fscanf(fp, "%le %le\n", &p.x, &p.y) == 2) {
+		if (NULL == (new
+		= reallocarray(data->points, data->num+1, sizeof(struct pt)))) {
+			e = ALG_ENOMEM;
+			break;
+		}
+		PROF_COUNT(CT_ALLOCS, 1);
+		data->points = new;
+		data->points[data->num++] = p;
+	}
+	if (ALG_OK == e && ferror(fp))
+		e = ALG_EIO;
+	PROF_COUNT(CT_BYTES, ftell(fp) > 0 ? ftell(fp) : 0);
+	PROF_STOP(ST_PARSE);
+	return e;
+}
+
+/* Evaluate a given polynomial at a given point. */
+/* FIXME: Horner? Square-and-Multiply? */
+double
+eval(double *coef, long len, double x)
+{
+	long p;
+	double *c, val = 0;
+	for (p = 0, c = coef; p < len; p++, c++)
+		val += (*c) * pow(x, p);
+	return val;
+}
+
+/* The weight function: 1-x, cut of to zero at x=1.
+ * TODO: also have a weight function suited at point x,
+ * according to the density of neighbouring data points. */
+/* TODO: cut off to zero for > epsilon */
+double
+weight(double x, double far)
+{
+	if (x < 0 || x > far)
+		return 0;
+	return exp(-x);
+}
+
+/* The levels of the tree of sums over num rows. */
+static long
+levels(long num)
+{
+	long l, leaves = (num + CHUNK - 1) / CHUNK;
+	for (l = 0; (1L << l) < leaves; l++)
+		;
+	return l;
+}
+
+/* Take the scratch of the sums over num rows with len numbers
+ * from the reserved workspace: the powers of a point,
+ * and a partial sum for each level of the tree. */
+static double*
+accbuf(struct alg *ctx, long num, long d, long len)
+{
+	return algtake(ctx, (d + 1 + levels(num) * len) * sizeof(double));
+}
+
+/* Sum up the i-th chunk of rows into out, one after another;
+ * the powers of each point are kept in pw for the values to share. */
+static void
+leaf(const struct acc *a, long i, double *out, double *pw)
+{
+	const double *y;
+	double v, x, *s, *t, *T;
+	long n, r, j, c, end, d = a->d;
+	memset(out, 0, a->len * sizeof(double));
+	s = out;
+	t = out + 2 * d + 1;
+	end = (i + 1) * CHUNK < a->num ? (i + 1) * CHUNK : a->num;
+	for (n = i * CHUNK; n < end; n++) {
+		r = a->start + n * a->step;
+		if (a->pt) {
+			x = a->pt[r].x;
+			y = &a->pt[r].y;
+		} else {
+			y = a->v + r * (a->k + 1);
+			x = *y++;
+		}
+		if (0 == (v = a->w ? a->w(fabs(a->x - x), a->far) : 1))
+			continue;
+		for (j = 0; j <= d; j++, v *= x)
+			s[j] += pw[j] = v;
+		for (; j <= 2 * d; j++, v *= x)
+			s[j] += v;
+		for (c = 0, T = t; c < a->k; c++, T += d + 1)
+			for (j = 0; j <= d; j++)
+				T[j] += pw[j] * y[c];
+	}
+}
+
+static void
+add(double *out, const double *in, long len)
+{
+	while (len-- > 0)
+		*out++ += *in++;
+}
+
+/* Sum up the leaves from lo to hi into out, each half on its own
+ * and then the two together; the right half goes to tmp, and each
+ * level further down takes the len numbers after it. */
+static void
+pairwise(const struct acc *a, long lo, long hi, double *out, double *tmp,
+	double *pw)
+{
+	long mid;
+	if (hi - lo < 2) {
+		leaf(a, lo, out, pw);
+		return;
+	}
+	mid = lo + (hi - lo) / 2;
+	pairwise(a, lo, mid, out, tmp, pw);
+	pairwise(a, mid, hi, tmp, tmp + a->len, pw);
+	add(out, tmp, a->len);
+}
+
+/* List the subtrees depth levels below the one from lo to hi,
+ * left to right, as the leaves they span. */
+static void
+trees(long lo, long hi, long depth, long *tlo, long *thi, long *n)
+{
+	long mid;
+	if (0 == depth || hi - lo < 2) {
+		tlo[*n] = lo;
+		thi[(*n)++] = hi;
+		return;
+	}
+	mid = lo + (hi - lo) / 2;
+	trees(lo, mid, depth - 1, tlo, thi, n);
+	trees(mid, hi, depth - 1, tlo, thi, n);
+}
+
+/* Combine the sums of the subtrees listed by trees() into out
+ * as pairwise() would have added them up. */
+static void
+merge(const struct acc *a, long lo, long hi, long depth, const double **sum,
+	double *out, double *tmp)
+{
+	long mid;
+	if (0 == depth || hi - lo < 2) {
+		memcpy(out, *sum, a->len * sizeof(double));
+		*sum += a->len;
+		return;
+	}
+	mid = lo + (hi - lo) / 2;
+	merge(a, lo, mid, depth - 1, sum, out, tmp);
+	merge(a, mid, hi, depth - 1, sum, tmp, tmp + a->len);
+	add(out, tmp, a->len);
+}
+
+static void*
+awork(void *arg)
+{
+	struct ajob *job = arg;
+	const struct acc *a = job->a;
+	long i;
+	for (i = job->first; i < job->ntree; i += job->step)
+		pairwise(a, job->lo[i], job->hi[i], job->sum + i * a->len,
+		    job->buf + a->d + 1, job->buf);
+	return NULL;
+}
+
+/* Put the power sums into out, added up pairwise over a tree
+ * whose leaves are the chunks of CHUNK rows; buf is the scratch
+ * taken by accbuf(). With more jobs, the subtrees a few levels
+ * down are summed by the threads and then combined in the same
+ * order, so the sums do not depend on the number of jobs.
+ * If the threads cannot be had, sum it all up here. */
+static void
+accumulate(const struct alg *ctx, const struct acc *a, double *out,
+	double *buf)
+{
+	struct ajob job[MAXJOBS];
+	const double *sum;
+	double *sums;
+	long leaves, depth, n = 0, *lo;
+	size_t size;
+	int jobs = ctx->jobs, t;
+	leaves = a->num > CHUNK ? (a->num + CHUNK - 1) / CHUNK : 1;
+	if (jobs > MAXJOBS)
+		jobs = MAXJOBS;
+	if (jobs > a->num / JOBPTS)
+		jobs = a->num / JOBPTS;
+	for (depth = 0; (1L << depth) < JOBTREES * jobs; depth++)
+		;
+	size = (1L << depth) * a->len
+	    + jobs * (a->d + 1 + levels(a->num) * a->len);
+	if (jobs < 2
+	|| NULL == (lo = reallocarray(NULL, 2L << depth, sizeof(long))))
+		goto serial;
+	if (NULL == (sums = reallocarray(NULL, size, sizeof(double)))) {
+		free(lo);
+		goto serial;
+	}
+	PROF_COUNT(CT_ALLOCS, 2);
+	trees(0, leaves, depth, lo, lo + (1L << depth), &n);
+	for (t = 0; t < jobs; t++) {
+		job[t].a = a;
+		job[t].lo = lo;
+		job[t].hi = lo + (1L << depth);
+		job[t].sum = sums;
+		job[t].ntree = n;
+		job[t].first = t;
+		job[t].step = jobs;
+		job[t].buf = sums + (1L << depth) * a->len
+		    + t * (a->d + 1 + levels(a->num) * a->len);
+	}
+	algjobs(awork, job, sizeof(struct ajob), jobs);
+	sum = sums;
+	merge(a, 0, leaves, depth, &sum, out, buf + a->d + 1);
+	free(sums);
+	free(lo);
+	return;
+serial:
+	pairwise(a, 0, leaves, out, buf + a->d + 1, buf);
+}
+
+/* Sum up the weighted powers of the data points into st: s[k] of x^k
+ * for k up to twice the degree, then t[k] of x^k y up to the degree,
+ * the entries of the normal equations, which only depend on i + j.
+ * Each point takes one weight and one run of multiplications. */
+static void
+moments(struct alg *ctx, const struct data *data, double x,
+	double *st, double *buf)
+{
+	struct acc a;
+	PROF_START(ST_FIT);
+	memset(&a, 0, sizeof(struct acc));
+	a.pt = data->points;
+	a.w = ctx->weight;
+	a.x = x;
+	a.far = ctx->far;
+	a.d = ctx->degree;
+	a.k = 1;
+	a.step = 1;
+	a.num = data->num;
+	a.len = 3 * a.d + 2;
+	accumulate(ctx, &a, st, buf);
+	PROF_COUNT(CT_FLOPS, 5ULL * (a.d + 1) * a.num);
+	PROF_STOP(ST_FIT);
+}
+
+/* Prepare the optimization matrix weighted at point x
+ * whose solution is the degree-tuple of the wlsq coeficients.
+ * It the weight function is NULL, make it a constant 1;
+ * otherwise it gets the distance and the far argument.
+ * The matrix lives in the workspace, which has been reserved. */
+static void
+build(struct alg *ctx, const struct data *data, double x,
+	struct matrix *mtx)
+{
+	double *st;
+	long r, c, d = ctx->degree;
+	st = algtake(ctx, (3 * d + 2) * sizeof(double));
+	moments(ctx, data, x, st, accbuf(ctx, data->num, d, 3 * d + 2));
+	mtx->rows = d + 1;
+	mtx->cols = d + 2;
+	mtx->gcol = 0;
+	mtx->nrow = 0;
+	mtx->m = algtake(ctx, mtx->rows * sizeof(double*));
+	for (r = 0; r < mtx->rows; r++) {
+		mtx->m[r] = algtake(ctx, mtx->cols * sizeof(double));
+		/* the linear combinations and the right hand side */
+		for (c = 0; c <= d; c++)
+			mtx->m[r][c] = st[r + c];
+		mtx->m[r][c] = st[2 * d + 1 + r];
+	}
+}
+
+/* Compose the optimization matrix for the given point
+ * in the workspace of the context, valid until its next use.
+ * Return ALG_OK or an error code. */
+int
+mkmtx(struct alg *ctx, const struct data *data, double x,
+	struct matrix *mtx)
+{
+	int e;
+	if (NULL == ctx || NULL == data || NULL == mtx
+	|| 0 == data->num || ctx->degree < 1)
+		return ALG_EINVAL;
+	if (ALG_OK != (e = algwork(ctx, MTXWORK(ctx->degree))))
+		return e;
+	build(ctx, data, x, mtx);
+	return ALG_OK;
+}
+
+/* Solve the normal equations for degree d, the lower triangle
+ * of the matrix packed in a and the nrhs right hand sides in b,
+ * one after another, by the Cholesky factorization a = L L' in place,
+ * overwriting b with the solutions; the factorization is done once
+ * for all of them, with the reciprocals of the diagonal of L kept in r.
+ * The matrix is positive semidefinite; where the weighted points do not
+ * determine the polynomial, a pivot vanishes within the rounding and its
+ * unknown is dropped, leaving a basic solution as the general elimination
+ * would. With the sizes constant, the compiler can unroll each of chol1()
+ * to chol8() for its degree; cholesky() takes any degree. */
+#define CHOLSTEPS(d)							\
+	for (i = 0; i <= (d); i++)					\
+		for (j = 0; j <= i; j++) {				\
+			u = a[PACKED(i) + j];				\
+			for (k = 0; k < j; k++)				\
+				u -= a[PACKED(i) + k] * a[PACKED(j) + k]; \
+			if (j < i)					\
+				a[PACKED(i) + j] = u * r[j];		\
+			else if (u > CHOLEPS(d) * a[PACKED(i) + i])	\
+				r[i] = 1 / (a[PACKED(i) + i] = sqrt(u)); \
+			else						\
+				r[i] = a[PACKED(i) + i] = 0;		\
+		}							\
+	for (; nrhs > 0; nrhs--, b += (d) + 1) {			\
+		for (i = 0; i <= (d); i++) {				\
+			for (u = b[i], k = 0; k < i; k++)		\
+				u -= a[PACKED(i) + k] * b[k];		\
+			b[i] = u * r[i];				\
+		}							\
+		for (i = (d); i >= 0; i--) {				\
+			for (u = b[i], k = i + 1; k <= (d); k++)	\
+				u -= a[PACKED(k) + i] * b[k];		\
+			b[i] = u * r[i];				\
+		}							\
+	}
+
+#define CHOLESKY(d)							\
+static void								\
+chol##d(double *a, double *b, long nrhs)				\
+{									\
+	double r[(d) + 1], u;						\
+	long i, j, k;							\
+	CHOLSTEPS(d)							\
+}
+
+static void
+cholesky(double *a, double *b, long nrhs, long d, double *r)
+{
+	double u;
+	long i, j, k;
+	CHOLSTEPS(d)
+}
+
+CHOLESKY(1)
+CHOLESKY(2)
+CHOLESKY(3)
+CHOLESKY(4)
+CHOLESKY(5)
+CHOLESKY(6)
+CHOLESKY(7)
+CHOLESKY(8)
+
+static void (*const chol[CHOLDEG + 1])(double*, double*, long) = {
+	NULL, chol1, chol2, chol3, chol4, chol5, chol6, chol7, chol8
+};
+
+/* Compose and solve the set of linear equations
+ * leading to the best polynomial to use at the given point.
+ * Up to CHOLDEG, the normal equations are solved by Cholesky;
+ * higher degrees go through the general solver.
+ * The solution lives in the workspace of the context,
+ * valid until its next use. Return ALG_OK or an error code. */
+int
+wsol(struct alg *ctx, const struct data *data, double x, struct linsol *sol)
+{
+	struct matrix mtx;
+	double *a, *st;
+	long i, j, d;
+	int e;
+	if (NULL == ctx || NULL == data || NULL == sol
+	|| 0 == data->num || ctx->degree < 1)
+		return ALG_EINVAL;
+	if (ALG_OK != (e = algwork(ctx, FITWORK(ctx->degree))))
+		return e;
+	if ((d = ctx->degree) <= CHOLDEG) {
+		st = algtake(ctx, (3 * d + 2) * sizeof(double));
+		a = algtake(ctx, PACKED(d + 1) * sizeof(double));
+		moments(ctx, data, x, st,
+		    accbuf(ctx, data->num, d, 3 * d + 2));
+		for (i = 0; i <= d; i++)
+			for (j = 0; j <= i; j++)
+				a[PACKED(i) + j] = st[i + j];
+		PROF_START(ST_ELIM);
+		chol[d](a, st + 2 * d + 1, 1);
+		PROF_COUNT(CT_FLOPS, (d + 1) * (d + 1) * (d + 7) / 3);
+		PROF_STOP(ST_ELIM);
+		memset(sol, 0, sizeof(struct linsol));
+		sol->len = d + 1;
+		sol->par = st + 2 * d + 1;
+		return ALG_OK;
+	}
+	build(ctx, data, x, &mtx);
+	return linsolvebuf(&mtx, sol,
+	    algtake(ctx, LINBUF(mtx.cols) * sizeof(double)));
+}
+
+/* Read data points with one or more values each, a line per point,
+ * appending them to the series; the first line sets the number of
+ * values, and all the other lines must have as many.
+ * Return ALG_OK or an error code. */
+int
+rseries(FILE *fp, struct series *ser)
+{
+	char *line = NULL, *p, *end;
+	size_t size = 0, max;
+	ssize_t len;
+	double *row, *new;
+	long c;
+	int e = ALG_OK;
+	if (NULL == fp || NULL == ser)
+		return ALG_EINVAL;
+	max = ser->num;
+	PROF_START(ST_PARSE);
+	while ((len = getline(&line, &size, fp)) != -1) {
+		PROF_COUNT(CT_BYTES, len);
+		if ((size_t) len == strspn(line, " \t\r\n"))
+			continue;
+		if (0 == ser->cols) {
+			for (p = line, c = 0; ; c++, p = end) {
+				strtod(p, &end);
+				if (end == p)
+					break;
+			}
+			if (c < 2) {
+				e = ALG_EPARSE;
+				break;
+			}
+			ser->cols = c - 1;
+		}
+		if ((size_t) ser->num == max) {
+			max = max ? 2 * max : 1024;
+			if (NULL == (new = reallocarray(ser->v,
+			    max, (ser->cols + 1) * sizeof(double)))) {
+				e = ALG_ENOMEM;
+				break;
+			}
+			PROF_COUNT(CT_ALLOCS, 1);
+			ser->v = new;
+		}
+		row = ser->v + ser->num * (ser->cols + 1);
+		for (p = line, c = 0; c <= ser->cols; c++, p = end) {
+			row[c] = strtod(p, &end);
+			if (end == p)
+				break;
+		}
+		/* a short row, a long row, or not a number */
+		p += strspn(p, " \t\r\n");
+		if (c <= ser->cols) {
+			e = *p ? ALG_EPARSE : ALG_ESHAPE;
+			break;
+		}
+		if (*p) {
+			strtod(p, &end);
+			e = end == p ? ALG_EPARSE : ALG_ESHAPE;
+			break;
+		}
+		ser->num++;
+	}
+	if (ALG_OK == e && ferror(fp))
+		e = ALG_EIO;
+	PROF_STOP(ST_PARSE);
+	free(line);
+	return e;
+}
+
+/* Sum up the weighted powers of the abscissas as moments() does,
+ * with the right hand sides of all the series after the power sums,
+ * one after another, over every step-th row from the start. */
+static void
+smoments(struct alg *ctx, const struct series *ser, double x,
+	long start, long step, double *st, double *buf)
+{
+	struct acc a;
+	PROF_START(ST_FIT);
+	memset(&a, 0, sizeof(struct acc));
+	a.v = ser->v;
+	a.w = ctx->weight;
+	a.x = x;
+	a.far = ctx->far;
+	a.d = ctx->degree;
+	a.k = ser->cols;
+	a.start = start;
+	a.step = step;
+	a.num = (ser->num - start + step - 1) / step;
+	a.len = 2 * a.d + 1 + a.k * (a.d + 1);
+	accumulate(ctx, &a, st, buf);
+	PROF_COUNT(CT_FLOPS, (4ULL * a.d + 2 + 2ULL * a.k * (a.d + 1))
+	    * a.num);
+	PROF_STOP(ST_FIT);
+}
+
+/* Pack the lower triangle of the normal equations for degree d
+ * into a from the power sums in s, less those in sub unless it is NULL,
+ * and solve them for the nrhs right hand sides in b; cholesky() takes
+ * room for d + 1 numbers in r. */
+static void
+solve(double *a, const double *s, const double *sub, double *b, long nrhs,
+	long d, double *r)
+{
+	long i, j;
+	for (i = 0; i <= d; i++)
+		for (j = 0; j <= i; j++)
+			a[PACKED(i) + j] = s[i + j] - (sub ? sub[i + j] : 0);
+	PROF_START(ST_ELIM);
+	if (d <= CHOLDEG)
+		chol[d](a, b, nrhs);
+	else
+		cholesky(a, b, nrhs, d, r);
+	PROF_COUNT(CT_FLOPS, (d + 1) * (d + 1) * (d + 1) / 3
+	    + 2ULL * nrhs * (d + 1) * (d + 1));
+	PROF_STOP(ST_ELIM);
+}
+
+/* Compose and solve the normal equations of all the series at once,
+ * weighted at the given point. The series share the matrix, which
+ * is factored once by Cholesky, and only differ in the right hand sides.
+ * The coefficients, a vector of degree + 1 of them per series,
+ * live in the workspace of the context, valid until its next use.
+ * Return ALG_OK or an error code. */
+int
+msol(struct alg *ctx, const struct series *ser, double x, double **coef)
+{
+	double *st, *buf, *a;
+	long d, k;
+	int e;
+	if (NULL == ctx || NULL == ser || NULL == coef
+	|| 0 == ser->num || ser->cols < 1 || ctx->degree < 1)
+		return ALG_EINVAL;
+	d = ctx->degree;
+	k = ser->cols;
+	if (ALG_OK != (e = algwork(ctx, SERWORK(d, k))))
+		return e;
+	st = algtake(ctx, (2 * d + 1 + k * (d + 1)) * sizeof(double));
+	a = algtake(ctx, PACKED(d + 1) * sizeof(double));
+	buf = accbuf(ctx, ser->num, d, 2 * d + 1 + k * (d + 1));
+	smoments(ctx, ser, x, 0, 1, st, buf);
+	solve(a, st, NULL, st + 2 * d + 1, k, d, buf);
+	*coef = st + 2 * d + 1;
+	return ALG_OK;
+}
+
+/* The leverage of a point at x on the fit, with the Cholesky factor
+ * of the normal equations packed in a: the square of the norm of the
+ * powers of x solved with the factor into z. A dropped unknown,
+ * with a zero on the diagonal, does not count. */
+static double
+leverage(const double *a, long d, double x, double *z)
+{
+	double u, v, h = 0;
+	long i, k;
+	for (i = 0, v = 1; i <= d; i++, v *= x) {
+		for (u = v, k = 0; k < i; k++)
+			u -= a[PACKED(i) + k] * z[k];
+		z[i] = a[PACKED(i) + i] ? u / a[PACKED(i) + i] : 0;
+		h += z[i] * z[i];
+	}
+	return h;
+}
+
+/* The value of the polynomial of degree d at x, by Horner. */
+static double
+horner(const double *c, long d, double x)
+{
+	double v = c[d];
+	while (d-- > 0)
+		v = v * x + c[d];
+	return v;
+}
+
+/* Add up the squares of the errors of the polynomials in coef
+ * predicting the values of the row, each divided by 1 - h. */
+static double
+sqerr(const double *row, const double *coef, long d, long k, double h)
+{
+	double r, sum = 0;
+	long c;
+	for (c = 0; c < k; c++, coef += d + 1) {
+		r = (row[c + 1] - horner(coef, d, row[0])) / (1 - h);
+		sum += r * r;
+	}
+	return sum;
+}
+
+/* Cross-validate the fit of the given degree and weight to the series:
+ * put the mean square error of predicting each value from a fit to the
+ * others into err. With no folds, each point is left out in turn;
+ * the error of the fit without the point is the error of the fit with it
+ * over 1 - h, where h is the leverage of the point, so one factorization
+ * serves all the points of a global fit, and the local factorization
+ * at each point serves its own. Otherwise the n-th point belongs
+ * to the fold n % folds, and each fold is left out in turn: the global
+ * fit subtracts the power sums of the fold from the total, and the local
+ * fit at a point subtracts those of its fold. A model that cannot predict
+ * a point without it, as when the fit interpolates, has an infinite error.
+ * Return ALG_OK or an error code. */
+int
+cverr(struct alg *ctx, const struct series *ser, long folds, double *err)
+{
+	double *s, *t, *buf, *a, *z, *fs, *ft, *row, h, sum = 0;
+	long d, k, f, n, j, nf, ls, lt;
+	int e;
+	if (NULL == ctx || NULL == ser || NULL == err
+	|| 0 == ser->num || ser->cols < 1 || ctx->degree < 1
+	|| folds < 0 || 1 == folds || folds > ser->num)
+		return ALG_EINVAL;
+	d = ctx->degree;
+	k = ser->cols;
+	ls = 2 * d + 1;
+	lt = k * (d + 1);
+	nf = NULL == ctx->weight ? folds : folds > 0;
+	if ((size_t) nf > SIZE_MAX / 2 / sizeof(double) / (ls + lt))
+		return ALG_ENOMEM;
+	if (ALG_OK != (e = algwork(ctx, CVWORK(d, k, nf))))
+		return e;
+	s = algtake(ctx, (ls + lt) * sizeof(double));
+	t = s + ls;
+	a = algtake(ctx, PACKED(d + 1) * sizeof(double));
+	z = algtake(ctx, (d + 1) * sizeof(double));
+	fs = algtake(ctx, nf * (ls + lt) * sizeof(double));
+	buf = accbuf(ctx, ser->num, d, ls + lt);
+	if (NULL == ctx->weight && 0 == folds) {
+		smoments(ctx, ser, 0, 0, 1, s, buf);
+		solve(a, s, NULL, t, k, d, buf);
+		for (n = 0, row = ser->v; n < ser->num; n++, row += k + 1) {
+			if (1 - (h = leverage(a, d, row[0], z)) <= CHOLEPS(d))
+				goto inf;
+			sum += sqerr(row, t, d, k, h);
+		}
+	} else if (NULL == ctx->weight) {
+		/* the sums of each fold, then their total */
+		for (f = 0; f < folds; f++) {
+			ft = fs + f * (ls + lt);
+			smoments(ctx, ser, 0, f, folds, ft, buf);
+			for (j = 0; j < ls + lt; j++)
+				s[j] += ft[j];
+		}
+		for (f = 0; f < folds; f++) {
+			ft = fs + f * (ls + lt);
+			for (j = 0; j < lt; j++)
+				ft[ls + j] = t[j] - ft[ls + j];
+			solve(a, s, ft, ft + ls, k, d, buf);
+			row = ser->v + f * (k + 1);
+			for (n = f; n < ser->num; n += folds, row += folds * (k + 1))
+				sum += sqerr(row, ft + ls, d, k, 0);
+		}
+	} else {
+		/* a local fit at each point */
+		for (n = 0, row = ser->v; n < ser->num; n++, row += k + 1) {
+			smoments(ctx, ser, row[0], 0, 1, s, buf);
+			if (folds) {
+				smoments(ctx, ser, row[0], n % folds, folds,
+				    fs, buf);
+				for (j = 0; j < lt; j++)
+					t[j] -= fs[ls + j];
+			}
+			solve(a, s, folds ? fs : NULL, t, k, d, buf);
+			h = folds ? 0 : ctx->weight(0, ctx->far)
+			    * leverage(a, d, row[0], z);
+			if (1 - h <= CHOLEPS(d))
+				goto inf;
+			sum += sqerr(row, t, d, k, h);
+		}
+	}
+	*err = sum / ser->num / k;
+	return ALG_OK;
+inf:
+	*err = INFINITY;
+	return ALG_OK;
+}
@@ -0,0 +1,67 @@
+#ifndef _ALGEBRA_FIT_H_
+#define _ALGEBRA_FIT_H_
+
+#include <stdio.h>
+
+#include "algebra.h"
+#include "matrix.h"
+#include "lineq.h"
+
+struct data {
+	long num;
+	struct pt {
+		double x, y;
+	}	*points;
+};
+
+/* Several series of values at the same abscissas:
+ * num rows of the abscissa followed by its cols values. */
+struct series {
+	long	 num;
+	long	 cols;
+	double	*v;
+};
+
+/* The levels of the tree of power sums, enough for any number
+ * of points, and the bytes of scratch for degree d and k values
+ * in a row: the powers of a point and a partial sum per level. */
+#define ACCDEPTH	64
+#define ACCWORK(d, k) \
+	ALGSIZE(((d) + 1 + ACCDEPTH * (2 * (d) + 1 \
+	+ (size_t) (k) * ((d) + 1))) * sizeof(double))
+
+/* The bytes of workspace mkmtx() and wsol() need for a given degree;
+ * wsol() also packs the normal equations for the Cholesky kernels. */
+#define MTXWORK(d) \
+	(ALGSIZE(((d) + 1) * sizeof(double*)) \
+	+ ((d) + 1) * ALGSIZE(((d) + 2) * sizeof(double)) \
+	+ ALGSIZE((3 * (d) + 2) * sizeof(double)) + ACCWORK(d, 1))
+#define FITWORK(d) \
+	(MTXWORK(d) + LINBUF((d) + 2) * sizeof(double) \
+	+ ALGSIZE(((d) + 1) * ((d) + 2) / 2 * sizeof(double)))
+
+/* The bytes of workspace msol() needs for degree d and k series:
+ * the sums of powers with the right hand sides, the packed triangle
+ * of the normal equations and the scratch of the sums. */
+#define SERWORK(d, k) \
+	(ALGSIZE((2 * (d) + 1 + (size_t) (k) * ((d) + 1)) * sizeof(double)) \
+	+ ALGSIZE(((d) + 1) * ((d) + 2) / 2 * sizeof(double)) \
+	+ ACCWORK(d, k))
+
+/* The bytes of workspace cverr() needs for k series and f folds:
+ * those of msol(), the leverage, and the power sums of each fold. */
+#define CVWORK(d, k, f) \
+	(SERWORK(d, k) + ALGSIZE(((d) + 1) * sizeof(double)) \
+	+ ALGSIZE((size_t) (f) * (2 * (d) + 1 + (size_t) (k) * ((d) + 1)) \
+	* sizeof(double)))
+
+int	rdata(FILE*, struct data*);
+int	rseries(FILE*, struct series*);
+double	eval(double*, long, double);
+double	weight(double, double);
+int	mkmtx(struct alg*, const struct data*, double, struct matrix*);
+int	wsol(struct alg*, const struct data*, double, struct linsol*);
+int	msol(struct alg*, const struct series*, double, double**);
+int	cverr(struct alg*, const struct series*, long, double*);
+
+#endif
@@ -0,0 +1,12 @@
+int
+main(void)
+{
+	long x = 1, o = 1;
+	if (1 != __atomic_fetch_add(&x, 1, __ATOMIC_RELAXED))
+		return 1;
+	if (!__atomic_compare_exchange_n(&x, &o, 3, 0,
+	    __ATOMIC_RELAXED, __ATOMIC_RELAXED) && 2 != o)
+		return 1;
+	__atomic_store_n(&x, 4, __ATOMIC_RELAXED);
+	return 4 != __atomic_load_n(&x, __ATOMIC_RELAXED);
+}
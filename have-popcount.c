@@ -0,0 +1,6 @@
+int
+main(void)
+{
+	unsigned long long x = 0xf0ULL;
+	return !(__builtin_popcountll(x) == 4 && __builtin_ctzll(x) == 4);
+}
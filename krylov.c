@@ -0,0 +1,414 @@
+/* Iterative solvers for large systems of linear equations:
+ * the conjugate gradient for symmetric positive definite matrices
+ * and the restarted GMRES for any, both with an optional
+ * preconditioner. Each iteration costs a product with the matrix,
+ * so a dense system takes O(n^2) per iteration instead of the O(n^3)
+ * of the elimination, and a sparse one O(nnz). */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
+#include "sparse.h"
+#include "krylov.h"
+#include "prof.h"
+
+/* The matrix as the solvers see it, with its preconditioner. */
+struct op {
+	const struct matrix	*mtx;	/* the dense matrix, or */
+	const struct csr	*a;	/* the sparse one */
+	long			 n;
+	double			*b;	/* the right hand side */
+	int			 pc;	/* the preconditioner */
+	double			*d;	/* the inverse of the diagonal */
+	const long		*ptr;	/* the pattern of ILU(0) */
+	const long		*col;
+	double			*lu;	/* the factors */
+	long			*diag;	/* where the pivots are */
+};
+
+/* Set the defaults: unpreconditioned CG to a relative residual
+ * of 1e-10 in at most 1000 iterations, and GMRES(30). */
+void
+kryinit(struct krylov *k)
+{
+	memset(k, 0, sizeof(struct krylov));
+	k->method = KRY_CG;
+	k->precond = KRY_NONE;
+	k->tol = 1e-10;
+	k->maxit = 1000;
+	k->restart = 30;
+}
+
+static double
+dot(const double *x, const double *y, long n)
+{
+	double s = 0;
+	long i;
+	for (i = 0; i < n; i++)
+		s += x[i] * y[i];
+	PROF_COUNT(CT_FLOPS, 2 * n);
+	return s;
+}
+
+/* y = Ax */
+static void
+matvec(const struct op *o, const double *x, double *y)
+{
+	const double *A;
+	double s;
+	long i, j, n = o->n;
+	if (o->mtx) {
+		for (i = 0; i < n; i++) {
+			for (A = o->mtx->m[i], s = 0, j = 0; j < n; j++)
+				s += A[j] * x[j];
+			y[i] = s;
+		}
+		PROF_COUNT(CT_FLOPS, 2 * n * n);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		for (s = 0, j = o->a->ptr[i]; j < o->a->ptr[i + 1]; j++)
+			s += o->a->val[j] * x[o->a->col[j]];
+		y[i] = s;
+	}
+	PROF_COUNT(CT_FLOPS, 2 * o->a->nnz);
+}
+
+/* z = M^-1 r, for the preconditioner M. */
+static void
+precond(const struct op *o, const double *r, double *z)
+{
+	double s;
+	long i, j, n = o->n;
+	switch (o->pc) {
+	case KRY_JACOBI:
+		for (i = 0; i < n; i++)
+			z[i] = r[i] * o->d[i];
+		PROF_COUNT(CT_FLOPS, n);
+		break;
+	case KRY_ILU:
+		for (i = 0; i < n; i++) {
+			for (s = r[i], j = o->ptr[i]; j < o->diag[i]; j++)
+				s -= o->lu[j] * z[o->col[j]];
+			z[i] = s;
+		}
+		for (i = n - 1; i >= 0; i--) {
+			s = z[i];
+			for (j = o->diag[i] + 1; j < o->ptr[i + 1]; j++)
+				s -= o->lu[j] * z[o->col[j]];
+			z[i] = s / o->lu[o->diag[i]];
+		}
+		PROF_COUNT(CT_FLOPS, 2 * o->ptr[n] + n);
+		break;
+	default:
+		memcpy(z, r, n * sizeof(double));
+	}
+}
+
+/* Factor the matrix incompletely, keeping its pattern, in place
+ * of the values in lu; iw is room for n indices.
+ * Return ALG_OK, or ALG_ESING for a missing or zero pivot. */
+static int
+ilu0(struct op *o, long *iw)
+{
+	long i, j, k, p, q, n = o->n;
+	for (i = 0; i < n; i++)
+		iw[i] = -1;
+	for (i = 0; i < n; i++) {
+		for (j = o->ptr[i], o->diag[i] = -1; j < o->ptr[i + 1]; j++) {
+			iw[o->col[j]] = j;
+			if (o->col[j] == i)
+				o->diag[i] = j;
+		}
+		if (-1 == o->diag[i])
+			return ALG_ESING;
+		for (j = o->ptr[i]; j < o->diag[i]; j++) {
+			k = o->col[j];
+			o->lu[j] /= o->lu[o->diag[k]];
+			for (q = o->diag[k] + 1; q < o->ptr[k + 1]; q++)
+				if (-1 != (p = iw[o->col[q]]))
+					o->lu[p] -= o->lu[j] * o->lu[q];
+			PROF_COUNT(CT_FLOPS, 2 * (o->ptr[k + 1] - o->diag[k]));
+		}
+		for (j = o->ptr[i]; j < o->ptr[i + 1]; j++)
+			iw[o->col[j]] = -1;
+		if (0 == o->lu[o->diag[i]])
+			return ALG_ESING;
+		PROF_COUNT(CT_PIVOTS, 1);
+	}
+	return ALG_OK;
+}
+
+static int
+cg(const struct op *o, struct krylov *k, double *x, double *w)
+{
+	double *r, *z, *p, *q, bn, rz, pq, a, rz1;
+	long i, n = o->n;
+	r = w;
+	z = r + n;
+	p = z + n;
+	q = p + n;
+	bn = sqrt(dot(o->b, o->b, n));
+	matvec(o, x, q);
+	for (i = 0; i < n; i++)
+		r[i] = o->b[i] - q[i];
+	precond(o, r, z);
+	memcpy(p, z, n * sizeof(double));
+	rz = dot(r, z, n);
+	for (k->iters = 0;; k->iters++) {
+		k->resid = sqrt(dot(r, r, n)) / bn;
+		if (k->resid <= k->tol)
+			return ALG_OK;
+		if (k->iters >= k->maxit)
+			return ALG_ECONV;
+		matvec(o, p, q);
+		/* not positive definite */
+		if (!((pq = dot(p, q, n)) > 0))
+			return ALG_ECONV;
+		a = rz / pq;
+		for (i = 0; i < n; i++) {
+			x[i] += a * p[i];
+			r[i] -= a * q[i];
+		}
+		precond(o, r, z);
+		rz1 = dot(r, z, n);
+		for (i = 0; i < n; i++)
+			p[i] = z[i] + rz1 / rz * p[i];
+		rz = rz1;
+		PROF_COUNT(CT_FLOPS, 6 * n);
+	}
+}
+
+/* GMRES(m), preconditioned from the right, so that the residual
+ * it minimizes is that of the system itself. The Hessenberg matrix
+ * is kept triangular by Givens rotations as it grows. */
+static int
+gmres(const struct op *o, struct krylov *k, double *x, double *w)
+{
+	double *V, *H, *cs, *sn, *g, *y, *z, *v, bn, h, t, u;
+	long i, j, l, n = o->n, m = k->restart;
+	V = w;
+	H = V + (m + 1) * n;
+	cs = H + (m + 1) * m;
+	sn = cs + m;
+	g = sn + m;
+	y = g + m + 1;
+	z = y + m;
+	bn = sqrt(dot(o->b, o->b, n));
+	for (k->iters = 0;;) {
+		matvec(o, x, V);
+		for (i = 0; i < n; i++)
+			V[i] = o->b[i] - V[i];
+		g[0] = sqrt(dot(V, V, n));
+		if ((k->resid = g[0] / bn) <= k->tol)
+			return ALG_OK;
+		if (k->iters >= k->maxit)
+			return ALG_ECONV;
+		for (i = 0; i < n; i++)
+			V[i] /= g[0];
+		for (j = 0; j < m && k->iters < k->maxit;) {
+			v = V + (j + 1) * n;
+			precond(o, V + j * n, z);
+			matvec(o, z, v);
+			/* the modified Gram-Schmidt */
+			for (i = 0; i <= j; i++) {
+				H[i * m + j] = h = dot(v, V + i * n, n);
+				for (l = 0; l < n; l++)
+					v[l] -= h * V[i * n + l];
+			}
+			H[(j + 1) * m + j] = h = sqrt(dot(v, v, n));
+			for (l = 0; h && l < n; l++)
+				v[l] /= h;
+			for (i = 0; i < j; i++) {
+				t = H[i * m + j];
+				u = H[(i + 1) * m + j];
+				H[i * m + j] = cs[i] * t + sn[i] * u;
+				H[(i + 1) * m + j] = cs[i] * u - sn[i] * t;
+			}
+			/* no progress is possible */
+			if (0 == (t = hypot(H[j * m + j], h)))
+				return ALG_ECONV;
+			cs[j] = H[j * m + j] / t;
+			sn[j] = h / t;
+			H[j * m + j] = t;
+			g[j + 1] = -sn[j] * g[j];
+			g[j] *= cs[j];
+			PROF_COUNT(CT_FLOPS, 2 * (j + 1) * n + 6 * j + n);
+			j++;
+			k->iters++;
+			if (fabs(g[j]) / bn <= k->tol || 0 == h)
+				break;
+		}
+		/* x += M^-1 V y, with y solving the triangular H y = g */
+		for (i = j - 1; i >= 0; i--) {
+			for (t = g[i], l = i + 1; l < j; l++)
+				t -= H[i * m + l] * y[l];
+			y[i] = t / H[i * m + i];
+		}
+		v = V + j * n;
+		memset(v, 0, n * sizeof(double));
+		for (i = 0; i < j; i++)
+			for (l = 0; l < n; l++)
+				v[l] += y[i] * V[i * n + l];
+		precond(o, v, z);
+		for (l = 0; l < n; l++)
+			x[l] += z[l];
+		PROF_COUNT(CT_FLOPS, 2 * j * n + j * j + n);
+	}
+}
+
+/* Set up the preconditioner and run the method from the initial
+ * guess in x, with nnz nonzero entries in the matrix.
+ * For ILU(0), a dense matrix takes the pattern of its nonzero entries. */
+static int
+solve(struct alg *ctx, struct krylov *k, struct op *o, long nnz, double *x)
+{
+	size_t vec, size, work;
+	long i, j, l, n = o->n, m = k->restart, *ptr, *col, *iw;
+	double *w;
+	int e = ALG_OK;
+
+	vec = ALGSIZE(n * sizeof(double));
+	if (KRY_CG == k->method)
+		work = 4 * vec;
+	else
+		work = ALGSIZE(((m + 1) * (n + m) + 4 * m + 1 + n)
+		    * sizeof(double));
+	size = work + vec;
+	if (KRY_JACOBI == k->precond)
+		size += vec;
+	if (KRY_ILU == k->precond) {
+		size += ALGSIZE(nnz * sizeof(double))
+		    + 2 * ALGSIZE(n * sizeof(long));
+		if (o->mtx)
+			size += ALGSIZE((n + 1) * sizeof(long))
+			    + ALGSIZE(nnz * sizeof(long));
+	}
+	if (ALG_OK != (e = algwork(ctx, size)))
+		return e;
+	w = algtake(ctx, work);
+	o->b = algtake(ctx, n * sizeof(double));
+	for (i = 0; i < n; i++)
+		o->b[i] = o->mtx ? o->mtx->m[i][n] : o->a->rhs[i];
+	k->iters = 0;
+	k->resid = 0;
+	if (0 == dot(o->b, o->b, n)) {
+		memset(x, 0, n * sizeof(double));
+		return ALG_OK;
+	}
+
+	PROF_START(ST_ELIM);
+	o->pc = k->precond;
+	if (KRY_JACOBI == k->precond) {
+		o->d = algtake(ctx, n * sizeof(double));
+		for (i = 0; i < n; i++) {
+			if (o->mtx)
+				o->d[i] = o->mtx->m[i][i];
+			else for (j = o->a->ptr[i]; j < o->a->ptr[i + 1]; j++)
+				if (o->a->col[j] == i)
+					o->d[i] = o->a->val[j];
+			if (0 == o->d[i]) {
+				e = ALG_ESING;
+				goto done;
+			}
+			o->d[i] = 1 / o->d[i];
+		}
+	}
+	if (KRY_ILU == k->precond) {
+		o->lu = algtake(ctx, nnz * sizeof(double));
+		o->diag = algtake(ctx, n * sizeof(long));
+		iw = algtake(ctx, n * sizeof(long));
+		if (o->mtx) {
+			ptr = algtake(ctx, (n + 1) * sizeof(long));
+			col = algtake(ctx, nnz * sizeof(long));
+			for (i = 0, l = 0; i < n; i++) {
+				for (ptr[i] = l, j = 0; j < n; j++) {
+					if (o->mtx->m[i][j]) {
+						col[l] = j;
+						o->lu[l++] = o->mtx->m[i][j];
+					}
+				}
+			}
+			ptr[n] = l;
+			o->ptr = ptr;
+			o->col = col;
+		} else {
+			o->ptr = o->a->ptr;
+			o->col = o->a->col;
+			memcpy(o->lu, o->a->val, nnz * sizeof(double));
+		}
+		if (ALG_OK != (e = ilu0(o, iw)))
+			goto done;
+	}
+	if (KRY_CG == k->method)
+		e = cg(o, k, x, w);
+	else
+		e = gmres(o, k, x, w);
+done:
+	PROF_STOP(ST_ELIM);
+	return e;
+}
+
+static int
+check(const struct krylov *k)
+{
+	if (NULL == k || k->tol < 0 || k->maxit < 0 || k->restart < 1
+	|| (KRY_CG != k->method && KRY_GMRES != k->method)
+	|| (KRY_NONE != k->precond && KRY_JACOBI != k->precond
+	&& KRY_ILU != k->precond))
+		return ALG_EINVAL;
+	return ALG_OK;
+}
+
+/* Solve the system given by the dense n x (n+1) matrix,
+ * the rightmost column being the right hand side, iteratively
+ * with the settings in k, starting from the guess in x;
+ * zeros make a cold start, a previous solution a warm one.
+ * The solution replaces the guess, and the iterations done
+ * and the relative residual reached are left in k.
+ * The matrix is left intact; the workspace of the context
+ * holds the vectors of the method and the preconditioner.
+ * Return ALG_OK, ALG_ECONV if the residual did not get below
+ * the tolerance in time or the method broke down, ALG_ESING
+ * if the preconditioner cannot be made, or another error code. */
+int
+krylov(struct alg *ctx, struct krylov *k, const struct matrix *mtx,
+	double *x)
+{
+	struct op o;
+	long i, j, nnz = 0;
+	int e;
+	if (NULL == mtx || NULL == x || ALG_OK != (e = check(k)))
+		return ALG_EINVAL;
+	if (mtx->rows < 1 || mtx->cols != mtx->rows + 1)
+		return ALG_ESHAPE;
+	memset(&o, 0, sizeof(struct op));
+	o.mtx = mtx;
+	o.n = mtx->rows;
+	if (KRY_ILU == k->precond)
+		for (i = 0; i < o.n; i++)
+			for (j = 0; j < o.n; j++)
+				nnz += 0 != mtx->m[i][j];
+	return solve(ctx, k, &o, nnz, x);
+}
+
+/* As krylov(), for a sparse system. */
+int
+krycsr(struct alg *ctx, struct krylov *k, const struct csr *a, double *x)
+{
+	struct op o;
+	int e;
+	if (NULL == a || NULL == x || ALG_OK != (e = check(k)))
+		return ALG_EINVAL;
+	if (a->n < 1)
+		return ALG_ESHAPE;
+	memset(&o, 0, sizeof(struct op));
+	o.a = a;
+	o.n = a->n;
+	return solve(ctx, k, &o, a->nnz, x);
+}
@@ -0,0 +1,32 @@
+#ifndef _ALGEBRA_KRYLOV_H_
+#define _ALGEBRA_KRYLOV_H_
+
+#include "algebra.h"
+#include "matrix.h"
+#include "sparse.h"
+
+/* The iterative methods. */
+#define KRY_CG		0	/* conjugate gradient, for SPD matrices */
+#define KRY_GMRES	1	/* restarted GMRES, for any */
+
+/* The preconditioners. */
+#define KRY_NONE	0
+#define KRY_JACOBI	1	/* the diagonal */
+#define KRY_ILU		2	/* incomplete LU, with no fill-in */
+
+/* The settings of an iterative solve, and how it went. */
+struct krylov {
+	int	 method;	/* KRY_CG or KRY_GMRES */
+	int	 precond;	/* KRY_NONE, KRY_JACOBI or KRY_ILU */
+	double	 tol;		/* of the relative residual */
+	long	 maxit;		/* give up after this many iterations */
+	long	 restart;	/* the GMRES restart length */
+	long	 iters;		/* iterations done */
+	double	 resid;		/* the relative residual reached */
+};
+
+void	kryinit(struct krylov*);
+int	krylov(struct alg*, struct krylov*, const struct matrix*, double*);
+int	krycsr(struct alg*, struct krylov*, const struct csr*, double*);
+
+#endif
@@ -1,83 +1,224 @@
 #include <unistd.h>
 #include <getopt.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <err.h>
 
 #include "config.h"
+#include "algebra.h"
 #include "matrix.h"
 #include "lincode.h"
+#include "prof.h"
 
 extern const char* __progname;
 
 int cflag = 0;
 int Cflag = 0;
+int dflag = 0;
+int eflag = 0;
 int gflag = 0;
 int Gflag = 0;
+int jobs = 0;
+int Tflag = 0;
+double secs = 0;
 int vflag = 0;
+int wflag = 0;
 
 static void
 usage(void)
 {
 	fprintf(stderr,
-		"usage: %s [-c] [-g] [-v] code [file ...]\n", __progname);
+		"usage: %s [-CcdGgTvw] [-j jobs] [-t secs] code [file ...]\n"
+		"       %s -e [-cgT] [-j jobs] code [file ...]\n",
+		__progname, __progname);
+}
+
+static void
+timing(void)
+{
+	prprof(Tflag > 1);
+}
+
+/* Encode the messages in the file, or on the standard input
+ * if it is NULL, to the standard output. */
+static int
+encfile(struct lincode *lc, const char *file)
+{
+	FILE *fp = stdin;
+	int e;
+	if (file && NULL == (fp = fopen(file, "r"))) {
+		warn("%s", file);
+		return ALG_EIO;
+	}
+	switch (e = encode(lc, fp, stdout, jobs)) {
+	case ALG_OK:
+		break;
+	case ALG_EEMPTY:
+		warnx("Will not encode with a code of dimension 0");
+		break;
+	case ALG_EBIG:
+		warnx("Will not encode with tables of a [%ld, %ld] code",
+		    lc->len, lc->dim);
+		break;
+	default:
+		warnx("Cannot encode '%s': %s", file ? file : "stdin",
+		    algerr(e));
+		break;
+	}
+	if (file)
+		fclose(fp);
+	return e;
 }
 
 int
 main(int argc, char** argv)
 {
-	struct matrix *mtx;
-	struct lincode *lc;
-	int c;
+	struct matrix mtx;
+	struct lincode *lc, *dc;
+	const char *errstr;
+	char *end;
+	uint64_t *dist;
+	long w, lo, hi;
+	int c, e;
 
-	while ((c = getopt(argc, argv, "cCgGv")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "cCdeGgj:t:Tvw")) != -1) switch (c) {
 		case 'c':
 			cflag = 1;
 			break;
 		case 'C':
 			Cflag = 1;
 			break;
+		case 'd':
+			dflag = 1;
+			break;
+		case 'e':
+			eflag = 1;
+			break;
 		case 'g':
 			gflag = 1;
 			break;
 		case 'G':
 			Gflag = 1;
 			break;
+		case 'j':
+			jobs = strtonum(optarg, 1, 1024, &errstr);
+			if (errstr)
+				errx(1, "%s jobs: %s", errstr, optarg);
+			break;
+		case 't':
+			secs = strtod(optarg, &end);
+			if (end == optarg || *end || !(secs > 0))
+				errx(1, "invalid time limit: %s", optarg);
+			break;
+		case 'T':
+			Tflag++;
+			break;
 		case 'v':
 			vflag = 1;
 			break;
+		case 'w':
+			wflag = 1;
+			break;
+		default:
+			usage();
+			return 1;
 	}
 	argc -= optind;
 	argv += optind;
 
-	if (argc == 0) {
+	if (argc == 0
+	|| (eflag && (Cflag || dflag || Gflag || vflag || wflag))) {
 		usage();
 		return 1;
 	}
 
-	if (NULL == (mtx = readmtx(*argv))) {
-		warnx("Cannot read matrix from '%s'", *argv);
+	if (0 == jobs && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		jobs = 1;
+
+	if (Tflag) {
+		profon();
+		atexit(timing);
+	}
+
+	if (ALG_OK != (e = readmtx(*argv, &mtx))) {
+		warnx("Cannot read matrix from '%s': %s", *argv, algerr(e));
 		return 1;
 	}
 
 	if (vflag)
-		prmtx(mtx);
-
-	if (NULL == (lc = calloc(1, sizeof(struct lincode))))
-		err(1, NULL);
-	if (cflag)
-		lc->ctlmtx = mtx;
-	else
-		lc->genmtx = mtx;
-
-	if (-1 == gem(mtx)) {
-		warnx("Cannot GEM the matrix");
-		return -1;
+		prmtx(&mtx);
+
+	PROF_START(ST_ELIM);
+	if (NULL == (lc = mkcode(&mtx, &e))) {
+		warnx("Cannot make a code from the matrix: %s", algerr(e));
+		return 1;
+	}
+	PROF_STOP(ST_ELIM);
+	if (cflag) {
+		dc = lc;
+		if (NULL == (lc = dualcode(dc, &e))) {
+			warnx("Cannot make a code from the control matrix: %s",
+			    algerr(e));
+			return 1;
+		}
+	} else {
+		if (NULL == (dc = dualcode(lc, &e))) {
+			warnx("Cannot figure out the control matrix: %s",
+			    algerr(e));
+			return 1;
+		}
+	}
+
+	if (vflag)
+		printf("[%ld, %ld] code\n", lc->len, lc->dim);
+	if (Gflag)
+		prcode(lc);
+	if (Cflag)
+		prcode(dc);
+
+	if (wflag) {
+		if (NULL == (dist = calloc(lc->len + 1, sizeof(uint64_t))))
+			err(1, NULL);
+		if (ALG_EBIG == (e = weights(lc, dist, jobs))) {
+			warnx("Will not enumerate a code of dimension %ld",
+			    lc->dim);
+			return 1;
+		}
+		if (ALG_OK != e) {
+			warnx("Cannot compute the weight distribution: %s",
+			    algerr(e));
+			return 1;
+		}
+		for (w = 0; w <= lc->len; w++)
+			if (dist[w])
+				printf("%ld %llu\n", w, (unsigned long long) dist[w]);
+		free(dist);
+	}
+
+	if (eflag) {
+		if (1 == argc && ALG_OK != encfile(lc, NULL))
+			return 1;
+		for (w = 1; w < argc; w++)
+			if (ALG_OK != encfile(lc, argv[w]))
+				return 1;
 	}
 
-	if (vflag) {
-		putchar('\n');
-		prmtx(mtx);
+	if (dflag) {
+		if (ALG_OK != (e = mindist(lc, jobs, secs, vflag, &lo, &hi))) {
+			warnx("Cannot compute the minimum distance: %s",
+			    algerr(e));
+			return 1;
+		}
+		if (lo == hi) {
+			printf("%ld\n", lo);
+		} else {
+			warnx("Out of time with %ld <= d <= %ld", lo, hi);
+			printf("%ld %ld\n", lo, hi);
+		}
 	}
 
+	freecode(lc);
+	freecode(dc);
+	freemtx(&mtx);
 	return 0;
 }
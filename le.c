@@ -1,56 +1,527 @@
 #include <unistd.h>
 #include <getopt.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include <err.h>
 
 #include "config.h"
+#include "algebra.h"
 #include "matrix.h"
 #include "lineq.h"
+#include "exact.h"
+#include "batch.h"
+#include "ooc.h"
+#include "sparse.h"
+#include "krylov.h"
+#include "tsqr.h"
+#include "qrup.h"
+#include "prof.h"
 
 extern const char* __progname;
 
+int bflag = 0;
+int iflag = 0;
+int jobs = 0;
+int lflag = 0;
+long tile = 0;
+int sflag = 0;
+int Tflag = 0;
+int uflag = 0;
 int vflag = 0;
+int xflag = 0;
+char *guess = NULL;
+struct krylov kry;
 
 static void
 usage(void)
 {
 	fprintf(stderr,
-		"usage: %s [-g] matrix\n", __progname);
+		"usage: %s [-Tv] [-s | -x] [-j jobs] matrix\n"
+		"       %s [-BT] [-j jobs] -o tile [matrix]\n"
+		"       %s [-Tv] -i method [-e tol] [-n iter] [-p precond]"
+		" [-w guess] matrix\n"
+		"       %s -b | -B [-s] [-j jobs] [stream]\n"
+		"       %s [-T] [-j jobs] -l [matrix]\n"
+		"       %s [-T] -u [matrix]\n",
+		__progname, __progname, __progname, __progname, __progname,
+		__progname);
+}
+
+/* Read a system for the iterative solvers: a dense matrix,
+ * or a sparse one in the Matrix Market format. */
+static int
+rdsys(const char *file, struct matrix *mtx, struct csr *csr)
+{
+	FILE *fp;
+	int c, e;
+	memset(mtx, 0, sizeof(struct matrix));
+	memset(csr, 0, sizeof(struct csr));
+	if (NULL == (fp = fopen(file, "r")))
+		err(1, "%s", file);
+	if ('%' == (c = getc(fp))) {
+		ungetc(c, fp);
+		e = readcsr(fp, csr);
+		fclose(fp);
+		return e;
+	}
+	fclose(fp);
+	return readmtx(file, mtx);
+}
+
+/* Solve the system iteratively, from a guess if there is one. */
+static int
+itsolve(const char *file)
+{
+	struct alg ctx;
+	struct matrix mtx, g;
+	struct csr csr;
+	struct linsol sol;
+	double *x;
+	long n;
+	int e;
+
+	if (ALG_OK != (e = rdsys(file, &mtx, &csr))) {
+		warnx("Cannot read matrix from '%s': %s", file, algerr(e));
+		return 1;
+	}
+	if (vflag && mtx.rows)
+		prmtx(&mtx);
+	n = csr.n ? csr.n : mtx.rows;
+	if (NULL == (x = calloc(n ? n : 1, sizeof(double))))
+		err(1, NULL);
+	if (guess) {
+		if (ALG_OK != (e = readmtx(guess, &g))) {
+			warnx("Cannot read guess from '%s': %s",
+			    guess, algerr(e));
+			return 1;
+		}
+		if (1 != g.rows || n != g.cols)
+			errx(1, "%s: not a row of %ld numbers", guess, n);
+		memcpy(x, g.m[0], n * sizeof(double));
+		freemtx(&g);
+	}
+
+	alginit(&ctx, NULL, 0);
+	e = csr.n ? krycsr(&ctx, &kry, &csr, x) : krylov(&ctx, &kry, &mtx, x);
+	if (vflag || ALG_ECONV == e)
+		warnx("%ld iterations, relative residual %e",
+		    kry.iters, kry.resid);
+	if (ALG_OK != e) {
+		warnx("Cannot solve equations: %s", algerr(e));
+		return 1;
+	}
+	memset(&sol, 0, sizeof(struct linsol));
+	sol.len = n;
+	sol.par = x;
+	PROF_START(ST_OUTPUT);
+	prsol(&sol);
+	PROF_STOP(ST_OUTPUT);
+	algfree(&ctx);
+	freecsr(&csr);
+	freemtx(&mtx);
+	free(x);
+	return 0;
+}
+
+static void
+timing(void)
+{
+	prprof(Tflag > 1);
+}
+
+/* Solve a tall system in the least squares sense as it streams in,
+ * printing the solution and the norm of the residual. */
+static int
+lsolve(const char *file)
+{
+	struct alg ctx;
+	struct linsol sol;
+	double resid;
+	int e;
+
+	if (file && NULL == freopen(file, "r", stdin))
+		err(1, "%s", file);
+	if (Tflag) {
+		profon();
+		atexit(timing);
+	}
+	alginit(&ctx, NULL, 0);
+	if (ALG_OK != (e = tsqr(&ctx, stdin, jobs, &sol, &resid))) {
+		warnx("Cannot solve equations: %s", algerr(e));
+		algfree(&ctx);
+		return 1;
+	}
+	PROF_START(ST_OUTPUT);
+	prsol(&sol);
+	printf("% e\n", resid);
+	PROF_STOP(ST_OUTPUT);
+	algfree(&ctx);
+	return 0;
+}
+
+/* Parse the numbers on the rest of a line into a,
+ * which has room for max of them and grows as needed.
+ * Return the count of the numbers, or -1 on error. */
+static long
+nums(const char *p, double **a, long *max)
+{
+	double *new;
+	char *end;
+	long num;
+	for (num = 0; ; num++, p = end) {
+		if (num == *max) {
+			*max = *max ? 2 * *max : 1024;
+			if (NULL == (new = reallocarray(*a, *max,
+			    sizeof(double))))
+				err(1, NULL);
+			*a = new;
+		}
+		(*a)[num] = strtod(p, &end);
+		if (end == p)
+			break;
+	}
+	p += strspn(p, " \t\r\n");
+	return *p ? -1 : num;
+}
+
+/* Keep the factorization of a system up to date as the commands
+ * on the standard input change it, starting with the system
+ * in the file if there is one; see le(1) for the commands. */
+static int
+usolve(const char *file)
+{
+	struct alg ctx;
+	struct qrup qr;
+	struct matrix mtx;
+	struct linsol sol;
+	char *line = NULL, *p, *name;
+	size_t size = 0;
+	ssize_t len;
+	double *a = NULL;
+	long num, max = 0, lineno = 0, r;
+	FILE *fp;
+	int c, e, bad = 0;
+
+	memset(&qr, 0, sizeof(struct qrup));
+	if (file) {
+		if (ALG_OK != (e = readmtx(file, &mtx))) {
+			warnx("Cannot read matrix from '%s': %s",
+			    file, algerr(e));
+			return 1;
+		}
+		e = qrinit(&qr, mtx.cols);
+		for (r = 0; ALG_OK == e && r < mtx.rows; r++)
+			e = qradd(&qr, mtx.m[r]);
+		freemtx(&mtx);
+		if (ALG_OK != e) {
+			warnx("Cannot factor '%s': %s", file, algerr(e));
+			qrfree(&qr);
+			return 1;
+		}
+	}
+	alginit(&ctx, NULL, 0);
+	while ((len = getline(&line, &size, stdin)) != -1) {
+		lineno++;
+		PROF_COUNT(CT_BYTES, len);
+		p = line + strspn(line, " \t\r\n");
+		if ('\0' == *p)
+			continue;
+		c = *p++;
+		e = ALG_OK;
+		if ('l' == c || 'w' == c) {
+			name = p + strspn(p, " \t");
+			name[strcspn(name, "\r\n")] = '\0';
+			if (NULL == (fp = fopen(name, 'l' == c ? "r" : "w"))) {
+				warn("line %ld: %s", lineno, name);
+				bad = 1;
+				continue;
+			}
+			if ('l' == c) {
+				qrfree(&qr);
+				e = qrload(fp, &qr);
+			} else
+				e = qr.n ? qrsave(fp, &qr) : ALG_EINVAL;
+			if (fclose(fp) && ALG_OK == e)
+				e = ALG_EIO;
+		} else if (NULL == strchr("abcdrsu", c)) {
+			warnx("line %ld: unknown command '%c'", lineno, c);
+			bad = 1;
+			continue;
+		} else if (-1 == (num = nums(p, &a, &max))) {
+			e = ALG_EPARSE;
+		} else switch (c) {
+		case 'a':
+			if (0 == qr.n)
+				e = qrinit(&qr, num);
+			if (ALG_OK == e)
+				e = num != qr.n ? ALG_EDIM : qradd(&qr, a);
+			break;
+		case 'b':
+			e = num != qr.m ? ALG_EDIM : qrrhs(&qr, a);
+			break;
+		case 'c':
+			e = num != qr.n + 1 || !(a[0] >= 1 && a[0] <= qr.m)
+			    || a[0] != (long) a[0] ? ALG_EDIM
+			    : qrrow(&qr, (long) a[0] - 1, a + 1);
+			break;
+		case 'd':
+			e = num != 1 || !(a[0] >= 1 && a[0] <= qr.m)
+			    || a[0] != (long) a[0] ? ALG_EDIM
+			    : qrdel(&qr, (long) a[0] - 1);
+			break;
+		case 'u':
+			e = num != qr.m + qr.n ? ALG_EDIM
+			    : qrrank1(&qr, a, a + qr.m);
+			break;
+		case 'r':
+		case 's':
+			if (num) {
+				e = ALG_EDIM;
+				break;
+			}
+			if (ALG_OK != (e = qrsolve(&ctx, &qr, &sol)))
+				break;
+			PROF_START(ST_OUTPUT);
+			if ('r' == c)
+				printf("%ld %ld\n", qr.rank, qr.gcol);
+			else if (sol.par)
+				prsol(&sol);
+			else
+				putchar('\n');
+			fflush(stdout);
+			PROF_STOP(ST_OUTPUT);
+			break;
+		}
+		if (ALG_OK != e) {
+			warnx("line %ld: %s", lineno, algerr(e));
+			bad = 1;
+		}
+	}
+	if (ferror(stdin))
+		bad = 1;
+	free(line);
+	free(a);
+	qrfree(&qr);
+	algfree(&ctx);
+	return bad;
 }
 
 int
 main(int argc, char** argv)
 {
-	struct matrix *mtx;
-	struct linsol *sol;
-	int c;
+	struct alg ctx;
+	struct matrix mtx;
+	struct linsol sol;
+	struct xsol *xsol;
+	const char *errstr;
+	char *end;
+	int c, e, kflag = 0;
 
-	while ((c = getopt(argc, argv, "v")) != -1) switch (c) {
+	kryinit(&kry);
+	while ((c = getopt(argc, argv, "bBe:i:j:ln:o:p:sTuvw:x")) != -1)
+	switch (c) {
+		case 'b':
+			bflag = 1;
+			break;
+		case 'B':
+			bflag = 2;
+			break;
+		case 'e':
+			kry.tol = strtod(optarg, &end);
+			if (end == optarg || *end || kry.tol < 0)
+				errx(1, "invalid tolerance: %s", optarg);
+			kflag = 1;
+			break;
+		case 'i':
+			iflag = 1;
+			if (0 == strcmp(optarg, "cg"))
+				kry.method = KRY_CG;
+			else if (0 == strcmp(optarg, "gmres"))
+				kry.method = KRY_GMRES;
+			else
+				errx(1, "unknown method: %s", optarg);
+			break;
+		case 'j':
+			jobs = strtonum(optarg, 1, 1024, &errstr);
+			if (errstr)
+				errx(1, "%s jobs: %s", errstr, optarg);
+			break;
+		case 'l':
+			lflag = 1;
+			break;
+		case 'n':
+			kry.maxit = strtonum(optarg, 0, LONG_MAX, &errstr);
+			if (errstr)
+				errx(1, "%s iterations: %s", errstr, optarg);
+			kflag = 1;
+			break;
+		case 'o':
+			tile = strtonum(optarg, 1, 65536, &errstr);
+			if (errstr)
+				errx(1, "%s tile: %s", errstr, optarg);
+			break;
+		case 'p':
+			if (0 == strcmp(optarg, "none"))
+				kry.precond = KRY_NONE;
+			else if (0 == strcmp(optarg, "jacobi"))
+				kry.precond = KRY_JACOBI;
+			else if (0 == strcmp(optarg, "ilu"))
+				kry.precond = KRY_ILU;
+			else
+				errx(1, "unknown preconditioner: %s", optarg);
+			kflag = 1;
+			break;
+		case 's':
+			sflag = 1;
+			break;
+		case 'T':
+			Tflag++;
+			break;
+		case 'u':
+			uflag = 1;
+			break;
 		case 'v':
 			vflag = 1;
 			break;
+		case 'w':
+			guess = optarg;
+			break;
+		case 'x':
+			xflag = 1;
+			break;
+		default:
+			usage();
+			return 1;
 	}
 	argc -= optind;
 	argv += optind;
 
+	if (0 == jobs && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		jobs = 1;
+
+	/* the options of the iterations only go with -i */
+	if ((sflag && xflag) || (!iflag && (kflag || guess))) {
+		usage();
+		return 1;
+	}
+
+	if (iflag) {
+		if (1 != argc || bflag || lflag || sflag || tile || uflag
+		|| xflag) {
+			usage();
+			return 1;
+		}
+		if (Tflag) {
+			profon();
+			atexit(timing);
+		}
+		return itsolve(*argv);
+	}
+
+	if (uflag) {
+		if (argc > 1 || bflag || iflag || lflag || sflag || tile
+		|| vflag || xflag) {
+			usage();
+			return 1;
+		}
+		if (Tflag) {
+			profon();
+			atexit(timing);
+		}
+		return usolve(argc ? *argv : NULL);
+	}
+
+	if (lflag) {
+		if (argc > 1 || bflag || iflag || sflag || tile || vflag
+		|| xflag) {
+			usage();
+			return 1;
+		}
+		return lsolve(argc ? *argv : NULL);
+	}
+
+	if (tile) {
+		if (argc > 1 || xflag || sflag || 1 == bflag) {
+			usage();
+			return 1;
+		}
+		if (argc && NULL == freopen(*argv, "r", stdin))
+			err(1, "%s", *argv);
+		if (Tflag) {
+			profon();
+			atexit(timing);
+		}
+		alginit(&ctx, NULL, 0);
+		if (ALG_OK != (e = oocsolve(&ctx, stdin, bflag, tile, jobs,
+		    &sol))) {
+			warnx("Cannot solve equations: %s", algerr(e));
+			return 1;
+		}
+		PROF_START(ST_OUTPUT);
+		prsol(&sol);
+		PROF_STOP(ST_OUTPUT);
+		algfree(&ctx);
+		return 0;
+	}
+
+	if (bflag) {
+		if (argc > 1 || xflag) {
+			usage();
+			return 1;
+		}
+		if (argc && NULL == freopen(*argv, "r", stdin))
+			err(1, "%s", *argv);
+		return batch(stdin, stdout, bflag > 1, sflag, jobs) ? 1 : 0;
+	}
+
 	if (1 != argc) {
 		usage();
 		return 1;
 	}
 
-	if (NULL == (mtx = readmtx(*argv))) {
-		warnx("Cannot read matrix from '%s'", *argv);
+	if (Tflag) {
+		profon();
+		atexit(timing);
+	}
+
+	if (ALG_OK != (e = readmtx(*argv, &mtx))) {
+		warnx("Cannot read matrix from '%s': %s", *argv, algerr(e));
 		return 1;
 	}
 
 	if (vflag)
-		prmtx(mtx);
+		prmtx(&mtx);
+
+	if (xflag) {
+		if (NULL == (xsol = xsolve(&mtx, jobs, &e))) {
+			warnx("Cannot solve equations exactly: %s", algerr(e));
+			return 1;
+		}
+		PROF_START(ST_OUTPUT);
+		e = prxsol(xsol);
+		PROF_STOP(ST_OUTPUT);
+		freexsol(xsol);
+		freemtx(&mtx);
+		if (ALG_OK != e) {
+			warnx("Cannot print the solution: %s", algerr(e));
+			return 1;
+		}
+		return 0;
+	}
 
-	if (NULL == (sol = linsolve(mtx))) {
-		warnx("Cannot solve equations");
-		return -1;
+	alginit(&ctx, NULL, 0);
+	ctx.mixed = sflag;
+	if (ALG_OK != (e = linsolve(&ctx, &mtx, &sol))) {
+		warnx("Cannot solve equations: %s", algerr(e));
+		return 1;
 	}
 
-	prsol(sol);
+	PROF_START(ST_OUTPUT);
+	prsol(&sol);
+	PROF_STOP(ST_OUTPUT);
+	algfree(&ctx);
+	freemtx(&mtx);
 	return 0;
 }
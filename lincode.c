@@ -1,7 +1,916 @@
-/*
-#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
-#include <err.h>
-*/
+#include <time.h>
 
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
 #include "lincode.h"
+#include "prof.h"
+
+#if HAVE_POPCOUNT
+#define POPCNT(x)	__builtin_popcountll(x)
+#define CTZ(x)		__builtin_ctzll(x)
+#else
+#define POPCNT(x)	popcnt(x)
+#define CTZ(x)		ctz(x)
+
+static int
+popcnt(uint64_t x)
+{
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (x * 0x0101010101010101ULL) >> 56;
+}
+
+static int
+ctz(uint64_t x)
+{
+	int n = 0;
+	while (0 == (x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+}
+#endif
+
+#if HAVE_ATOMIC
+#define ALOAD(p)	__atomic_load_n((p), __ATOMIC_RELAXED)
+#define ASTORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define AFETCHADD(p, v)	__atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define AMIN(p, v)	amin((p), (v))
+
+static void
+amin(long *p, long v)
+{
+	long o = __atomic_load_n(p, __ATOMIC_RELAXED);
+	while (v < o && !__atomic_compare_exchange_n(p, &o, v, 0,
+	    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+#else
+#define ALOAD(p)	alocked((p), 0, 0)
+#define ASTORE(p, v)	alocked((p), 1, (v))
+#define AFETCHADD(p, v)	alocked((p), 2, (v))
+#define AMIN(p, v)	alocked((p), 3, (v))
+
+static pthread_mutex_t amtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* Without atomics, serialize the access to the shared bounds. */
+static long
+alocked(long *p, int op, long v)
+{
+	long o;
+	pthread_mutex_lock(&amtx);
+	o = *p;
+	if (1 == op)
+		*p = v;
+	else if (2 == op)
+		*p += v;
+	else if (3 == op && v < *p)
+		*p = v;
+	pthread_mutex_unlock(&amtx);
+	return o;
+}
+#endif
+
+#define ROW(lc, r)	((lc)->gen + (r) * (lc)->wpr)
+#define BIT(w, c)	(((w)[(c) / 64] >> ((c) % 64)) & 1)
+#define SETBIT(w, c)	((w)[(c) / 64] |= 1ULL << ((c) % 64))
+
+/* The two primes we do the MacWilliams transform modulo. */
+#define P1	2147483647ULL
+#define P2	2147483629ULL
+
+/* Return a zero code, or NULL if it cannot be allocated. */
+static struct lincode*
+newcode(long len, long dim)
+{
+	struct lincode *lc;
+	if (NULL == (lc = calloc(1, sizeof(struct lincode))))
+		return NULL;
+	lc->len = len;
+	lc->dim = dim;
+	lc->wpr = (len + 63) / 64;
+	if (dim && NULL == (lc->gen = calloc(dim * lc->wpr, sizeof(uint64_t)))) {
+		free(lc);
+		return NULL;
+	}
+	return lc;
+}
+
+/* Make a binary linear code from the generating matrix, reading its
+ * entries modulo 2. The rows get reduced into a systematic form,
+ * dropping the dependent ones, so the dimension is the actual rank.
+ * Return the code, or NULL on error, with ALG_OK or the error code
+ * in err unless it is NULL: ALG_EINVAL for an empty matrix,
+ * or ALG_ENOMEM. */
+struct lincode*
+mkcode(struct matrix *mtx, int *err)
+{
+	struct lincode *lc = NULL;
+	long r, c;
+	int e = ALG_OK;
+	if (NULL == mtx || 0 == mtx->rows || 0 == mtx->cols) {
+		e = ALG_EINVAL;
+		goto out;
+	}
+	if (NULL == (lc = newcode(mtx->cols, mtx->rows))) {
+		e = ALG_ENOMEM;
+		goto out;
+	}
+	lc->genmtx = mtx;
+	for (r = 0; r < mtx->rows; r++)
+		for (c = 0; c < mtx->cols; c++)
+			if (((long) mtx->m[r][c]) % 2)
+				SETBIT(ROW(lc, r), c);
+	if (ALG_OK != (e = syscode(lc, NULL))) {
+		freecode(lc);
+		lc = NULL;
+	}
+out:
+	if (err)
+		*err = e;
+	return lc;
+}
+
+void
+freecode(struct lincode *lc)
+{
+	if (lc) {
+		free(lc->gen);
+		free(lc->piv);
+		free(lc);
+	}
+}
+
+void
+prcode(struct lincode *lc)
+{
+	long r, c;
+	if (NULL == lc)
+		return;
+	for (r = 0; r < lc->dim; r++) {
+		for (c = 0; c < lc->len; c++)
+			printf("%s%d", c ? " " : "", (int) BIT(ROW(lc, r), c));
+		putchar('\n');
+	}
+}
+
+/* Reduce the generating matrix into the reduced row echelon form,
+ * looking for the pivots in the given order of columns
+ * (or left to right if the order is NULL). The pivot columns
+ * then form an information set. Dependent rows get dropped.
+ * Return ALG_OK or an error code. */
+int
+syscode(struct lincode *lc, const long *order)
+{
+	uint64_t *A, *B, t;
+	long i, c, r, p, j, rank = 0;
+	if (NULL == lc)
+		return ALG_EINVAL;
+	free(lc->piv);
+	if (NULL == (lc->piv = calloc(lc->dim + 1, sizeof(long))))
+		return ALG_ENOMEM;
+	for (i = 0; i < lc->len && rank < lc->dim; i++) {
+		c = order ? order[i] : i;
+		if (c < 0 || c >= lc->len)
+			return ALG_EINVAL;
+		for (p = rank; p < lc->dim; p++)
+			if (BIT(ROW(lc, p), c))
+				break;
+		if (p == lc->dim)
+			continue;
+		A = ROW(lc, rank);
+		if (p != rank) {
+			for (B = ROW(lc, p), j = 0; j < lc->wpr; j++) {
+				t = A[j];
+				A[j] = B[j];
+				B[j] = t;
+			}
+		}
+		for (r = 0; r < lc->dim; r++) {
+			if (r == rank || 0 == BIT(ROW(lc, r), c))
+				continue;
+			for (B = ROW(lc, r), j = 0; j < lc->wpr; j++)
+				B[j] ^= A[j];
+		}
+		lc->piv[rank++] = c;
+	}
+	lc->dim = rank;
+	return ALG_OK;
+}
+
+/* Return the dual code, generated by the control matrix.
+ * With G = (I|P) in the pivot columns, the dual is (P^T|I).
+ * Return NULL on error, with the error code in err as mkcode() does. */
+struct lincode*
+dualcode(struct lincode *lc, int *err)
+{
+	struct lincode *dc = NULL;
+	char *ispiv = NULL;
+	long r, c, d;
+	int e = ALG_OK;
+	if (NULL == lc) {
+		e = ALG_EINVAL;
+		goto out;
+	}
+	if (NULL == lc->piv && ALG_OK != (e = syscode(lc, NULL)))
+		goto out;
+	if (NULL == (ispiv = calloc(lc->len, sizeof(char)))
+	||  NULL == (dc = newcode(lc->len, lc->len - lc->dim))) {
+		e = ALG_ENOMEM;
+		goto out;
+	}
+	for (r = 0; r < lc->dim; r++)
+		ispiv[lc->piv[r]] = 1;
+	for (c = 0, d = 0; c < lc->len; c++) {
+		if (ispiv[c])
+			continue;
+		SETBIT(ROW(dc, d), c);
+		for (r = 0; r < lc->dim; r++)
+			if (BIT(ROW(lc, r), c))
+				SETBIT(ROW(dc, d), lc->piv[r]);
+		d++;
+	}
+	if (ALG_OK != (e = syscode(dc, NULL))) {
+		freecode(dc);
+		dc = NULL;
+	}
+out:
+	free(ispiv);
+	if (err)
+		*err = e;
+	return dc;
+}
+
+struct wjob {
+	struct lincode	*lc;
+	uint64_t	lo;
+	uint64_t	hi;
+	uint64_t	*dist;
+	uint64_t	*w;	/* scratch, a codeword */
+};
+
+/* Count the weights of the codewords lo to hi-1, in Gray code order:
+ * the i-th codeword differs from the previous one by the generator
+ * indexed by the lowest set bit of i, so each step is one XOR. */
+static void*
+wenum(void *arg)
+{
+	struct wjob *job = arg;
+	struct lincode *lc = job->lc;
+	uint64_t *w = job->w, *g, i, gray, x;
+	long r, j, wt;
+	gray = job->lo ^ (job->lo >> 1);
+	for (r = 0; r < lc->dim; r++)
+		if ((gray >> r) & 1)
+			for (g = ROW(lc, r), j = 0; j < lc->wpr; j++)
+				w[j] ^= g[j];
+	for (wt = 0, j = 0; j < lc->wpr; j++)
+		wt += POPCNT(w[j]);
+	job->dist[wt]++;
+	if (1 == lc->wpr) {
+		for (x = w[0], i = job->lo + 1; i < job->hi; i++) {
+			x ^= lc->gen[CTZ(i)];
+			job->dist[POPCNT(x)]++;
+		}
+	} else {
+		for (i = job->lo + 1; i < job->hi; i++) {
+			g = ROW(lc, CTZ(i));
+			for (wt = 0, j = 0; j < lc->wpr; j++) {
+				w[j] ^= g[j];
+				wt += POPCNT(w[j]);
+			}
+			job->dist[wt]++;
+		}
+	}
+	return NULL;
+}
+
+/* Enumerate all the codewords, splitting them into consecutive ranges
+ * among the given number of jobs; the ranges no thread can be had for
+ * get enumerated here. Return ALG_OK or ALG_ENOMEM. */
+static int
+enumerate(struct lincode *lc, uint64_t *dist, int jobs)
+{
+	struct wjob *job;
+	uint64_t total, step, *scr;
+	long j, w;
+	int e = ALG_OK;
+	total = 1ULL << lc->dim;
+	if (jobs < 1)
+		jobs = 1;
+	if ((uint64_t) jobs > total)
+		jobs = total;
+	job = calloc(jobs, sizeof(struct wjob));
+	scr = calloc(jobs * (lc->len + 1 + lc->wpr), sizeof(uint64_t));
+	if (NULL == job || NULL == scr) {
+		e = ALG_ENOMEM;
+		goto out;
+	}
+	for (step = total / jobs, j = 0; j < jobs; j++) {
+		job[j].lc = lc;
+		job[j].lo = j * step;
+		job[j].hi = (j == jobs - 1) ? total : (j + 1) * step;
+		job[j].dist = scr + j * (lc->len + 1 + lc->wpr);
+		job[j].w = job[j].dist + lc->len + 1;
+	}
+	algjobs(wenum, job, sizeof(struct wjob), jobs);
+	memset(dist, 0, (lc->len + 1) * sizeof(uint64_t));
+	for (j = 0; j < jobs; j++)
+		for (w = 0; w <= lc->len; w++)
+			dist[w] += job[j].dist[w];
+out:
+	free(job);
+	free(scr);
+	return e;
+}
+
+static uint64_t
+powmod(uint64_t b, uint64_t e, uint64_t p)
+{
+	uint64_t r = 1;
+	for (b %= p; e; e >>= 1, b = b * b % p)
+		if (e & 1)
+			r = r * b % p;
+	return r;
+}
+
+/* Compute the weight distribution of a code of dimension k
+ * from the distribution B of its dual, using the MacWilliams identity
+ * A_j = 2^(k-n) sum_i B_i K_j(i) with the Krawtchouk polynomials
+ * (j+1) K_j+1(i) = (n-2i) K_j(i) - (n-j+1) K_j-1(i).
+ * This is done modulo two primes and put together with the CRT,
+ * which is exact as long as all A_j < P1 P2.
+ * Return ALG_OK or ALG_ENOMEM. */
+static int
+macwilliams(long n, long k, const uint64_t *B, uint64_t *A)
+{
+	const uint64_t prime[2] = { P1, P2 };
+	uint64_t *scr, *K0, *K1, *Kt, *a[2], p, S, inv, x;
+	long i, j, q;
+	if (NULL == (scr = calloc(4 * (n + 1), sizeof(uint64_t))))
+		return ALG_ENOMEM;
+	K0 = scr;
+	K1 = scr + (n + 1);
+	a[0] = scr + 2 * (n + 1);
+	a[1] = scr + 3 * (n + 1);
+	for (q = 0; q < 2; q++) {
+		p = prime[q];
+		inv = powmod(powmod(2, n - k, p), p - 2, p);
+		for (i = 0; i <= n; i++) {
+			K0[i] = 0;
+			K1[i] = 1;
+		}
+		for (j = 0; j <= n; j++) {
+			for (S = 0, i = 0; i <= n; i++)
+				if (B[i])
+					S = (S + B[i] % p * K1[i]) % p;
+			a[q][j] = S * inv % p;
+			/* K1 = K_j, K0 = K_j-1; make K0 = K_j+1 */
+			x = powmod(j + 1, p - 2, p);
+			for (i = 0; i <= n; i++) {
+				K0[i] = ((n - 2 * i + (int64_t) p) % p * K1[i]
+				    + (p - (n - j + 1) % p) % p * K0[i]) % p;
+				K0[i] = K0[i] * x % p;
+			}
+			Kt = K0;
+			K0 = K1;
+			K1 = Kt;
+		}
+	}
+	inv = powmod(P1 % P2, P2 - 2, P2);
+	for (j = 0; j <= n; j++)
+		A[j] = a[0][j] + P1 * ((a[1][j] + P2 - a[0][j] % P2) % P2 * inv % P2);
+	free(scr);
+	return ALG_OK;
+}
+
+/* Fill in the weight distribution of the code: dist[w] is the number
+ * of codewords of weight w, for w = 0, ..., len. If the dual code
+ * is smaller, enumerate that and use the MacWilliams identity.
+ * Return ALG_OK or an error code: ALG_EBIG if the code has more
+ * than LC_MAXENUM dimensions. */
+int
+weights(struct lincode *lc, uint64_t *dist, int jobs)
+{
+	struct lincode *dc;
+	uint64_t *B;
+	int e;
+	if (NULL == lc || NULL == dist)
+		return ALG_EINVAL;
+	if (NULL == lc->piv && ALG_OK != (e = syscode(lc, NULL)))
+		return e;
+	if (lc->dim > LC_MAXENUM)
+		return ALG_EBIG;
+	if (lc->dim <= lc->len - lc->dim)
+		return enumerate(lc, dist, jobs);
+	if (NULL == (dc = dualcode(lc, &e)))
+		return e;
+	if (NULL == (B = calloc(lc->len + 1, sizeof(uint64_t)))) {
+		freecode(dc);
+		return ALG_ENOMEM;
+	}
+	if (ALG_OK == (e = enumerate(dc, B, jobs)))
+		e = macwilliams(lc->len, lc->dim, B, dist);
+	freecode(dc);
+	free(B);
+	return e;
+}
+
+/* Brouwer-Zimmermann: a codeword of weight d has at most d-1 ones
+ * outside any information set. Having enumerated all combinations
+ * of up to w rows of a systematic generating matrix, all codewords
+ * not seen yet have more than w ones in its information set.
+ * With more information sets, these lower bounds add up. */
+
+struct bz {
+	struct lincode	*cur;	/* the matrix being enumerated */
+	long		w;	/* the number of rows to combine */
+	long		next;	/* the next first row to take */
+	long		upper;	/* the least weight found */
+	long		stop;	/* the time budget is exhausted */
+	double		deadline;
+};
+
+struct bzjob {
+	struct bz	*bz;
+	uint64_t	*acc;	/* partial sums, one per level */
+	long		best;
+	unsigned long	leaves;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bzleaf(struct bzjob *job, long wt)
+{
+	struct bz *bz = job->bz;
+	if (wt < job->best) {
+		job->best = wt;
+		AMIN(&bz->upper, wt);
+	}
+	if (0 == (++job->leaves & 0xffff) && bz->deadline > 0
+	&& now() > bz->deadline)
+		ASTORE(&bz->stop, 1);
+}
+
+/* Add all combinations of the remaining rows from start on
+ * to the partial sum of the d rows chosen so far. */
+static void
+bzcomb(struct bzjob *job, long d, long start, const uint64_t *acc)
+{
+	struct lincode *lc = job->bz->cur;
+	uint64_t *nxt = job->acc + d * lc->wpr, *g;
+	long i, j, wt, last = lc->dim - (job->bz->w - d);
+	for (i = start; i <= last && !ALOAD(&job->bz->stop); i++) {
+		g = ROW(lc, i);
+		if (d + 1 == job->bz->w) {
+			for (wt = 0, j = 0; j < lc->wpr; j++)
+				wt += POPCNT(acc[j] ^ g[j]);
+			bzleaf(job, wt);
+			continue;
+		}
+		for (j = 0; j < lc->wpr; j++)
+			nxt[j] = acc[j] ^ g[j];
+		bzcomb(job, d + 1, i + 1, nxt);
+	}
+}
+
+static void*
+bzwork(void *arg)
+{
+	struct bzjob *job = arg;
+	struct bz *bz = job->bz;
+	struct lincode *lc = bz->cur;
+	long i, wt, j;
+	while (!ALOAD(&bz->stop)
+	&& (i = AFETCHADD(&bz->next, 1)) <= lc->dim - bz->w) {
+		if (1 == bz->w) {
+			for (wt = 0, j = 0; j < lc->wpr; j++)
+				wt += POPCNT(ROW(lc, i)[j]);
+			bzleaf(job, wt);
+		} else {
+			bzcomb(job, 1, i + 1, ROW(lc, i));
+		}
+	}
+	return NULL;
+}
+
+/* Return a copy of the code, without its pivots,
+ * or NULL if it cannot be allocated. */
+static struct lincode*
+copycode(struct lincode *lc)
+{
+	struct lincode *cp;
+	if (NULL == (cp = newcode(lc->len, lc->dim)))
+		return NULL;
+	memcpy(cp->gen, lc->gen, lc->dim * lc->wpr * sizeof(uint64_t));
+	return cp;
+}
+
+/* Find the minimum distance by the Brouwer-Zimmermann algorithm,
+ * splitting the combinations to enumerate among the jobs; those
+ * no thread can be had for get enumerated here. Stop after the given
+ * number of seconds, if positive. Fill in the bounds reached on the
+ * distance, which differ if time ran out.
+ * Return ALG_OK or ALG_ENOMEM. */
+static int
+bzdist(struct lincode *lc, int jobs, double secs, int verbose,
+	long *lo, long *hi)
+{
+	struct lincode **G = NULL, **g;
+	struct bzjob *job = NULL;
+	struct bz bz;
+	char *used;
+	long *order, *rank = NULL, *rk, m, nmat = 0, o, c, r, j, t, lower;
+	double start = now();
+	int e = ALG_OK;
+	used = calloc(lc->len, sizeof(char));
+	order = calloc(lc->len, sizeof(long));
+	if (NULL == used || NULL == order) {
+		e = ALG_ENOMEM;
+		goto out;
+	}
+	/* find as many disjoint information sets as we can;
+	 * the last ones are just mostly disjoint from the previous */
+	for (;;) {
+		for (o = 0, c = 0; c < lc->len; c++)
+			if (!used[c])
+				order[o++] = c;
+		for (c = 0; c < lc->len; c++)
+			if (used[c])
+				order[o++] = c;
+		if (NULL == (g = reallocarray(G, nmat + 1, sizeof(*G)))) {
+			e = ALG_ENOMEM;
+			goto out;
+		}
+		G = g;
+		if (NULL == (rk = reallocarray(rank, nmat + 1, sizeof(long)))) {
+			e = ALG_ENOMEM;
+			goto out;
+		}
+		rank = rk;
+		if (NULL == (G[nmat] = copycode(lc))) {
+			e = ALG_ENOMEM;
+			goto out;
+		}
+		if (ALG_OK != (e = syscode(G[nmat], order))) {
+			freecode(G[nmat]);
+			goto out;
+		}
+		for (rank[nmat] = 0, r = 0; r < lc->dim; r++)
+			if (!used[G[nmat]->piv[r]]) {
+				used[G[nmat]->piv[r]] = 1;
+				rank[nmat]++;
+			}
+		if (0 == rank[nmat]) {
+			freecode(G[nmat]);
+			break;
+		}
+		nmat++;
+	}
+	if (verbose)
+		fprintf(stderr, "%ld information sets\n", nmat);
+
+	memset(&bz, 0, sizeof(struct bz));
+	bz.upper = lc->len;
+	bz.deadline = secs > 0 ? start + secs : 0;
+	if (jobs < 1)
+		jobs = 1;
+	if (NULL == (job = calloc(jobs, sizeof(struct bzjob)))) {
+		e = ALG_ENOMEM;
+		goto out;
+	}
+	for (j = 0; j < jobs; j++) {
+		job[j].bz = &bz;
+		if (NULL == (job[j].acc
+		= calloc((lc->dim + 1) * lc->wpr, sizeof(uint64_t)))) {
+			e = ALG_ENOMEM;
+			goto out;
+		}
+	}
+	lower = 1;
+	for (bz.w = 1; bz.w <= lc->dim && lower < ALOAD(&bz.upper); bz.w++) {
+		for (m = 0; m < nmat && lower < ALOAD(&bz.upper); m++) {
+			bz.cur = G[m];
+			bz.next = 0;
+			for (j = 0; j < jobs; j++)
+				job[j].best = lc->len + 1;
+			algjobs(bzwork, job, sizeof(struct bzjob), jobs);
+			if (ALOAD(&bz.stop))
+				goto done;
+			/* matrices up to m are done with w rows,
+			 * the rest with w-1 rows */
+			for (lower = 0, t = 0; t < nmat; t++) {
+				o = (t <= m ? bz.w + 1 : bz.w) - (lc->dim - rank[t]);
+				lower += o > 0 ? o : 0;
+			}
+			if (verbose)
+				fprintf(stderr, "w=%ld G%ld: %ld <= d <= %ld, %.1fs\n",
+				    bz.w, m, lower, ALOAD(&bz.upper), now() - start);
+		}
+	}
+done:
+	*hi = ALOAD(&bz.upper);
+	*lo = lower < *hi ? lower : *hi;
+	if (bz.w > lc->dim && !bz.stop)
+		*lo = *hi;
+out:
+	for (j = 0; job && j < jobs; j++)
+		free(job[j].acc);
+	free(job);
+	for (m = 0; m < nmat; m++)
+		freecode(G[m]);
+	free(G);
+	free(rank);
+	free(used);
+	free(order);
+	return e;
+}
+
+/* Find the minimum distance of the code, i.e. the minimal weight
+ * of a nonzero codeword, or 0 for the zero code. Small codes
+ * (or codes with a small dual) get enumerated, larger ones,
+ * and those whose weight distribution would not fit in 64 bits,
+ * are searched with Brouwer-Zimmermann for at most secs seconds
+ * (if positive), reporting progress on stderr if verbose.
+ * Fill in the lower and upper bound on the distance,
+ * which differ if time ran out.
+ * Return ALG_OK or an error code. */
+int
+mindist(struct lincode *lc, int jobs, double secs, int verbose,
+	long *lo, long *hi)
+{
+	uint64_t *dist;
+	long w;
+	int e;
+	if (NULL == lc || NULL == lo || NULL == hi)
+		return ALG_EINVAL;
+	if (NULL == lc->piv && ALG_OK != (e = syscode(lc, NULL)))
+		return e;
+	if (0 == lc->dim) {
+		*lo = *hi = 0;
+		return ALG_OK;
+	}
+	if (lc->dim > LC_MAXENUM
+	|| (lc->dim > LC_MAXWALK && lc->len - lc->dim > LC_MAXWALK))
+		return bzdist(lc, jobs, secs, verbose, lo, hi);
+	if (NULL == (dist = calloc(lc->len + 1, sizeof(uint64_t))))
+		return ALG_ENOMEM;
+	if (ALG_OK != (e = weights(lc, dist, jobs))) {
+		free(dist);
+		return e;
+	}
+	for (w = 1; w <= lc->len; w++)
+		if (dist[w])
+			break;
+	free(dist);
+	*lo = *hi = w;
+	return ALG_OK;
+}
+
+/* Encode the messages a block at a time, a whole number of bytes
+ * of both the messages and the codewords in a block of about this
+ * many bytes of the input. */
+#define ENCBLOCK	(1L << 20)
+
+/* The Four Russians encoder: each byte of a message selects one
+ * of the 256 sums of its eight rows of the generating matrix, so a
+ * codeword is a XOR of one table entry per byte of the message.
+ * With the pivots in the first k columns, the message is copied
+ * into the codeword and the entries only hold the parity bits. */
+struct encoder {
+	struct lincode	*lc;
+	int		 sys;	/* the pivots are the first k columns */
+	long		 width;	/* bits of a table entry */
+	long		 tw;	/* words of a table entry */
+	long		 kb;	/* bytes of a message */
+	uint64_t	*tab;	/* 256 entries for each byte of a message */
+};
+
+struct ejob {
+	const struct encoder	*enc;
+	const unsigned char	*in;	/* the messages of this block */
+	unsigned char		*out;	/* and their codewords, zeroed */
+	long			 msgs;
+	uint64_t		*cw;	/* scratch, EJOBWORDS() of them */
+};
+
+/* The scratch of a job: a codeword with a word to spare,
+ * a message with a byte to spare, and the codeword as bytes. */
+#define EJOBWORDS(e)	(2 * ((e)->tw + 1) + ((e)->kb + 8) / 8)
+
+#define ENTRY(e, i, b)	((e)->tab + ((i) * 256 + (b)) * (e)->tw)
+
+/* Build the tables: an entry for each single bit holds its row,
+ * and every other is the XOR of its lowest bit and the rest.
+ * Return ALG_OK, ALG_EBIG if the tables would be too big,
+ * or ALG_ENOMEM. */
+static int
+mktables(struct lincode *lc, struct encoder *e)
+{
+	uint64_t *t, *lo, *hi;
+	long r, c, i, b, j;
+	memset(e, 0, sizeof(struct encoder));
+	e->lc = lc;
+	e->sys = 1;
+	for (r = 0; r < lc->dim; r++)
+		if (lc->piv[r] != r)
+			e->sys = 0;
+	e->width = e->sys ? lc->len - lc->dim : lc->len;
+	e->tw = (e->width + 63) / 64;
+	e->kb = (lc->dim + 7) / 8;
+	if ((size_t) e->tw * e->kb > LC_MAXTABLE / 256 / sizeof(uint64_t))
+		return ALG_EBIG;
+	if (NULL == (e->tab = calloc(e->kb * 256 * e->tw + 1,
+	    sizeof(uint64_t))))
+		return ALG_ENOMEM;
+	for (r = 0; r < lc->dim; r++) {
+		t = ENTRY(e, r / 8, 1 << (r % 8));
+		if (0 == e->sys) {
+			memcpy(t, ROW(lc, r), e->tw * sizeof(uint64_t));
+			continue;
+		}
+		for (c = lc->dim; c < lc->len; c++)
+			if (BIT(ROW(lc, r), c))
+				SETBIT(t, c - lc->dim);
+	}
+	for (i = 0; i < e->kb; i++)
+		for (b = 3; b < 256; b++) {
+			if (0 == (b & (b - 1)))
+				continue;
+			t = ENTRY(e, i, b);
+			lo = ENTRY(e, i, b & -b);
+			hi = ENTRY(e, i, b & (b - 1));
+			for (j = 0; j < e->tw; j++)
+				t[j] = lo[j] ^ hi[j];
+		}
+	return ALG_OK;
+}
+
+/* Copy the nbits bits at bit pos of src into the bytes of m,
+ * low bits first, clearing the bits past them in the last byte.
+ * The source has a byte to spare after them. */
+static void
+getbits(unsigned char *m, const unsigned char *src, uint64_t pos, long nbits)
+{
+	const unsigned char *p = src + pos / 8;
+	int s = pos % 8;
+	long j, nb = (nbits + 7) / 8;
+	if (0 == s)
+		memcpy(m, p, nb);
+	else
+		for (j = 0; j < nb; j++)
+			m[j] = p[j] >> s | p[j + 1] << (8 - s);
+	if (nbits % 8)
+		m[nb - 1] &= (1U << (nbits % 8)) - 1;
+}
+
+/* Put the nbits bits of m at bit pos of dst, which is zero from there
+ * on; the bits past them in m are zero. No byte past the last bit
+ * is touched, as it may belong to the block of another job. */
+static void
+putbits(unsigned char *dst, uint64_t pos, const unsigned char *m, long nbits)
+{
+	unsigned char *p = dst + pos / 8;
+	int s = pos % 8;
+	long j, nb = (nbits + 7) / 8;
+	if (0 == s) {
+		memcpy(p, m, nb);
+		return;
+	}
+	for (j = 0; j < nb; j++) {
+		p[j] |= m[j] << s;
+		if (8 * (j + 1) - s < nbits)
+			p[j + 1] = m[j] >> (8 - s);
+	}
+}
+
+static void*
+ework(void *arg)
+{
+	struct ejob *job = arg;
+	const struct encoder *e = job->enc;
+	const uint64_t *t;
+	uint64_t *cw = job->cw;
+	unsigned char *m, *cb;
+	long i, b, j, k = e->lc->dim, n = e->lc->len;
+	m = (unsigned char*) (cw + e->tw + 1);
+	cb = (unsigned char*) (cw + e->tw + 1 + (e->kb + 8) / 8);
+	for (i = 0; i < job->msgs; i++) {
+		getbits(m, job->in, (uint64_t) i * k, k);
+		memset(cw, 0, e->tw * sizeof(uint64_t));
+		if (1 == e->tw) {
+			for (b = 0; b < e->kb; b++)
+				cw[0] ^= ENTRY(e, b, m[b])[0];
+		} else {
+			for (b = 0; b < e->kb; b++)
+				for (t = ENTRY(e, b, m[b]), j = 0; j < e->tw; j++)
+					cw[j] ^= t[j];
+		}
+		for (j = 0; j < (e->width + 7) / 8; j++)
+			cb[j] = cw[j / 8] >> (j % 8 * 8);
+		if (e->sys) {
+			putbits(job->out, (uint64_t) i * n, m, k);
+			putbits(job->out, (uint64_t) i * n + k, cb, n - k);
+		} else {
+			putbits(job->out, (uint64_t) i * n, cb, n);
+		}
+	}
+	return NULL;
+}
+
+/* Encode the bits of the input, low bits of each byte first,
+ * as a stream of messages of k bits each, the last one filled up
+ * with zeros, into the stream of their codewords of n bits each,
+ * filled up with zeros to a whole byte. The input is read in blocks,
+ * one for each of the jobs to encode at a time, and the codewords
+ * of the blocks are written in order. A block no thread can be had
+ * for is encoded in the calling thread.
+ * Return ALG_OK or an error code: ALG_EEMPTY for a code of dimension 0,
+ * ALG_EBIG if its tables would take more than LC_MAXTABLE bytes,
+ * or ALG_EIO if the streams fail. */
+int
+encode(struct lincode *lc, FILE *in, FILE *out, int jobs)
+{
+	struct encoder e;
+	struct ejob *job;
+	uint64_t *scr;
+	unsigned char *ibuf, *obuf;
+	size_t got, isize, osize;
+	long msgs, per, inb, outb, busy, j;
+	int ret;
+	if (NULL == lc || NULL == in || NULL == out)
+		return ALG_EINVAL;
+	if (NULL == lc->piv && ALG_OK != (ret = syscode(lc, NULL)))
+		return ret;
+	if (0 == lc->dim)
+		return ALG_EEMPTY;
+	if (ALG_OK != (ret = mktables(lc, &e)))
+		return ret;
+	if (jobs < 1)
+		jobs = 1;
+	/* a multiple of eight messages per block */
+	if ((per = ENCBLOCK / lc->dim * 8) < 8)
+		per = 8;
+	inb = per / 8 * lc->dim;
+	outb = per / 8 * lc->len;
+	isize = jobs * inb;
+	osize = jobs * outb;
+	job = calloc(jobs, sizeof(struct ejob));
+	scr = calloc(jobs * EJOBWORDS(&e), sizeof(uint64_t));
+	ibuf = malloc(isize + 1);
+	obuf = malloc(osize + 1);
+	if (NULL == job || NULL == scr || NULL == ibuf || NULL == obuf) {
+		ret = ALG_ENOMEM;
+		goto out;
+	}
+	do {
+		PROF_START(ST_PARSE);
+		got = fread(ibuf, 1, isize, in);
+		PROF_COUNT(CT_BYTES, got);
+		PROF_STOP(ST_PARSE);
+		if (0 == got)
+			break;
+		memset(ibuf + got, 0, isize + 1 - got);
+		memset(obuf, 0, osize + 1);
+		msgs = (8 * got + lc->dim - 1) / lc->dim;
+		for (j = 0; j < jobs; j++) {
+			job[j].enc = &e;
+			job[j].in = ibuf + j * inb;
+			job[j].out = obuf + j * outb;
+			job[j].msgs = msgs - j * per < 0 ? 0
+			    : msgs - j * per > per ? per : msgs - j * per;
+			job[j].cw = scr + j * EJOBWORDS(&e);
+		}
+		/* only the first blocks may have messages */
+		if ((busy = (msgs + per - 1) / per) > jobs)
+			busy = jobs;
+		algjobs(ework, job, sizeof(struct ejob), busy);
+		PROF_START(ST_OUTPUT);
+		fwrite(obuf, 1, ((uint64_t) msgs * lc->len + 7) / 8, out);
+		PROF_STOP(ST_OUTPUT);
+	} while (got == isize);
+	if (ferror(in) || ferror(out))
+		ret = ALG_EIO;
+out:
+	free(e.tab);
+	free(job);
+	free(scr);
+	free(ibuf);
+	free(obuf);
+	return ret;
+}
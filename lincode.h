@@ -1,13 +1,41 @@
 #ifndef _ALGEBRA_LINCODE_H
 #define _ALGEBRA_LINCODE_H
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
+
+#include "matrix.h"
 
 struct lincode {
 	long		size;
 	struct word	*words;
 	struct matrix	*genmtx;
 	struct matrix	*ctlmtx;
+	long		len;	/* length of the codewords: n */
+	long		dim;	/* dimension of the code: k */
+	long		wpr;	/* 64-bit words per packed row */
+	uint64_t	*gen;	/* dim packed rows of the generating matrix */
+	long		*piv;	/* pivot column of each row after syscode() */
 };
 
+/* The largest dimension we enumerate all the codewords of. */
+#define LC_MAXENUM	62
+
+/* Look for the minimum distance with Brouwer-Zimmermann
+ * if both the code and its dual are bigger than this. */
+#define LC_MAXWALK	24
+
+/* The largest tables we encode with, in bytes. */
+#define LC_MAXTABLE	(1UL << 30)
+
+struct lincode*	mkcode(struct matrix*, int*);
+struct lincode*	dualcode(struct lincode*, int*);
+void		freecode(struct lincode*);
+void		prcode(struct lincode*);
+int		syscode(struct lincode*, const long*);
+int		weights(struct lincode*, uint64_t*, int);
+int		mindist(struct lincode*, int, double, int, long*, long*);
+int		encode(struct lincode*, FILE*, FILE*, int);
+
 #endif
@@ -1,120 +1,280 @@
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
-#include <err.h>
+#include <float.h>
+#include <math.h>
 
 #include "config.h"
+#include "algebra.h"
 #include "matrix.h"
 #include "lineq.h"
+#include "prof.h"
 
 /* Solve a system of linear equations given by a matrix.
  * The rightmost column is taken as the right hand vector.
- * Return a linsol structure (even if there is no solution),
- * or NULL on error. */
-struct linsol*
-linsolve(struct matrix *mtx)
+ * The solution is stored in the given buffer of LINBUF(cols) doubles,
+ * which the returned linsol points into; it has no particular solution
+ * if the system has no solution. Once the matrix is in the reduced
+ * row echelon form, the particular solution is its right hand side
+ * and each generator is a column without a pivot, so they are all
+ * read off at once. Return ALG_OK or an error code. */
+int
+linsolvebuf(struct matrix *mtx, struct linsol *sol, double *buf)
 {
-	double R;
-	long r, c, g;
-	struct linsol* sol;
-	if (NULL == mtx) {
-		warnx("Will not solve a NULL equation");
-		return NULL;
+	double *hom;
+	long r, c, k, g, len, *piv;
+	int e;
+	if (NULL == mtx || NULL == sol || NULL == buf || mtx->cols < 2)
+		return ALG_EINVAL;
+	/* past the solution, which has at most cols * (cols-1) numbers */
+	piv = (long*) (buf + (size_t) mtx->cols * mtx->cols);
+	if (ALG_OK != (e = rref(mtx, piv, buf + LINBUF(mtx->cols)
+	    - mtx->cols)))
+		return e;
+	memset(sol, 0, sizeof(struct linsol));
+	sol->len = len = mtx->cols-1;
+	if (mtx->gcol >= mtx->cols)
+		return ALG_OK;
+	sol->par = buf;
+	memset(sol->par, 0, len * sizeof(double));
+	for (r = 0; r < mtx->rows; r++)
+		sol->par[piv[r]] = mtx->m[r][len];
+	if (0 == (sol->dim = len - mtx->rows))
+		return ALG_OK;
+	sol->hom = buf + len;
+	memset(sol->hom, 0, sol->dim * len * sizeof(double));
+	/* the columns without a pivot, the last one first */
+	for (g = 0, c = len-1, r = mtx->rows-1; c >= 0; c--) {
+		if (r >= 0 && piv[r] == c) {
+			r--;
+			continue;
+		}
+		hom = sol->hom + g++ * len;
+		hom[c] = 1;
+		for (k = 0; k <= r; k++)
+			hom[piv[k]] = 0 - mtx->m[k][c];
 	}
-	if (1 == mtx->cols) {
-		warnx("One column is not enough");
-		return NULL;
+	return ALG_OK;
+}
+
+/* Give up refining a solution in mixed precision after this many steps. */
+#define MIXITER		30
+
+/* The bytes mixsolve() takes from the workspace for n equations:
+ * the factors, the row swaps and the correction. */
+#define MIXWORK(n)	(ALGSIZE((size_t) (n) * (n) * sizeof(float)) \
+			+ ALGSIZE((size_t) (n) * sizeof(long)) \
+			+ ALGSIZE((size_t) (n) * sizeof(float)))
+
+/* Factor the n x n matrix of floats, stored row by row, in place
+ * into L and U with partial pivoting, recording the row swaps.
+ * The rows are kept contiguous so that the inner loop vectorizes.
+ * Return -1 if a pivot is within the rounding of single precision
+ * of the norm of the matrix, where a singular one would have zero. */
+static int
+sfactor(float *a, long n, long *piv, double anrm)
+{
+	double tol = n * FLT_EPSILON * anrm;
+	float *A, *B, l, t;
+	long i, j, k, r;
+	for (k = 0; k < n; k++) {
+		for (r = k, i = k+1; i < n; i++)
+			if (fabsf(a[i * n + k]) > fabsf(a[r * n + k]))
+				r = i;
+		if (fabsf(a[r * n + k]) <= tol)
+			return -1;
+		PROF_COUNT(CT_PIVOTS, 1);
+		A = a + k * n;
+		if ((piv[k] = r) != k) {
+			for (B = a + r * n, j = 0; j < n; j++) {
+				t = A[j];
+				A[j] = B[j];
+				B[j] = t;
+			}
+		}
+		for (i = k+1; i < n; i++) {
+			B = a + i * n;
+			l = B[k] /= A[k];
+			for (j = k+1; j < n; j++)
+				B[j] -= l * A[j];
+		}
+		PROF_COUNT(CT_ROWS, n - k - 1);
+		PROF_COUNT(CT_FLOPS, (n - k - 1) * (2 * (n - k - 1) + 1));
 	}
-	/*prmtx(mtx);*/
-	if (-1 == gem(mtx)) {
-		warnx("Could not GEM");
-		return NULL;
+	return 0;
+}
+
+/* Solve the system factored by sfactor() for the given right side,
+ * in place. */
+static void
+ssolve(const float *a, long n, const long *piv, float *x)
+{
+	const float *A;
+	float X;
+	long i, j;
+	for (i = 0; i < n; i++) {
+		if (piv[i] != i) {
+			X = x[i];
+			x[i] = x[piv[i]];
+			x[piv[i]] = X;
+		}
 	}
-	/*prmtx(mtx);*/
-	if (NULL == (sol = calloc(1, sizeof(struct linsol))))
-		err(1, NULL);
-	sol->len = mtx->cols-1;
-	if (mtx->gcol >= mtx->cols)
-		return sol;
-	if (NULL == (sol->par = calloc(mtx->cols-1, sizeof(double))))
-		err(1, NULL);
-	/* fill the tail of the solution with zeros */
-	for (c = mtx->cols-2; c >= mtx->gcol; c--)
-		sol->par[c] = 0;
-	for (r = mtx->rows-1; r >= 0; r--) {
-		R = mtx->m[r][mtx->cols-1];
-		for (c = r+1; c < mtx->cols-1; c++)
-			R -= mtx->m[r][c] * sol->par[c];
-		sol->par[r] = R / mtx->m[r][r];
-		/* yes, the row is the column here */
+	for (i = 0; i < n; i++)
+		for (A = a + i * n, j = 0; j < i; j++)
+			x[i] -= A[j] * x[j];
+	for (i = n-1; i >= 0; i--) {
+		for (A = a + i * n, j = i+1; j < n; j++)
+			x[i] -= A[j] * x[j];
+		x[i] /= A[i];
 	}
-	if (mtx->cols - mtx->gcol <= 1)
-		return sol;
-	sol->dim = (mtx->cols - mtx->gcol) - 1;
-	if (NULL == (sol->hom = calloc(sol->dim, sizeof(double*))))
-		err(1, NULL);
-	for (g = 0; g < sol->dim; g++) {
-		if (NULL == (sol->hom[g] = calloc(sol->len, sizeof(double))))
-			err(1, NULL);
-		for (c = 0; c < sol->dim; c++) /* (...,0,1,0,...,0) */
-			sol->hom[g][sol->len-c-1] = (c == g ? 1 : 0);
-		/* same as before, with a zero right-hand side */
-		/* FIXME: this should be a subroutine. */
-		for (r = mtx->rows-1; r >= 0; r--) {
-			R = 0;
-			for (c = r+1; c < mtx->cols-1; c++)
-				R -= mtx->m[r][c] * sol->hom[g][c];
-			sol->hom[g][r] = R / mtx->m[r][r];
-			/* yes, the row is the column here */
+	PROF_COUNT(CT_FLOPS, 2 * n * n);
+}
+
+/* Compute the residual of the solution in double precision,
+ * the rightmost column being the right hand side.
+ * Return its largest entry in absolute value. */
+static double
+resid(const struct matrix *mtx, const double *x, double *r)
+{
+	double R, max = 0;
+	long i, j, n = mtx->rows;
+	for (i = 0; i < n; i++) {
+		R = mtx->m[i][n];
+		for (j = 0; j < n; j++)
+			R -= mtx->m[i][j] * x[j];
+		r[i] = R;
+		max = fabs(R) > max ? fabs(R) : max;
+	}
+	PROF_COUNT(CT_FLOPS, 2 * n * n);
+	return max;
+}
+
+/* Solve a square system factoring it in single precision,
+ * and refine the solution in x with residuals computed in double
+ * until it is as good as one found in double precision.
+ * The matrix is left intact, and r holds a vector of it.
+ * Return -1 if the matrix does not fit in floats, if it is singular
+ * in single precision, or if the refinement does not converge:
+ * the elimination in double precision then tells a singular system
+ * and finds all of its solutions. */
+static int
+mixsolve(struct alg *ctx, const struct matrix *mtx, double *x, double *r)
+{
+	double v, s, max, anrm = 0;
+	float *a, *d;
+	long i, j, n = mtx->rows, *piv;
+	int it, e = -1;
+	a = algtake(ctx, (size_t) n * n * sizeof(float));
+	piv = algtake(ctx, n * sizeof(long));
+	d = algtake(ctx, n * sizeof(float));
+	for (i = 0; i < n; i++) {
+		for (s = 0, j = 0; j < n; j++) {
+			if (!(fabs(v = mtx->m[i][j]) <= FLT_MAX))
+				return -1;
+			a[i * n + j] = v;
+			s += fabs(v);
+		}
+		anrm = s > anrm ? s : anrm;
+	}
+	PROF_START(ST_ELIM);
+	if (-1 == sfactor(a, n, piv, anrm)) {
+		PROF_STOP(ST_ELIM);
+		return -1;
+	}
+	PROF_STOP(ST_ELIM);
+	PROF_START(ST_BACKSUB);
+	for (i = 0; i < n; i++) {
+		x[i] = 0;
+		r[i] = mtx->m[i][n];
+	}
+	for (it = 0; it <= MIXITER; it++) {
+		for (i = 0; i < n; i++) {
+			if (!(fabs(r[i]) <= FLT_MAX))
+				goto out;
+			d[i] = r[i];
+		}
+		ssolve(a, n, piv, d);
+		for (max = 0, i = 0; i < n; i++) {
+			x[i] += d[i];
+			max = fabs(x[i]) > max ? fabs(x[i]) : max;
+		}
+		if (resid(mtx, x, r) <= max * anrm * DBL_EPSILON * sqrt(n)) {
+			e = 0;
+			break;
 		}
 	}
-	return sol;
+out:
+	PROF_STOP(ST_BACKSUB);
+	return e;
 }
 
-void
-prvec(double* vec, long len)
+/* As linsolvebuf(), with the solution in the workspace of the context,
+ * valid until its next use. With ctx->mixed set, a square system is
+ * first solved in mixed precision by mixsolve(), leaving the matrix
+ * intact; only if that fails is it eliminated in double precision. */
+int
+linsolve(struct alg *ctx, struct matrix *mtx, struct linsol *sol)
+{
+	double *buf;
+	size_t size;
+	long n;
+	int e, mixed;
+	if (NULL == ctx || NULL == mtx || NULL == sol || mtx->cols < 2)
+		return ALG_EINVAL;
+	n = mtx->rows;
+	size = LINBUF(mtx->cols) * sizeof(double);
+	if ((mixed = ctx->mixed && n == mtx->cols - 1))
+		size += MIXWORK(n);
+	if (ALG_OK != (e = algwork(ctx, size)))
+		return e;
+	buf = algtake(ctx, LINBUF(mtx->cols) * sizeof(double));
+	/* the buffer has room for both x and r */
+	if (mixed && 0 == mixsolve(ctx, mtx, buf, buf + n)) {
+		memset(sol, 0, sizeof(struct linsol));
+		sol->len = n;
+		sol->par = buf;
+		return ALG_OK;
+	}
+	return linsolvebuf(mtx, sol, buf);
+}
+
+static void
+prvec(FILE *fp, double* vec, long len)
 {
 	long c;
 	if (NULL == vec)
 		return;
-	putchar('(');
+	putc('(', fp);
 	for (c = 0; c < len; c++) {
 		if (c > 0)
-			printf(", ");
-		printf("%e", vec[c]);
+			fprintf(fp, ", ");
+		fprintf(fp, "%e", vec[c]);
 	}
-	putchar(')');
+	putc(')', fp);
 }
 
 void
-prsol(struct linsol* sol)
+fprsol(FILE *fp, struct linsol* sol)
 {
 	long g;
-	if (NULL == sol) {
-		warnx("Will not print a NULL solution");
+	if (NULL == sol || NULL == sol->par)
 		return;
-	}
-	if (NULL == sol->par)
-		return;
-	prvec(sol->par, sol->len);
+	prvec(fp, sol->par, sol->len);
 	if (0 == sol->dim) {
-		putchar('\n');
+		putc('\n', fp);
 		return;
 	}
-	printf(" + <");
+	fprintf(fp, " + <");
 	for (g = 0; g < sol->dim; g++) {
 		if (g > 0)
-			printf(", ");
-		prvec(sol->hom[g], sol->len);
+			fprintf(fp, ", ");
+		prvec(fp, sol->hom + g * sol->len, sol->len);
 	}
-	printf(">\n");
+	fprintf(fp, ">\n");
 }
 
 void
-freesol(struct linsol* sol)
+prsol(struct linsol* sol)
 {
-	if (sol) {
-		free(sol->par);
-		free(sol->hom);
-		free(sol);
-	}
+	fprsol(stdout, sol);
 }
@@ -1,17 +1,25 @@
 #ifndef _ALGEBRA_LINEQ_H_
 #define _ALGEBRA_LINEQ_H_
 
+#include <stdio.h>
+
+#include "algebra.h"
 #include "matrix.h"
 
 struct linsol {
 	long		len; /* length of vectors: R^n */
 	long		dim; /* dimension of the hom solution */
-	double*		par; /* a particular solution */
-	double**	hom; /* a list of generators */
+	double*		par; /* a particular solution, NULL if none */
+	double*		hom; /* dim generators, len numbers each */
 };
 
-struct linsol*	linsolve(struct matrix*);
-void		freesol(struct linsol*);
-void		prsol(struct linsol*);
+/* The doubles linsolvebuf() needs for a matrix with this many columns:
+ * the solution, and the pivots and the scale of the columns for rref(). */
+#define LINBUF(cols)	((size_t) (cols) * ((cols) + 2))
+
+int	linsolve(struct alg*, struct matrix*, struct linsol*);
+int	linsolvebuf(struct matrix*, struct linsol*, double*);
+void	fprsol(FILE*, struct linsol*);
+void	prsol(struct linsol*);
 
 #endif
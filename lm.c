@@ -0,0 +1,174 @@
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
+#include "mtxop.h"
+#include "prof.h"
+
+extern const char* __progname;
+
+int op = 0;
+int jobs = 0;
+int Tflag = 0;
+int vflag = 0;
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"usage: %s [-Tv] [-j jobs] -a | -m matrix matrix ...\n"
+		"       %s [-Tv] -d | -i | -r | -t matrix\n",
+		__progname, __progname);
+}
+
+static void
+timing(void)
+{
+	prprof(Tflag > 1);
+}
+
+/* Read a matrix from the file, or from stdin for "-". */
+static void
+rdmtx(const char *file, struct matrix *mtx)
+{
+	int e;
+	e = strcmp(file, "-") ? readmtx(file, mtx) : fgetmtx(stdin, mtx);
+	if (ALG_OK != e)
+		errx(1, "Cannot read matrix from '%s': %s", file, algerr(e));
+	if (0 == mtx->rows)
+		errx(1, "%s: empty matrix", file);
+	if (vflag) {
+		prmtx(mtx);
+		putchar('\n');
+	}
+}
+
+/* Add up or multiply the matrices, left to right. Each partial result
+ * lives in the workspace of one context while the next one is computed
+ * into the other. */
+static int
+chain(int argc, char **argv)
+{
+	struct alg ctx[2];
+	struct matrix first, acc, mtx, res;
+	int i, e;
+
+	alginit(&ctx[0], NULL, 0);
+	alginit(&ctx[1], NULL, 0);
+	rdmtx(argv[0], &first);
+	acc = first;
+	for (i = 1; i < argc; i++) {
+		rdmtx(argv[i], &mtx);
+		e = 'a' == op
+		    ? mtxadd(&ctx[i % 2], &acc, &mtx, &res)
+		    : mtxmul(&ctx[i % 2], &acc, &mtx, &res, jobs);
+		if (ALG_OK != e)
+			errx(1, "Cannot %s '%s': %s",
+			    'a' == op ? "add" : "multiply by",
+			    argv[i], algerr(e));
+		freemtx(&mtx);
+		acc = res;
+	}
+	PROF_START(ST_OUTPUT);
+	prmtx(&acc);
+	PROF_STOP(ST_OUTPUT);
+	freemtx(&first);
+	algfree(&ctx[0]);
+	algfree(&ctx[1]);
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	struct alg ctx;
+	struct matrix mtx, res;
+	const char *errstr;
+	double det;
+	long rank;
+	int c, e;
+
+	while ((c = getopt(argc, argv, "adij:mrTtv")) != -1)
+	switch (c) {
+		case 'a':
+		case 'd':
+		case 'i':
+		case 'm':
+		case 'r':
+		case 't':
+			if (op && op != c) {
+				usage();
+				return 1;
+			}
+			op = c;
+			break;
+		case 'j':
+			jobs = strtonum(optarg, 1, 1024, &errstr);
+			if (errstr)
+				errx(1, "%s jobs: %s", errstr, optarg);
+			break;
+		case 'T':
+			Tflag++;
+			break;
+		case 'v':
+			vflag = 1;
+			break;
+		default:
+			usage();
+			return 1;
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (0 == jobs && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		jobs = 1;
+
+	if (0 == op
+	|| (('a' == op || 'm' == op) && argc < 2)
+	|| ('a' != op && 'm' != op && 1 != argc)) {
+		usage();
+		return 1;
+	}
+
+	if (Tflag) {
+		profon();
+		atexit(timing);
+	}
+
+	if ('a' == op || 'm' == op)
+		return chain(argc, argv);
+
+	rdmtx(*argv, &mtx);
+	alginit(&ctx, NULL, 0);
+	switch (op) {
+	case 'd':
+		if (ALG_OK == (e = mtxdet(&ctx, &mtx, &det)))
+			printf("% e\n", det);
+		break;
+	case 'r':
+		if (ALG_OK == (e = mtxrank(&ctx, &mtx, &rank)))
+			printf("%ld\n", rank);
+		break;
+	case 'i':
+		if (ALG_OK == (e = mtxinv(&ctx, &mtx, &res)))
+			prmtx(&res);
+		break;
+	case 't':
+		if (ALG_OK == (e = mtxtrans(&ctx, &mtx, &res)))
+			prmtx(&res);
+		break;
+	}
+	if (ALG_OK != e) {
+		warnx("Cannot compute with '%s': %s", *argv, algerr(e));
+		return 1;
+	}
+	algfree(&ctx);
+	freemtx(&mtx);
+	return 0;
+}
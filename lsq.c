@@ -1,39 +1,45 @@
 /* TODO use dlopen() to compare ourselves to a given function.c */
 
+#include <pthread.h>
+#include <unistd.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include <math.h>
 #include <err.h>
 
 #include "config.h"
+#include "algebra.h"
 #include "matrix.h"
 #include "lineq.h"
-
-int	dflag = 0;
-double	eflag = 1;
-int	nflag = 0;
-int	vflag = 0;
-int	wflag = 0;
-int	degree = 1;
+#include "fit.h"
+#include "spline.h"
+#include "prof.h"
 
 extern char* __progname;
 
-struct data {
-	long num;
-	struct pt {
-		double x, y;
-	}	*points;
-};
-
 static void
 usage(void)
 {
 	fprintf(stderr,
-	"%s [-D degree] [-d] [-e far] [-n] [-v] [-w] data\n"
-	"%s [-D degree] [-d] [-e far] [-n] [-v] [-w] function.so args\n"
-	"%s [-D degree] [-d] [-e far] [-n] [-v] [-w] function.so hi lo step\n",
-		__progname, __progname, __progname);
+	"%s [-D degree] [-c] [-d] [-e far] [-j jobs] [-n] [-T] [-v] [-w] data\n"
+	"%s [-D degree] [-d] [-e far] [-j jobs] [-n] [-T] [-v] [-w] function.so args\n"
+	"%s [-D degree] [-d] [-e far] [-j jobs] [-n] [-T] [-v] [-w] function.so hi lo step\n"
+	"%s -s smooth [-d] [-n] [-o spline] [-T] [-v] data\n"
+	"%s -i spline [-d] [-n] [-T] [-v] [data]\n"
+	"%s -X [-D degree] [-e far,...] [-j jobs] [-k folds] [-T] [-v] [-w] data\n",
+		__progname, __progname, __progname, __progname, __progname,
+		__progname);
+}
+
+static int json = 0;
+
+static void
+timing(void)
+{
+	prprof(json);
 }
 
 void
@@ -47,167 +53,278 @@ prdata(struct data *data)
 		printf("% e % e\n", p->x, p->y);
 }
 
-int
-rdata(FILE *fp, struct data *data)
+/* Print the values of the polynomials of all the series at x,
+ * next to the data and the differences if given the data. */
+static void
+prvals(double x, double *coef, long len, long cols, const double *y)
 {
-	struct pt p;
-	if (NULL == data)
-		return -1;
-	while (fscanf(fp, "%le %le\n", &p.x, &p.y) == 2) {
-		if (NULL == (data->points
-		= reallocarray(data->points, data->num+1, sizeof(struct pt))))
-			err(1, NULL);
-		data->points[data->num++] = p;
+	double val;
+	long c;
+	printf("% e", x);
+	for (c = 0; c < cols; c++, coef += len) {
+		val = eval(coef, len, x);
+		if (y) {
+			printf(" % e % e % e", val, y[c], val-y[c]);
+		} else {
+			printf(" % e", val);
+		}
 	}
-	if (ferror(fp))
-		err(1, NULL);
-	return 0;
+	putchar('\n');
 }
 
-/* Evaluate a given polynomial at a given point. */
-/* FIXME: Horner? Square-and-Multiply? */
-double
-eval(double *coef, long len, double x)
-{
-	long p;
-	double *c, val = 0;
-	for (p = 0, c = coef; p < len; p++, c++)
-		val += (*c) * pow(x, p);
-	return val;
-}
-
-/* The weight function: 1-x, cut of to zero at x=1.
- * TODO: also have a weight function suited at point x,
- * according to the density of neighbouring data points. */
-/* TODO: cut off to zero for > epsilon */
-double
-weight(double x, double far)
+/* Print the coefficients of the polynomials, a line per series. */
+static void
+prcoef(double *coef, long len, long cols)
 {
-	if (x < 0 || x > far)
-		return 0;
-	return exp(-x);
+	long c, i;
+	PROF_START(ST_OUTPUT);
+	for (c = 0; c < cols; c++, coef += len)
+		for (i = 0; i < len; i++)
+			printf(i < len-1 ? "% e " : "% e\n", coef[i]);
+	PROF_STOP(ST_OUTPUT);
 }
 
-/* Prepare the optimization matrix weighted at point x
- * whose solution is the degree-tuple of the wlsq coeficients.
- * It the weight function is NULL, make it a constant 1.
- * Return the composed matrix, or NULL on error. */
-struct matrix*
-mkmtx(struct data *data, int degree, double(*w)(double, double), double x)
+/* Approximate the original data with the polynomials,
+ * printing the differences too if asked to. */
+int
+approx(struct series *ser, double *coef, long len, int diff)
 {
-	struct pt *p;
-	long r, c, n;
-	struct matrix *mtx;
-	if (NULL == data || 0 == data->num || degree < 1)
-		return NULL;
-	if (NULL == (mtx = calloc(1, sizeof(struct matrix))))
-		err(1, NULL);
-	mtx->rows = degree + 1;
-	mtx->cols = degree + 2;
-	if (NULL == (mtx->m = calloc(mtx->rows, sizeof(double*))))
-		err(1, NULL);
-	/* the linear combinations */
-	for (r = 0; r < mtx->rows; r++) {
-		if (NULL == (mtx->m[r] = calloc(mtx->cols, sizeof(double))))
-			err(1, NULL);
-		for (c = 0; c < mtx->cols-1; c++) {
-			for (n = 0, p = data->points; n < data->num; n++, p++) {
-				mtx->m[r][c] += pow(p->x, r+c)
-					* (w ? w(fabs(x - p->x), eflag) : 1);
-			}
-		}
-	}
-	/* the right hand side */
-	for (r = 0; r < mtx->rows; r++)
-		for (n = 0, p = data->points; n < data->num; n++, p++)
-			mtx->m[r][c] += pow(p->x, r) * p->y
-				* (w ? w(fabs(x - p->x), eflag) : 1);
-	return mtx;
+	long n;
+	double *row;
+	if (NULL == ser || NULL == coef || 0 == len)
+		return -1;
+	PROF_START(ST_OUTPUT);
+	for (n = 0, row = ser->v; n < ser->num; n++, row += ser->cols+1)
+		prvals(row[0], coef, len, ser->cols, diff ? row+1 : NULL);
+	PROF_STOP(ST_OUTPUT);
+	return 0;
 }
 
-/* Approximate the original data with a polynomial. */
+/* Approximate the original data with the spline. */
 int
-approx(struct data *data, double *coef, long len)
+splapprox(struct data *data, struct spline *spl, int diff)
 {
 	long n;
 	struct pt *p;
 	double val;
-	if (NULL == data || NULL == coef || 0 == len)
+	if (NULL == data || NULL == spl)
 		return -1;
+	PROF_START(ST_OUTPUT);
 	for (n = 0, p = data->points; n < data->num; n++, p++) {
-		val = eval(coef, len, p->x);
-		if (dflag) {
+		val = spleval(spl, p->x);
+		if (diff) {
 			printf("% e % e % e % e\n", p->x, val, p->y, val-p->y);
 		} else {
 			printf("% e % e\n", p->x, val);
 		}
 	}
+	PROF_STOP(ST_OUTPUT);
 	return 0;
 }
 
-
-/* Compose and solve the set of linear equations
- * leading to the best polynomial to use at the given point.
- * Return the solution, or NULL on error. */
-struct linsol*
-wsol(struct data *data, int degree, double(*w)(double, double), double x)
-{
-	struct matrix *mtx;
-	struct linsol *sol;
-	if (NULL == data || NULL == w || degree < 1)
-		return NULL;
-	if (NULL == (mtx = mkmtx(data, degree, w, x))) {
-		warnx("Cannot figure out matrix at %e", x);
-		return NULL;
-	}
-	if (NULL == (sol = linsolve(mtx))) {
-		warnx("Cannot solve equations for %e", x);
-		freemtx(mtx);
-		return NULL;
-	}
-	freemtx(mtx);
-	return sol;
-}
-
 /* Approximate the original data with polynomials,
  * using a specific polynomial at each point. */
 int
-wapprox(struct data *data)
+wapprox(struct alg *ctx, struct series *ser, int diff)
 {
 	long n;
-	struct pt *p;
-	struct linsol *sol;
-	double val;
-	if (NULL == data)
+	double *row, *coef;
+	int e;
+	if (NULL == ser)
 		return -1;
-	for (n = 0, p = data->points; n < data->num; n++, p++) {
-		if (NULL == (sol = wsol(data, degree, weight, p->x))) {
-			warnx("Cannot solve equations at %e", p->x);
+	for (n = 0, row = ser->v; n < ser->num; n++, row += ser->cols+1) {
+		if (ALG_OK != (e = msol(ctx, ser, row[0], &coef))) {
+			warnx("Cannot solve equations at %e: %s", row[0],
+			    algerr(e));
 			return -1;
 		}
-		val = eval(sol->par, sol->len, p->x);
-		if (dflag && vflag) {
-			printf("% e % e % e % e\n", p->x, val, p->y, val-p->y);
-		} else {
-			printf("% e % e\n", p->x, val);
-		}
+		PROF_START(ST_OUTPUT);
+		prvals(row[0], coef, ctx->degree+1, ser->cols,
+		    diff ? row+1 : NULL);
+		PROF_STOP(ST_OUTPUT);
 	}
 	return 0;
 }
 
+/* Fit a smoothing spline to the data, or load one from a file,
+ * optionally save it, and evaluate it at the data points
+ * and at the arguments on stdin. */
+static int
+spline(struct alg *ctx, struct data *data, struct spline *spl,
+	const char *load, const char *save, double smooth,
+	int vflag, int dflag, int nflag)
+{
+	FILE *fp;
+	double x;
+	int c, e;
+	if (load) {
+		if (NULL == (fp = fopen(load, "r"))) {
+			warnx("Cannot open '%s'", load);
+			return 1;
+		}
+		if (ALG_OK != (e = splread(fp, spl))) {
+			warnx("Cannot read spline from '%s': %s",
+			    load, algerr(e));
+			return 1;
+		}
+		fclose(fp);
+	} else if (ALG_OK != (e = splfit(ctx, data, smooth, spl))) {
+		warnx("Cannot fit the spline: %s", algerr(e));
+		return 1;
+	}
+	if (save) {
+		if (NULL == (fp = fopen(save, "w"))) {
+			warnx("Cannot open '%s'", save);
+			return 1;
+		}
+		if (ALG_OK != splwrite(fp, spl) || fclose(fp)) {
+			warnx("Cannot write spline to '%s'", save);
+			return 1;
+		}
+	}
+	if (vflag)
+		splapprox(data, spl, dflag);
+	if (!nflag) {
+		PROF_START(ST_OUTPUT);
+		while (1 == (c = fscanf(stdin, "%le", &x)))
+			printf("% e % e\n", x, spleval(spl, x));
+		PROF_STOP(ST_OUTPUT);
+	}
+	e = nflag || feof(stdin) ? 0 : 1;
+	freespl(spl);
+	algfree(ctx);
+	free(data->points);
+	return e;
+}
+
+/* A model of the cross-validation grid, and its error. */
+struct model {
+	int	 degree;
+	double	 far;
+	double	 err;
+	int	 e;
+};
+
+struct grid {
+	pthread_mutex_t	 lock;
+	struct series	*ser;
+	struct model	*model;
+	long		 num;
+	long		 next;	/* the first model not taken yet */
+	long		 folds;
+	int		 wflag;
+};
+
+/* Take the models one by one and cross-validate them,
+ * each thread in a context of its own. */
+static void*
+cvwork(void *arg)
+{
+	struct grid *g = arg;
+	struct model *m;
+	struct alg ctx;
+	alginit(&ctx, NULL, 0);
+	for (;;) {
+		pthread_mutex_lock(&g->lock);
+		m = g->next < g->num ? &g->model[g->next++] : NULL;
+		pthread_mutex_unlock(&g->lock);
+		if (NULL == m)
+			break;
+		ctx.degree = m->degree;
+		ctx.far = m->far;
+		ctx.weight = g->wflag ? weight : NULL;
+		m->e = cverr(&ctx, g->ser, g->folds, &m->err);
+	}
+	algfree(&ctx);
+	return NULL;
+}
+
+/* Cross-validate the degrees up to the given one, and for the weighted
+ * fit each of the far values in the comma separated list, on the given
+ * number of threads; print the error of each model if asked to,
+ * and the model with the least error. */
+static int
+crossval(struct series *ser, int degree, const char *fars, long folds,
+	int jobs, int wflag, int vflag)
+{
+	struct grid g;
+	struct model *m, *best = NULL;
+	const char *p;
+	char *end;
+	double far;
+	long nfar, n;
+	int d;
+
+	memset(&g, 0, sizeof(struct grid));
+	for (nfar = 1, p = fars; wflag && (p = strchr(p, ',')); p++)
+		nfar++;
+	if (NULL == (g.model = calloc(degree * nfar, sizeof(struct model))))
+		err(1, NULL);
+	for (p = fars; g.num < degree * nfar; p = end + 1) {
+		far = strtod(p, &end);
+		if (end == p || (*end && ',' != *end) || !(far > 0))
+			errx(1, "invalid far: %s", fars);
+		for (d = 1; d <= degree; d++) {
+			g.model[g.num].degree = d;
+			g.model[g.num++].far = far;
+		}
+		if (!wflag)
+			break;
+	}
+	g.ser = ser;
+	g.folds = folds;
+	g.wflag = wflag;
+	pthread_mutex_init(&g.lock, NULL);
+	if (jobs > g.num)
+		jobs = g.num;
+	/* the threads take the models one by one */
+	algjobs(cvwork, &g, 0, jobs);
+	PROF_START(ST_OUTPUT);
+	for (n = 0, m = g.model; n < g.num; n++, m++) {
+		if (ALG_OK != m->e) {
+			warnx("Cannot cross-validate degree %d: %s",
+			    m->degree, algerr(m->e));
+			continue;
+		}
+		if (vflag)
+			printf(wflag ? "%d% e% e\n" : "%d% e\n",
+			    m->degree, wflag ? m->far : m->err, m->err);
+		if (NULL == best || m->err < best->err)
+			best = m;
+	}
+	if (best)
+		printf(wflag ? "%d% e% e\n" : "%d% e\n",
+		    best->degree, wflag ? best->far : best->err, best->err);
+	PROF_STOP(ST_OUTPUT);
+	pthread_mutex_destroy(&g.lock);
+	free(g.model);
+	return NULL == best;
+}
+
 int
 main(int argc, char** argv)
 {
-	int c;
+	int c, e, jobs = 0;
+	int cflag = 0, dflag = 0, nflag = 0, Tflag = 0, vflag = 0, wflag = 0;
+	int xflag = 0;
+	char *load = NULL, *save = NULL, *end;
+	const char *fars = "1.0";
+	const char *errstr;
+	long folds = 0;
 	FILE *fp;
-	struct data *data;
-	struct matrix *mtx;
-	struct linsol *sol;
-	double x;
+	struct alg ctx;
+	struct data data;
+	struct series ser;
+	struct spline spl;
+	double x, *coef, smooth = -1;
 
-	while ((c = getopt(argc, argv, "D:de:nvw")) != -1) switch (c) {
+	alginit(&ctx, NULL, 0);
+	while ((c = getopt(argc, argv, "cD:de:i:j:k:no:s:TvwX")) != -1) switch (c) {
+		case 'c':
+			cflag = 1;
+			break;
 		case 'D':
-			degree = atoi(optarg);
+			ctx.degree = atoi(optarg);
 			/* FIXME strtonum */
 			break;
 		case 'd':
@@ -215,89 +332,148 @@ main(int argc, char** argv)
 			vflag = 1;
 			break;
 		case 'e':
-			eflag = strtod(optarg, NULL);
+			ctx.far = strtod(optarg, NULL);
+			fars = optarg;
+			break;
+		case 'i':
+			load = optarg;
+			break;
+		case 'j':
+			jobs = strtonum(optarg, 1, 1024, &errstr);
+			if (errstr)
+				errx(1, "%s jobs: %s", errstr, optarg);
+			break;
+		case 'k':
+			folds = strtonum(optarg, 2, LONG_MAX, &errstr);
+			if (errstr)
+				errx(1, "%s folds: %s", errstr, optarg);
 			break;
 		case 'n':
 			nflag = 1;
 			vflag = 1;
 			break;
+		case 'o':
+			save = optarg;
+			break;
+		case 's':
+			smooth = strtod(optarg, &end);
+			if (end == optarg || *end || !(smooth >= 0))
+				errx(1, "invalid smoothing: %s", optarg);
+			break;
+		case 'T':
+			Tflag++;
+			break;
 		case 'v':
 			vflag = 1;
 			break;
 		case 'w':
 			wflag = 1;
 			break;
+		case 'X':
+			xflag = 1;
+			break;
 	}
 	argc -= optind;
 	argv += optind;
 
-	if (argc != 1) {
+	if ((load && (argc > 1 || wflag || smooth >= 0 || save))
+	|| (!load && argc != 1)
+	|| (save && smooth < 0)
+	|| (smooth >= 0 && wflag)
+	|| (cflag && (wflag || load || smooth >= 0))
+	|| (xflag && (cflag || dflag || nflag || load || smooth >= 0))
+	|| (jobs && (load || smooth >= 0))
+	|| (!xflag && folds)) {
 		usage();
 		return 1;
 	}
 
-	if (degree < 1) {
+	if (ctx.degree < 1) {
 		usage();
 		return 1;
 	}
 
-	if (eflag <= 0) {
+	if (ctx.far <= 0) {
 		usage();
 		return 1;
 	}
 
-	if (NULL == (fp = fopen(*argv, "r"))) {
-		warnx("Cannot open '%s'", *argv);
-		return 1;
+	if (Tflag) {
+		json = Tflag > 1;
+		profon();
+		atexit(timing);
 	}
-	if (NULL == (data = calloc(1, sizeof(struct data))))
-		err(1, NULL);
-	if (-1 == rdata(fp, data)) {
-		warnx("Cannot read data from '%s'", *argv);
-		return 1;
+
+	memset(&data, 0, sizeof(struct data));
+	memset(&ser, 0, sizeof(struct series));
+	if (argc) {
+		if (NULL == (fp = fopen(*argv, "r"))) {
+			warnx("Cannot open '%s'", *argv);
+			return 1;
+		}
+		e = load || smooth >= 0 ? rdata(fp, &data) : rseries(fp, &ser);
+		if (ALG_OK != e) {
+			warnx("Cannot read data from '%s': %s",
+			    *argv, algerr(e));
+			return 1;
+		}
+		fclose(fp);
 	}
 
-	if (data->num <= degree) {
+	if (0 == jobs && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		jobs = 1;
+	if (xflag) {
+		/* the profile is not thread safe */
+		e = crossval(&ser, ctx.degree, fars, folds,
+		    Tflag ? 1 : jobs, wflag, vflag);
+		free(ser.v);
+		return e;
+	}
+
+	/* the threads summing up the fit do not profile */
+	ctx.jobs = jobs;
+	if (load || smooth >= 0)
+		return spline(&ctx, &data, &spl, load, save, smooth,
+		    vflag && argc, dflag, nflag);
+
+	if (ser.num <= ctx.degree) {
 		/* This will result in a singular matrix
 		 * TODO: show those non-unique polynomials? */
-		warnx("%zu points for degree %d", data->num, degree);
+		warnx("%ld points for degree %d", ser.num, ctx.degree);
 	}
 
 	if (wflag) {
 		/* weighted least-square regression */
+		ctx.weight = weight;
 		if (vflag)
-			wapprox(data);
-		if (nflag)
-			return 0;
-		while (1 == (c = fscanf(stdin, "%le", &x))) {
-			if (NULL == (sol = wsol(data, degree, weight, x))) {
-				warnx("Cannot solve equations for %e", x);
+			wapprox(&ctx, &ser, dflag);
+		while (!nflag && 1 == (c = fscanf(stdin, "%le", &x))) {
+			if (ALG_OK != (e = msol(&ctx, &ser, x, &coef))) {
+				warnx("Cannot solve equations for %e: %s", x,
+				    algerr(e));
 				continue;
 			}
-			printf("% e % e\n", x, eval(sol->par, sol->len, x));
-			freesol(sol);
+			PROF_START(ST_OUTPUT);
+			prvals(x, coef, ctx.degree+1, ser.cols, NULL);
+			PROF_STOP(ST_OUTPUT);
 		}
-		return feof(stdin) ? 0 : 1;
 	} else {
-		/* simple least-square regression */
-		if (NULL == (mtx = mkmtx(data, degree, NULL, 0))) {
-			warnx("Cannot figure out matrix from data");
-			return 1;
-		}
-		if (NULL == (sol = linsolve(mtx))) {
-			warnx("Cannot solve linear equations");
+		/* simple least-square regression,
+		 * all the series solved with one factorization */
+		if (ALG_OK != (e = msol(&ctx, &ser, 0, &coef))) {
+			warnx("Cannot solve linear equations: %s", algerr(e));
 			return 1;
 		}
-		/*prsol(sol);*/
-		freemtx(mtx);
+		if (cflag)
+			prcoef(coef, ctx.degree+1, ser.cols);
 		if (vflag)
-			approx(data, sol->par, sol->len);
-		if (nflag)
-			return 0;
-		while (1 == (c = fscanf(stdin, "%le", &x)))
-			printf("% e % e\n", x, eval(sol->par, sol->len, x));
-		freesol(sol);
-		return feof(stdin) ? 0 : 1;
+			approx(&ser, coef, ctx.degree+1, dflag);
+		PROF_START(ST_OUTPUT);
+		while (!nflag && !cflag && 1 == (c = fscanf(stdin, "%le", &x)))
+			prvals(x, coef, ctx.degree+1, ser.cols, NULL);
+		PROF_STOP(ST_OUTPUT);
 	}
-	return 0;
+	algfree(&ctx);
+	free(ser.v);
+	return nflag || cflag || feof(stdin) ? 0 : 1;
 }
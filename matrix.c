@@ -3,67 +3,127 @@
 #include <limits.h>
 #include <stdio.h>
 #include <ctype.h>
-#include <err.h>
+#include <float.h>
+#include <math.h>
 
 #include "config.h"
+#include "algebra.h"
 #include "matrix.h"
+#include "prof.h"
 
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
 
-/* Parse a string of numbers separated by whitespace and save it in an array.
- * Return the size of the array, or -1 for error. The returned array gets
- * allocated here; it is the caller's responsibility to free it later. */
-long
-mkrow(char *line, double **row)
+/* Parse a string of numbers separated by whitespace and save it in an array,
+ * filling in its size. The array gets allocated here; it is the caller's
+ * responsibility to free it later. Return ALG_OK or an error code. */
+static int
+mkrow(char *line, double **row, long *len)
 {
+	double *new;
 	char *n, *e;
-	long i = 0;
+	long i = 0, size = 0;
 	*row = NULL;
 	while ((n = strsep(&line, " \t\n"))) {
 		if (*n == '\0')
 			continue;
-		if (NULL == (*row = reallocarray(*row, i+1, sizeof(double))))
-			err(1, NULL);
+		if (i == size) {
+			size = size ? 2 * size : 8;
+			if (NULL == (new = reallocarray(*row, size,
+			    sizeof(double)))) {
+				free(*row);
+				return ALG_ENOMEM;
+			}
+			PROF_COUNT(CT_ALLOCS, 1);
+			*row = new;
+		}
 		e = NULL;
 		(*row)[i++] = strtod(n, &e);
 		if (e && isprint(*e)) {
-			warnx("Cannot read '%s' at '%s'", n, e);
 			free(*row);
-			return -1;
+			return ALG_EPARSE;
 		}
 	}
-	return i;
+	*len = i;
+	return ALG_OK;
 }
 
 /* Add a row of numbers to a given matrix.
  * The rows needs to have the same number of columns as the previous rows.
- * Return 0 for success, -1 for error. */
-int
+ * Return ALG_OK or an error code. */
+static int
 addrow(double *row, long cols, struct matrix *mtx)
 {
 	double **new = NULL;
 	if (NULL == mtx || NULL == row)
-		return -1;
-	if (mtx->cols && mtx->cols != cols) {
-		warnx("Row has %zu != %zu cols", cols, mtx->cols);
-		return -1;
-	}
+		return ALG_EINVAL;
+	if (mtx->cols && mtx->cols != cols)
+		return ALG_ESHAPE;
 	if (NULL == (new = reallocarray(mtx->m, mtx->rows+1, sizeof(double*))))
-		err(1, NULL);
+		return ALG_ENOMEM;
+	PROF_COUNT(CT_ALLOCS, 1);
 	mtx->m = new;
 	mtx->m[mtx->rows++] = row;
+	mtx->nrow = mtx->rows;
 	if (0 == mtx->cols)
 		mtx->cols = cols;
-	return 0;
+	return ALG_OK;
+}
+
+/* Parse a line of text into a new row of the matrix.
+ * Empty lines are skipped. Return ALG_OK or an error code. */
+static int
+addline(struct matrix *mtx, const char *line, size_t len)
+{
+	double *row;
+	char *copy;
+	long cols;
+	int e;
+	if (NULL == (copy = malloc(len + 1)))
+		return ALG_ENOMEM;
+	memcpy(copy, line, len);
+	copy[len] = '\0';
+	e = mkrow(copy, &row, &cols);
+	free(copy);
+	if (ALG_OK != e || 0 == cols)
+		return e;
+	if (ALG_OK != (e = addrow(row, cols, mtx)))
+		free(row);
+	return e;
 }
 
+/* Make a matrix out of the given rows x cols array of numbers,
+ * stored row by row, using the given array of row pointers.
+ * Nothing gets allocated or copied: the matrix is the caller's
+ * memory, and gem() will rewrite it. Return ALG_OK or ALG_EINVAL. */
+int
+mtxinit(struct matrix *mtx, double *a, long rows, long cols, double **rowp)
+{
+	long r;
+	if (NULL == mtx || NULL == a || NULL == rowp || rows < 1 || cols < 1)
+		return ALG_EINVAL;
+	for (r = 0; r < rows; r++)
+		rowp[r] = a + r * cols;
+	mtx->rows = rows;
+	mtx->cols = cols;
+	mtx->gcol = 0;
+	mtx->nrow = 0;
+	mtx->m = rowp;
+	return ALG_OK;
+}
+
+/* Free the rows allocated by parsemtx() or readmtx().
+ * The matrix structure itself belongs to the caller. */
 void
 freemtx(struct matrix *mtx)
 {
-	if (mtx) {
-		free(mtx->m);
-		free(mtx);
-	}
+	long r;
+	if (NULL == mtx || 0 == mtx->nrow)
+		return;
+	for (r = 0; r < mtx->nrow; r++)
+		free(mtx->m[r]);
+	free(mtx->m);
+	memset(mtx, 0, sizeof(struct matrix));
 }
 
 void
@@ -79,51 +139,97 @@ prmtx(struct matrix *mtx)
 	}
 }
 
-struct matrix*
-readmtx(const char* file)
+/* Parse a matrix from the given text: the rows are lines of numbers
+ * separated by whitespace. Return ALG_OK or an error code;
+ * on success, the caller frees the matrix with freemtx(). */
+int
+parsemtx(const char *buf, size_t len, struct matrix *mtx)
+{
+	const char *end = buf + len, *nl;
+	int e = ALG_OK;
+	if (NULL == mtx || (NULL == buf && len))
+		return ALG_EINVAL;
+	memset(mtx, 0, sizeof(struct matrix));
+	PROF_START(ST_PARSE);
+	PROF_COUNT(CT_BYTES, len);
+	for (; buf < end; buf = nl + 1) {
+		if (NULL == (nl = memchr(buf, '\n', end - buf)))
+			nl = end;
+		if (ALG_OK != (e = addline(mtx, buf, nl - buf)))
+			break;
+	}
+	PROF_STOP(ST_PARSE);
+	if (ALG_OK != e)
+		freemtx(mtx);
+	return e;
+}
+
+/* Read the next matrix from a stream of matrices separated
+ * by blank lines, as with parsemtx(). At the end of the stream,
+ * return ALG_OK with an empty matrix. */
+int
+fgetmtx(FILE *fp, struct matrix *mtx)
 {
-	FILE *fp;
-	double *row = NULL;
-	struct matrix *mtx = NULL;
-	char *line = NULL, *p, *q;
-	long len, cols;
+	char *line = NULL;
 	size_t size = 0;
+	ssize_t len;
+	int e = ALG_OK;
 
-	if (NULL == file)
-		return NULL;
-	if (NULL == (fp = fopen(file, "r"))) {
-		warnx("Cannot open '%s'", file);
-		return NULL;
-	}
-	if (NULL == (mtx = calloc(1, sizeof(struct matrix))))
-		err(1, NULL);
+	if (NULL == fp || NULL == mtx)
+		return ALG_EINVAL;
+	memset(mtx, 0, sizeof(struct matrix));
+	PROF_START(ST_PARSE);
 	while ((len = getline(&line, &size, fp)) != -1) {
-		if (0 == --len)
+		PROF_COUNT(CT_BYTES, len);
+		if ((size_t) len == strspn(line, " \t\r\n")) {
+			if (mtx->rows)
+				break;
 			continue;
-		line[len] = '\0';
-		p = q = strdup(line);
-		if (-1 == (cols = mkrow(q, &row))) {
-			warnx("Cannot parse matrix row: '%s'", line);
-			goto bad;
-		}
-		if (-1 == addrow(row, cols, mtx)) {
-			warnx("Cannot add row %zu: '%s'", mtx->rows, line);
-			goto bad;
 		}
+		if (ALG_OK != (e = addline(mtx, line, len)))
+			break;
 	}
-	free(p);
+	if (ALG_OK == e && ferror(fp))
+		e = ALG_EIO;
+	PROF_STOP(ST_PARSE);
 	free(line);
-	fclose(fp);
-	return mtx;
-bad:
-	free(p);
+	if (ALG_OK != e)
+		freemtx(mtx);
+	return e;
+}
+
+/* Read a matrix from a file, as with parsemtx(). */
+int
+readmtx(const char* file, struct matrix *mtx)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int e = ALG_OK;
+
+	if (NULL == file || NULL == mtx)
+		return ALG_EINVAL;
+	memset(mtx, 0, sizeof(struct matrix));
+	if (NULL == (fp = fopen(file, "r")))
+		return ALG_EIO;
+	PROF_START(ST_PARSE);
+	while ((len = getline(&line, &size, fp)) != -1) {
+		PROF_COUNT(CT_BYTES, len);
+		if (ALG_OK != (e = addline(mtx, line, len)))
+			break;
+	}
+	if (ALG_OK == e && ferror(fp))
+		e = ALG_EIO;
+	PROF_STOP(ST_PARSE);
 	free(line);
-	freemtx(mtx);
 	fclose(fp);
-	return NULL;
+	if (ALG_OK != e)
+		freemtx(mtx);
+	return e;
 }
 
-long
+static long
 nulcols(double* row, long cols)
 {
 	long c, z = 0;
@@ -138,19 +244,20 @@ nulcols(double* row, long cols)
 
 /* Perform the Gaussian Elimination on a given matrix.
  * Fill in the column index where linear dependency starts.
- * Return 0 on success, -1 on error.
+ * The rows get swapped and the null rows moved past the end,
+ * so nothing needs to be allocated here.
+ * Return ALG_OK, or ALG_EINVAL for an empty matrix.
  * NB: this _rewrites_ the matrix. */
 int
 gem(struct matrix* mtx)
 {
-	double *m, *A, *B, a, b;
+	double *A, *B, a, b;
 	long c, r, j, z, maxcol, minrow, maxnul;
 	if (NULL == mtx || 0 == mtx->rows || 0 == mtx->cols)
-		return -1;
+		return ALG_EINVAL;
 	if (1 == mtx->rows)
-		return 0;
-	if (NULL == (m = calloc(mtx->cols, sizeof(double))))
-		err(1, NULL);
+		return ALG_OK;
+	PROF_START(ST_ELIM);
 	/* go through all columns, see if they need geming. */
 	for (c = 0, maxcol = MIN(mtx->cols, mtx->rows); c < maxcol; c++) {
 		/* find a row with a nonzero lead
@@ -168,6 +275,7 @@ gem(struct matrix* mtx)
 			goto elim;
 		}
 		A = mtx->m[minrow];
+		PROF_COUNT(CT_PIVOTS, 1);
 		/* combine the other rows appropriately, zeroing their lead */
 		for (r = c; r < mtx->rows; r++) {
 			if (r == minrow)
@@ -178,24 +286,129 @@ gem(struct matrix* mtx)
 			B[c] = 0;
 			for (j = c+1; j < mtx->cols; j++)
 				B[j] = a * B[j] - b * A[j];
+			PROF_COUNT(CT_ROWS, 1);
+			PROF_COUNT(CT_FLOPS, 3 * (mtx->cols - c - 1));
 		}
 		/* make the minimal row the first row */
 		if (minrow != c) {
-			for (j = 0; j < mtx->cols; j++) {
-				m[j] = A[j];
-				A[j] = mtx->m[c][j];
-				mtx->m[c][j] = m[j];
-			}
+			mtx->m[minrow] = mtx->m[c];
+			mtx->m[c] = A;
 		}
 	}
 elim:
-	/* delete the null rows */
+	/* move the null rows past the end */
 	for (r = mtx->rows-1; r >= c; r--) {
 		if (nulcols(mtx->m[r], mtx->cols) == mtx->cols) {
-			free(mtx->m[r]);
-			mtx->rows--;
+			A = mtx->m[r];
+			mtx->m[r] = mtx->m[--mtx->rows];
+			mtx->m[mtx->rows] = A;
 		}
 	}
 	mtx->gcol = c;
-	return 0;
+	PROF_STOP(ST_ELIM);
+	return ALG_OK;
+}
+
+/* Bring the matrix into the row echelon form, in place.
+ * The elimination picks the largest pivot in each column and scales
+ * the pivot rows to a leading one. An entry counts as zero if it is
+ * within the rounding of the largest number that has been in its
+ * column, which is kept in scale, with room for cols of them.
+ * The column of each pivot is stored in piv, with room for
+ * MIN(rows, cols) of them. As with gem(), the null rows end up
+ * past the end, and gcol is set past the last pivot, so it equals
+ * cols if there is a pivot on the right hand side. Unless det is NULL,
+ * it gets the product of the pivots, with the sign of the row swaps.
+ * Return ALG_OK, or ALG_EINVAL. */
+int
+echelon(struct matrix *mtx, long *piv, double *scale, double *det)
+{
+	double *A, *B, a, b, eps, d = 1;
+	long c, i, j, p, r;
+	if (NULL == mtx || NULL == piv || NULL == scale
+	|| 0 == mtx->rows || 0 == mtx->cols)
+		return ALG_EINVAL;
+	PROF_START(ST_ELIM);
+	eps = DBL_EPSILON * MAX(mtx->rows, mtx->cols);
+	for (j = 0; j < mtx->cols; j++)
+		scale[j] = 0;
+	for (i = 0; i < mtx->rows; i++)
+		for (j = 0; j < mtx->cols; j++)
+			scale[j] = MAX(scale[j], fabs(mtx->m[i][j]));
+	for (r = 0, c = 0; c < mtx->cols && r < mtx->rows; c++) {
+		for (p = r, i = r+1; i < mtx->rows; i++)
+			if (fabs(mtx->m[i][c]) > fabs(mtx->m[p][c]))
+				p = i;
+		if (fabs(mtx->m[p][c]) <= eps * scale[c]) {
+			/* no pivot in this column */
+			for (i = r; i < mtx->rows; i++)
+				mtx->m[i][c] = 0;
+			continue;
+		}
+		PROF_COUNT(CT_PIVOTS, 1);
+		A = mtx->m[p];
+		mtx->m[p] = mtx->m[r];
+		mtx->m[r] = A;
+		d *= p == r ? A[c] : 0 - A[c];
+		/* the multiples of the row subtracted below are as big */
+		for (a = A[c], A[c] = 1, j = c+1; j < mtx->cols; j++) {
+			scale[j] = MAX(scale[j], fabs(A[j]));
+			A[j] /= a;
+		}
+		for (i = r+1; i < mtx->rows; i++) {
+			B = mtx->m[i];
+			if (0 == (b = B[c]))
+				continue;
+			B[c] = 0;
+			for (j = c+1; j < mtx->cols; j++)
+				B[j] -= b * A[j];
+			PROF_COUNT(CT_ROWS, 1);
+			PROF_COUNT(CT_FLOPS, 2 * (mtx->cols - c - 1));
+		}
+		PROF_COUNT(CT_FLOPS, mtx->cols - c - 1);
+		piv[r++] = c;
+	}
+	/* the rest of the rows are null now */
+	mtx->rows = r;
+	mtx->gcol = r ? piv[r-1] + 1 : 0;
+	if (det)
+		*det = d;
+	PROF_STOP(ST_ELIM);
+	return ALG_OK;
+}
+
+/* Bring the matrix into the reduced row echelon form, in place,
+ * going through echelon() first. The elimination above the pivots
+ * then only touches the columns without a pivot: it is a triangular
+ * solve with all of them as right hand sides, done a row at a time.
+ * Return ALG_OK, or ALG_EINVAL. */
+int
+rref(struct matrix *mtx, long *piv, double *scale)
+{
+	double *A, *B, b;
+	long i, j, k, l, r, end;
+	int e;
+	if (ALG_OK != (e = echelon(mtx, piv, scale, NULL)))
+		return e;
+	r = mtx->rows;
+	PROF_START(ST_BACKSUB);
+	for (k = r-1; k > 0; k--) {
+		A = mtx->m[k];
+		for (i = 0; i < k; i++) {
+			B = mtx->m[i];
+			if (0 == (b = B[piv[k]]))
+				continue;
+			B[piv[k]] = 0;
+			/* the runs of columns between the later pivots */
+			for (l = k; l < r; l++) {
+				end = l+1 < r ? piv[l+1] : mtx->cols;
+				for (j = piv[l]+1; j < end; j++)
+					B[j] -= b * A[j];
+			}
+			PROF_COUNT(CT_FLOPS,
+			    2 * (mtx->cols - piv[k] - (r - k)));
+		}
+	}
+	PROF_STOP(ST_BACKSUB);
+	return ALG_OK;
 }
@@ -2,17 +2,26 @@
 #define _ALGEBRA_MATRIX_H_
 
 #include <stdlib.h>
+#include <stdio.h>
+
+#include "algebra.h"
 
 struct matrix {
 	long rows;
 	long cols;
 	long gcol;
+	long nrow;	/* rows allocated here, for freemtx() */
 	double **m;
 };
 
-struct matrix*	readmtx(const char*);
-void		freemtx(struct matrix*);
-void		prmtx(struct matrix*);
-int		gem(struct matrix*);
+int	parsemtx(const char*, size_t, struct matrix*);
+int	readmtx(const char*, struct matrix*);
+int	fgetmtx(FILE*, struct matrix*);
+int	mtxinit(struct matrix*, double*, long, long, double**);
+void	freemtx(struct matrix*);
+void	prmtx(struct matrix*);
+int	gem(struct matrix*);
+int	echelon(struct matrix*, long*, double*, double*);
+int	rref(struct matrix*, long*, double*);
 
 #endif
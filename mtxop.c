@@ -0,0 +1,394 @@
+/* The arithmetic of matrices. The results are carved from the workspace
+ * of the context, so they stay valid until its next use; the operands
+ * are left intact. The product is computed the way the optimized BLAS
+ * do it: a block of A and a panel of B are packed into contiguous
+ * slivers sized for the caches, and a micro-kernel multiplies a sliver
+ * of A by a sliver of B into a small block of C kept in the registers.
+ * The inverse, the determinant and the rank go through the elimination
+ * of matrix.c. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
+#include "mtxop.h"
+#include "prof.h"
+
+/* The block of C the micro-kernel keeps in the registers;
+ * with two-double vectors, bigger ones spill. */
+#define MR	2
+#define NR	4
+
+/* The packed blocks: MC x KC of A to stay in the L2 cache,
+ * KC x NC of B to stay in the L3; MC is a multiple of MR
+ * and NC of NR. */
+#define MC	128
+#define KC	256
+#define NC	2048
+
+/* Threads multiplying. */
+#define MAXJOBS	256
+
+/* Give each thread at least this many multiply-adds. */
+#define JOBFMA	(1L << 18)
+
+/* The tiles of a transposition. */
+#define TB	32
+
+#define MIN(x,y)	(((x) < (y)) ? (x) : (y))
+#define ROUNDUP(n, m)	(((n) + (m) - 1) / (m) * (m))
+
+struct gjob {
+	const struct matrix	*a;
+	const struct matrix	*b;
+	double			*c;	/* the product, row by row */
+	long			 ldc;	/* its columns */
+	long			 r0, r1;	/* the rows of C computed here */
+	long			 c0, c1;	/* and the columns */
+	double			*pa;	/* the packed block of A */
+	double			*pb;	/* the packed panel of B */
+};
+
+/* The bytes of a rows x cols matrix in the workspace,
+ * or 0 if that is too much. */
+static size_t
+mtxsize(long rows, long cols)
+{
+	if (rows < 1 || cols < 1
+	|| (size_t) cols > SIZE_MAX / sizeof(double) / 2 / rows)
+		return 0;
+	return ALGSIZE((size_t) rows * sizeof(double*))
+	    + ALGSIZE((size_t) rows * cols * sizeof(double));
+}
+
+/* Take a zero rows x cols matrix from the reserved workspace. */
+static void
+newmtx(struct alg *ctx, long rows, long cols, struct matrix *mtx)
+{
+	double **rowp;
+	double *a;
+	rowp = algtake(ctx, (size_t) rows * sizeof(double*));
+	a = algtake(ctx, (size_t) rows * cols * sizeof(double));
+	mtxinit(mtx, a, rows, cols, rowp);
+}
+
+/* Copy the matrix into the first columns of a new one,
+ * taken from the reserved workspace. */
+static void
+cpmtx(struct alg *ctx, const struct matrix *a, long cols, struct matrix *c)
+{
+	long r;
+	newmtx(ctx, a->rows, cols, c);
+	for (r = 0; r < a->rows; r++)
+		memcpy(c->m[r], a->m[r], a->cols * sizeof(double));
+}
+
+static int
+badmtx(const struct matrix *mtx)
+{
+	return NULL == mtx || NULL == mtx->m || mtx->rows < 1 || mtx->cols < 1;
+}
+
+/* C = A + B, of the same shape.
+ * Return ALG_OK or an error code. */
+int
+mtxadd(struct alg *ctx, const struct matrix *a, const struct matrix *b,
+	struct matrix *c)
+{
+	long i, j;
+	size_t size;
+	int e;
+	if (NULL == ctx || badmtx(a) || badmtx(b) || NULL == c)
+		return ALG_EINVAL;
+	if (a->rows != b->rows || a->cols != b->cols)
+		return ALG_EDIM;
+	if (0 == (size = mtxsize(a->rows, a->cols)))
+		return ALG_ENOMEM;
+	if (ALG_OK != (e = algwork(ctx, size)))
+		return e;
+	newmtx(ctx, a->rows, a->cols, c);
+	for (i = 0; i < a->rows; i++)
+		for (j = 0; j < a->cols; j++)
+			c->m[i][j] = a->m[i][j] + b->m[i][j];
+	PROF_COUNT(CT_FLOPS, a->rows * a->cols);
+	return ALG_OK;
+}
+
+/* T = A', a tile at a time, so that neither the rows read
+ * nor the rows written leave the cache.
+ * Return ALG_OK or an error code. */
+int
+mtxtrans(struct alg *ctx, const struct matrix *a, struct matrix *t)
+{
+	long i, j, ii, jj, ie, je;
+	size_t size;
+	int e;
+	if (NULL == ctx || badmtx(a) || NULL == t)
+		return ALG_EINVAL;
+	if (0 == (size = mtxsize(a->cols, a->rows)))
+		return ALG_ENOMEM;
+	if (ALG_OK != (e = algwork(ctx, size)))
+		return e;
+	newmtx(ctx, a->cols, a->rows, t);
+	for (ii = 0; ii < a->rows; ii += TB)
+		for (jj = 0, ie = MIN(ii + TB, a->rows); jj < a->cols; jj += TB)
+			for (i = ii, je = MIN(jj + TB, a->cols); i < ie; i++)
+				for (j = jj; j < je; j++)
+					t->m[j][i] = a->m[i][j];
+	return ALG_OK;
+}
+
+/* Pack the mc x kc block of A at row i and column p
+ * into slivers of MR rows, stored column by column,
+ * padding the last one with zeros. */
+static void
+packa(const struct matrix *a, long i, long mc, long p, long kc, double *pa)
+{
+	const double *row;
+	double *s;
+	long r, q;
+	for (r = 0; r < ROUNDUP(mc, MR); r++) {
+		s = pa + (r / MR) * MR * kc + r % MR;
+		if (r >= mc) {
+			for (q = 0; q < kc; q++)
+				s[q * MR] = 0;
+			continue;
+		}
+		for (q = 0, row = a->m[i + r] + p; q < kc; q++)
+			s[q * MR] = row[q];
+	}
+}
+
+/* Pack the kc x nc panel of B at row p and column j
+ * into slivers of NR columns, stored row by row,
+ * padding the last one with zeros. */
+static void
+packb(const struct matrix *b, long p, long kc, long j, long nc, double *pb)
+{
+	const double *row;
+	double *s;
+	long q, c, n;
+	for (q = 0; q < kc; q++) {
+		row = b->m[p + q] + j;
+		for (c = 0; c < nc; c += NR) {
+			s = pb + c * kc + q * NR;
+			n = MIN(NR, nc - c);
+			memcpy(s, row + c, n * sizeof(double));
+			for (; n < NR; n++)
+				s[n] = 0;
+		}
+	}
+}
+
+/* C += A B for a sliver of MR rows of A and NR columns of B,
+ * both kc long; only the mr x nr corner of the block is stored.
+ * The constant bounds let the compiler keep the block
+ * in the vector registers. */
+static void
+kernel(long kc, const double *a, const double *b, double *c, long ldc,
+	long mr, long nr)
+{
+	double ab[MR][NR];
+	long i, j, q;
+	for (i = 0; i < MR; i++)
+		for (j = 0; j < NR; j++)
+			ab[i][j] = 0;
+	for (q = 0; q < kc; q++, a += MR, b += NR)
+		for (i = 0; i < MR; i++)
+			for (j = 0; j < NR; j++)
+				ab[i][j] += a[i] * b[j];
+	for (i = 0; i < mr; i++, c += ldc)
+		for (j = 0; j < nr; j++)
+			c[j] += ab[i][j];
+}
+
+/* Multiply the part of the product assigned to the job,
+ * a panel of B and a block of A at a time. */
+static void*
+gwork(void *arg)
+{
+	struct gjob *g = arg;
+	long k = g->a->cols, ic, jc, pc, ir, jr, mc, nc, kc;
+	double *c;
+	for (jc = g->c0; jc < g->c1; jc += NC) {
+		nc = MIN(NC, g->c1 - jc);
+		for (pc = 0; pc < k; pc += KC) {
+			kc = MIN(KC, k - pc);
+			packb(g->b, pc, kc, jc, nc, g->pb);
+			for (ic = g->r0; ic < g->r1; ic += MC) {
+				mc = MIN(MC, g->r1 - ic);
+				packa(g->a, ic, mc, pc, kc, g->pa);
+				for (jr = 0; jr < nc; jr += NR) {
+					c = g->c + ic * g->ldc + jc + jr;
+					for (ir = 0; ir < mc; ir += MR)
+						kernel(kc, g->pa + ir * kc,
+						    g->pb + jr * kc,
+						    c + ir * g->ldc, g->ldc,
+						    MIN(MR, mc - ir),
+						    MIN(NR, nc - jr));
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+/* C = A B, with the rows or the columns of C, whichever are more,
+ * split among the jobs; each job packs its own blocks.
+ * Return ALG_OK or an error code. */
+int
+mtxmul(struct alg *ctx, const struct matrix *a, const struct matrix *b,
+	struct matrix *c, int jobs)
+{
+	struct gjob job[MAXJOBS];
+	long m, n, k, units, unit, u0, u1;
+	size_t size, pack;
+	double fma;
+	int t, e;
+	if (NULL == ctx || badmtx(a) || badmtx(b) || NULL == c || jobs < 1)
+		return ALG_EINVAL;
+	if (a->cols != b->rows)
+		return ALG_EDIM;
+	m = a->rows;
+	n = b->cols;
+	k = a->cols;
+	fma = (double) m * n * k;
+	if (jobs > MAXJOBS)
+		jobs = MAXJOBS;
+	if (jobs > 1 + fma / JOBFMA)
+		jobs = 1 + fma / JOBFMA;
+	unit = n >= m ? NR : MR;
+	units = ((n >= m ? n : m) + unit - 1) / unit;
+	if (jobs > units)
+		jobs = units;
+	/* the biggest part gets at most this many rows or columns */
+	u1 = (units + jobs - 1) / jobs * unit;
+	pack = ALGSIZE((size_t) MIN(KC, k) * sizeof(double)
+	    * (n >= m ? ROUNDUP(MIN(MC, m), MR) + MIN(NC, u1)
+	    : MIN(MC, u1) + ROUNDUP(MIN(NC, n), NR)));
+	if (0 == (size = mtxsize(m, n)) || (SIZE_MAX - size) / jobs < pack)
+		return ALG_ENOMEM;
+	if (ALG_OK != (e = algwork(ctx, size + jobs * pack)))
+		return e;
+	newmtx(ctx, m, n, c);
+	PROF_START(ST_MULT);
+	for (t = 0; t < jobs; t++) {
+		job[t].a = a;
+		job[t].b = b;
+		job[t].c = c->m[0];
+		job[t].ldc = n;
+		u0 = units * t / jobs * unit;
+		u1 = units * (t + 1) / jobs * unit;
+		job[t].r0 = n >= m ? 0 : u0;
+		job[t].r1 = n >= m ? m : MIN(u1, m);
+		job[t].c0 = n >= m ? u0 : 0;
+		job[t].c1 = n >= m ? MIN(u1, n) : n;
+		/* the block of A first, then the panel of B */
+		job[t].pa = algtake(ctx, pack);
+		job[t].pb = job[t].pa + MIN(KC, k) * ROUNDUP(MIN(MC,
+		    job[t].r1 - job[t].r0), MR);
+	}
+	algjobs(gwork, job, sizeof(struct gjob), jobs);
+	PROF_COUNT(CT_FLOPS, 2 * m * n * k);
+	PROF_STOP(ST_MULT);
+	return ALG_OK;
+}
+
+/* The inverse of a square matrix: the elimination of [A | I]
+ * to the reduced row echelon form leaves the inverse on the right.
+ * Its rows point into the workspace. Return ALG_OK or an error code,
+ * ALG_ESING if the matrix is singular. */
+int
+mtxinv(struct alg *ctx, const struct matrix *a, struct matrix *inv)
+{
+	struct matrix aug;
+	double *scale;
+	long *piv, n, r;
+	size_t size;
+	int e;
+	if (NULL == ctx || badmtx(a) || NULL == inv)
+		return ALG_EINVAL;
+	if (a->rows != a->cols)
+		return ALG_EDIM;
+	n = a->rows;
+	if (0 == (size = mtxsize(n, 2 * n)))
+		return ALG_ENOMEM;
+	size += ALGSIZE(n * sizeof(long)) + ALGSIZE(2 * n * sizeof(double))
+	    + ALGSIZE(n * sizeof(double*));
+	if (ALG_OK != (e = algwork(ctx, size)))
+		return e;
+	cpmtx(ctx, a, 2 * n, &aug);
+	for (r = 0; r < n; r++)
+		aug.m[r][n + r] = 1;
+	piv = algtake(ctx, n * sizeof(long));
+	scale = algtake(ctx, 2 * n * sizeof(double));
+	if (ALG_OK != (e = rref(&aug, piv, scale)))
+		return e;
+	if (aug.rows < n || piv[n-1] != n-1)
+		return ALG_ESING;
+	memset(inv, 0, sizeof(struct matrix));
+	inv->m = algtake(ctx, n * sizeof(double*));
+	inv->rows = inv->cols = n;
+	for (r = 0; r < n; r++)
+		inv->m[r] = aug.m[r] + n;
+	return ALG_OK;
+}
+
+/* Eliminate a copy of the matrix into the row echelon form. */
+static int
+reduce(struct alg *ctx, const struct matrix *a, struct matrix *copy,
+	double *det)
+{
+	size_t size;
+	long *piv;
+	double *scale;
+	int e;
+	if (NULL == ctx || badmtx(a))
+		return ALG_EINVAL;
+	if (0 == (size = mtxsize(a->rows, a->cols)))
+		return ALG_ENOMEM;
+	size += ALGSIZE(MIN(a->rows, a->cols) * sizeof(long))
+	    + ALGSIZE(a->cols * sizeof(double));
+	if (ALG_OK != (e = algwork(ctx, size)))
+		return e;
+	cpmtx(ctx, a, a->cols, copy);
+	piv = algtake(ctx, MIN(a->rows, a->cols) * sizeof(long));
+	scale = algtake(ctx, a->cols * sizeof(double));
+	return echelon(copy, piv, scale, det);
+}
+
+/* The determinant of a square matrix, the product of the pivots.
+ * Return ALG_OK or an error code. */
+int
+mtxdet(struct alg *ctx, const struct matrix *a, double *det)
+{
+	struct matrix copy;
+	int e;
+	if (NULL == det || badmtx(a))
+		return ALG_EINVAL;
+	if (a->rows != a->cols)
+		return ALG_EDIM;
+	if (ALG_OK != (e = reduce(ctx, a, &copy, det)))
+		return e;
+	if (copy.rows < a->rows)
+		*det = 0;
+	return ALG_OK;
+}
+
+/* The rank of a matrix, the number of pivots.
+ * Return ALG_OK or an error code. */
+int
+mtxrank(struct alg *ctx, const struct matrix *a, long *rank)
+{
+	struct matrix copy;
+	int e;
+	if (NULL == rank)
+		return ALG_EINVAL;
+	if (ALG_OK != (e = reduce(ctx, a, &copy, NULL)))
+		return e;
+	*rank = copy.rows;
+	return ALG_OK;
+}
@@ -0,0 +1,16 @@
+#ifndef _ALGEBRA_MTXOP_H_
+#define _ALGEBRA_MTXOP_H_
+
+#include "algebra.h"
+#include "matrix.h"
+
+int	mtxadd(struct alg*, const struct matrix*, const struct matrix*,
+	    struct matrix*);
+int	mtxtrans(struct alg*, const struct matrix*, struct matrix*);
+int	mtxmul(struct alg*, const struct matrix*, const struct matrix*,
+	    struct matrix*, int);
+int	mtxinv(struct alg*, const struct matrix*, struct matrix*);
+int	mtxdet(struct alg*, const struct matrix*, double*);
+int	mtxrank(struct alg*, const struct matrix*, long*);
+
+#endif
@@ -0,0 +1,598 @@
+/* Solve a regular system too big for the memory. The augmented matrix
+ * gets written into a temporary file as square tiles, which are then
+ * factored in the left-looking LU order: each column of tiles (a panel)
+ * is read in, updated with the factored panels to its left, factored
+ * with partial pivoting and written back. Only the panel being worked
+ * on and a few tiles read ahead by a prefetching thread are in memory,
+ * so the I/O overlaps the arithmetic. The right hand side is the last
+ * column of the matrix, so it gets eliminated along the way, and the
+ * L factor is never needed again; the row interchanges are applied to
+ * each panel as it comes, leaving the factored panels as they are.
+ * What remains is a back substitution reading the U tiles once. */
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
+#include "lineq.h"
+#include "ooc.h"
+#include "prof.h"
+
+/* Tiles read ahead. */
+#define NBUF	4
+
+/* Threads multiplying the tiles. */
+#define MAXJOBS	256
+
+struct tiles {
+	int		 fd;
+	long		 n;	/* unknowns; the matrix is n x (n+1) */
+	long		 b;	/* the size of a tile */
+	long		 R;	/* tiles down */
+	long		 C;	/* tiles across */
+};
+
+/* The order in which the tiles are needed. */
+struct sched {
+	int		 phase;	/* 0 panel, 1 update, 2 back substitution */
+	long		 i, j, k;
+};
+
+struct fetch {
+	struct tiles	*t;
+	struct sched	 s;
+	pthread_t	 tid;
+	pthread_mutex_t	 lock;
+	pthread_cond_t	 cond;
+	double		*buf;	/* NBUF tiles */
+	long		 head;	/* tiles read */
+	long		 tail;	/* tiles used */
+	long		 ready;	/* panels written back */
+	int		 err;
+	int		 stop;
+	int		 sync;	/* no thread: take() reads the tiles */
+};
+
+struct gjob {
+	double		*P;
+	const double	*L;
+	const double	*U;
+	long		 b;
+	long		 first;
+	long		 last;
+};
+
+#define TILE(t)	((size_t) (t)->b * (t)->b)
+
+static off_t
+tileoff(struct tiles *t, long i, long j)
+{
+	return ((off_t) i * t->C + j) * TILE(t) * sizeof(double);
+}
+
+static int
+rdtile(struct tiles *t, long i, long j, double *a)
+{
+	size_t len = TILE(t) * sizeof(double), got = 0;
+	ssize_t r;
+	while (got < len) {
+		r = pread(t->fd, (char*) a + got, len - got,
+		    tileoff(t, i, j) + got);
+		if (r <= 0)
+			return ALG_EIO;
+		got += r;
+	}
+	return ALG_OK;
+}
+
+static int
+wrtile(struct tiles *t, long i, long j, const double *a)
+{
+	size_t len = TILE(t) * sizeof(double), put = 0;
+	ssize_t w;
+	while (put < len) {
+		w = pwrite(t->fd, (const char*) a + put, len - put,
+		    tileoff(t, i, j) + put);
+		if (w <= 0)
+			return ALG_EIO;
+		put += w;
+	}
+	return ALG_OK;
+}
+
+/* Fill in the next tile needed, and the number of panels
+ * that must have been written back before it can be read.
+ * Return 0 when there are no more. */
+static int
+next(struct tiles *t, struct sched *s, long *i, long *j, long *need)
+{
+	for (;;) switch (s->phase) {
+	case 0:
+		/* read in the panel j */
+		if (s->j == t->C) {
+			s->phase = 2;
+			s->i = t->R - 1;
+			s->j = t->C - 1;
+			continue;
+		}
+		if (s->i < t->R) {
+			*i = s->i++;
+			*j = s->j;
+			*need = 0;
+			return 1;
+		}
+		s->phase = 1;
+		s->k = 0;
+		s->i = 0;
+		continue;
+	case 1:
+		/* the L tiles of the panels k < j */
+		if (s->k < s->j && s->k < t->R) {
+			if (s->i < s->k)
+				s->i = s->k;
+			if (s->i < t->R) {
+				*i = s->i++;
+				*j = s->k;
+				*need = s->k + 1;
+				return 1;
+			}
+			s->k++;
+			s->i = 0;
+			continue;
+		}
+		s->phase = 0;
+		s->i = 0;
+		s->j++;
+		continue;
+	case 2:
+		/* the U tiles, from the bottom right */
+		if (s->i < 0)
+			return 0;
+		if (s->j >= s->i) {
+			*i = s->i;
+			*j = s->j--;
+			*need = t->C;
+			return 1;
+		}
+		s->i--;
+		s->j = t->C - 1;
+		continue;
+	}
+}
+
+static void*
+prefetch(void *arg)
+{
+	struct fetch *f = arg;
+	double *a;
+	long i, j, need;
+	int e;
+	while (next(f->t, &f->s, &i, &j, &need)) {
+		pthread_mutex_lock(&f->lock);
+		while (0 == f->stop
+		&& (f->head - f->tail == NBUF || f->ready < need))
+			pthread_cond_wait(&f->cond, &f->lock);
+		if (f->stop) {
+			pthread_mutex_unlock(&f->lock);
+			break;
+		}
+		pthread_mutex_unlock(&f->lock);
+		a = f->buf + (f->head % NBUF) * TILE(f->t);
+		e = rdtile(f->t, i, j, a);
+		pthread_mutex_lock(&f->lock);
+		if (ALG_OK != e)
+			f->err = e;
+		f->head++;
+		pthread_cond_broadcast(&f->cond);
+		pthread_mutex_unlock(&f->lock);
+		if (ALG_OK != e)
+			break;
+	}
+	return NULL;
+}
+
+/* Wait for the next tile in the schedule, or read it here if there
+ * is no thread to read ahead. Return NULL on error. */
+static double*
+take(struct fetch *f)
+{
+	double *a = NULL;
+	long i, j, need;
+	if (f->sync) {
+		if (0 == next(f->t, &f->s, &i, &j, &need))
+			f->err = ALG_EINVAL;
+		else if (ALG_OK == (f->err = rdtile(f->t, i, j,
+		    a = f->buf + (f->head % NBUF) * TILE(f->t))))
+			f->head++;
+		return ALG_OK == f->err ? a : NULL;
+	}
+	pthread_mutex_lock(&f->lock);
+	while (f->head == f->tail && ALG_OK == f->err)
+		pthread_cond_wait(&f->cond, &f->lock);
+	if (f->head > f->tail)
+		a = f->buf + (f->tail % NBUF) * TILE(f->t);
+	pthread_mutex_unlock(&f->lock);
+	return a;
+}
+
+/* Done with the tile from take(). */
+static void
+release(struct fetch *f)
+{
+	pthread_mutex_lock(&f->lock);
+	f->tail++;
+	pthread_cond_broadcast(&f->cond);
+	pthread_mutex_unlock(&f->lock);
+}
+
+/* Panels up to j have been written back. */
+static void
+written(struct fetch *f, long j)
+{
+	pthread_mutex_lock(&f->lock);
+	f->ready = j + 1;
+	pthread_cond_broadcast(&f->cond);
+	pthread_mutex_unlock(&f->lock);
+}
+
+static void*
+gwork(void *arg)
+{
+	struct gjob *g = arg;
+	const double *l, *u;
+	double *p;
+	long r, q, c;
+	for (r = g->first; r < g->last; r++) {
+		p = g->P + r * g->b;
+		for (q = 0, l = g->L + r * g->b; q < g->b; q++) {
+			if (0 == l[q])
+				continue;
+			for (c = 0, u = g->U + q * g->b; c < g->b; c++)
+				p[c] -= l[q] * u[c];
+		}
+	}
+	return NULL;
+}
+
+/* P -= L U, all of them b x b, with the rows split among the jobs. */
+static void
+gemm(double *P, const double *L, const double *U, long b, int jobs)
+{
+	struct gjob job[MAXJOBS];
+	int t;
+	if (jobs > MAXJOBS)
+		jobs = MAXJOBS;
+	if (jobs > b)
+		jobs = b;
+	for (t = 0; t < jobs; t++) {
+		job[t].P = P;
+		job[t].L = L;
+		job[t].U = U;
+		job[t].b = b;
+		job[t].first = b * t / jobs;
+		job[t].last = b * (t + 1) / jobs;
+	}
+	algjobs(gwork, job, sizeof(struct gjob), jobs);
+}
+
+/* Store a row of the matrix into the block of b rows. */
+static int
+putrow(struct tiles *t, double *blk, long r, const double *row, long cols)
+{
+	long c, i = r / t->b, j;
+	double *a = blk + (r % t->b) * t->b;
+	if (cols != t->n + 1)
+		return ALG_ESHAPE;
+	for (c = 0; c < cols; c++)
+		a[(c / t->b) * TILE(t) + c % t->b] = row[c];
+	if (r % t->b == t->b - 1 || r == t->n - 1) {
+		for (j = 0; j < t->C; j++)
+			if (ALG_OK != wrtile(t, i, j, blk + j * TILE(t)))
+				return ALG_EIO;
+		memset(blk, 0, t->C * TILE(t) * sizeof(double));
+	}
+	return ALG_OK;
+}
+
+/* Read the augmented matrix, as text or as one binary frame,
+ * and write it into the tile file. */
+static int
+mktiles(struct tiles *t, FILE *in, int binary, long b)
+{
+	struct matrix mtx;
+	uint32_t dim[2];
+	double *blk = NULL, *row = NULL;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	long r = 0;
+	int e = ALG_OK;
+
+	t->b = b;
+	if (binary) {
+		if (2 != fread(dim, sizeof(uint32_t), 2, in))
+			return ALG_EIO;
+		if (dim[0] < 1 || dim[1] != dim[0] + 1)
+			return ALG_ESHAPE;
+		t->n = dim[0];
+	} else {
+		/* the first row tells the size */
+		memset(&mtx, 0, sizeof(struct matrix));
+		while (0 == mtx.rows
+		&& (len = getline(&line, &size, in)) != -1)
+			if (ALG_OK != (e = parsemtx(line, len, &mtx)))
+				goto done;
+		if (0 == mtx.rows || mtx.cols < 2) {
+			e = mtx.rows ? ALG_ESHAPE : ALG_EIO;
+			goto done;
+		}
+		t->n = mtx.cols - 1;
+	}
+	t->R = (t->n + b - 1) / b;
+	t->C = (t->n + 1 + b - 1) / b;
+	if (NULL == (blk = calloc(t->C * TILE(t), sizeof(double)))
+	||  NULL == (row = calloc(t->n + 1, sizeof(double)))) {
+		e = ALG_ENOMEM;
+		goto done;
+	}
+	if (0 == binary) {
+		e = putrow(t, blk, r++, mtx.m[0], mtx.cols);
+		freemtx(&mtx);
+	}
+	while (ALG_OK == e && r < t->n) {
+		if (binary) {
+			if ((size_t) t->n + 1
+			    != fread(row, sizeof(double), t->n + 1, in)) {
+				e = ALG_EIO;
+				break;
+			}
+			e = putrow(t, blk, r++, row, t->n + 1);
+			continue;
+		}
+		if ((len = getline(&line, &size, in)) == -1) {
+			e = ALG_ESHAPE;
+			break;
+		}
+		if (ALG_OK != (e = parsemtx(line, len, &mtx)))
+			break;
+		if (mtx.rows)
+			e = putrow(t, blk, r++, mtx.m[0], mtx.cols);
+		freemtx(&mtx);
+	}
+done:
+	free(line);
+	free(blk);
+	free(row);
+	return e;
+}
+
+/* Swap the rows of the panel. */
+static void
+swap(struct tiles *t, double *P, long r1, long r2)
+{
+	double *a, *b, x;
+	long c;
+	if (r1 == r2)
+		return;
+	a = P + (r1 / t->b) * TILE(t) + (r1 % t->b) * t->b;
+	b = P + (r2 / t->b) * TILE(t) + (r2 % t->b) * t->b;
+	for (c = 0; c < t->b; c++) {
+		x = a[c];
+		a[c] = b[c];
+		b[c] = x;
+	}
+}
+
+/* Factor the panel j, already updated, with partial pivoting. */
+static int
+factor(struct tiles *t, double *P, long j, long *piv)
+{
+	double *d, *a, l, m;
+	long c, r, g, p, q, w;
+	for (c = 0; c < t->b && (g = j * t->b + c) < t->n; c++) {
+		for (r = g, p = -1, m = 0; r < t->n; r++) {
+			a = P + (r / t->b) * TILE(t) + (r % t->b) * t->b;
+			if (fabs(a[c]) > m) {
+				m = fabs(a[c]);
+				p = r;
+			}
+		}
+		if (-1 == p)
+			return ALG_ESING;
+		swap(t, P, g, p);
+		piv[g] = p;
+		d = P + (g / t->b) * TILE(t) + (g % t->b) * t->b;
+		for (r = g + 1; r < t->n; r++) {
+			a = P + (r / t->b) * TILE(t) + (r % t->b) * t->b;
+			if (0 == a[c])
+				continue;
+			l = a[c] /= d[c];
+			for (q = c + 1, w = t->b; q < w; q++)
+				a[q] -= l * d[q];
+		}
+		PROF_COUNT(CT_PIVOTS, 1);
+		PROF_COUNT(CT_FLOPS, 2ULL * (t->n - g) * (t->b - c));
+	}
+	return ALG_OK;
+}
+
+/* Update the panel P with the factored panel k, streamed in. */
+static int
+update(struct tiles *t, struct fetch *f, double *P, long k,
+	const long *piv, int jobs)
+{
+	double *L, *U = P + k * TILE(t), *a, *u, l;
+	long r, q, i, c;
+	for (r = k * t->b; r < t->n && r < (k + 1) * t->b; r++)
+		swap(t, P, r, piv[r]);
+	/* U_kj = L_kk^-1 P_k */
+	if (NULL == (L = take(f)))
+		return f->err;
+	for (r = 1; r < t->b; r++) {
+		for (q = 0, a = U + r * t->b; q < r; q++) {
+			if (0 == (l = L[r * t->b + q]))
+				continue;
+			for (c = 0, u = U + q * t->b; c < t->b; c++)
+				a[c] -= l * u[c];
+		}
+	}
+	release(f);
+	/* P_i -= L_ik U_kj */
+	for (i = k + 1; i < t->R; i++) {
+		if (NULL == (L = take(f)))
+			return f->err;
+		gemm(P + i * TILE(t), L, U, t->b, jobs);
+		release(f);
+		PROF_COUNT(CT_FLOPS, 2ULL * TILE(t) * t->b);
+	}
+	return ALG_OK;
+}
+
+/* Solve U x = y, reading the U tiles from the bottom right. */
+static int
+backsub(struct tiles *t, struct fetch *f, double *x)
+{
+	double *U, *y, *acc;
+	long i, j, r, c, g;
+	if (NULL == (y = calloc(2 * t->b, sizeof(double))))
+		return ALG_ENOMEM;
+	acc = y + t->b;
+	for (i = t->R - 1; i >= 0; i--) {
+		memset(y, 0, 2 * t->b * sizeof(double));
+		for (j = t->C - 1; j >= i; j--) {
+			if (NULL == (U = take(f))) {
+				free(y);
+				return f->err;
+			}
+			for (r = 0; r < t->b && i * t->b + r < t->n; r++) {
+				for (c = 0; c < t->b; c++) {
+					g = j * t->b + c;
+					if (g == t->n)
+						y[r] = U[r * t->b + c];
+					else if (g < t->n && j > i)
+						acc[r] += U[r * t->b + c] * x[g];
+				}
+			}
+			if (j > i) {
+				release(f);
+				continue;
+			}
+			/* the diagonal tile */
+			for (r = t->b - 1; r >= 0; r--) {
+				if ((g = i * t->b + r) >= t->n)
+					continue;
+				for (c = r + 1; c < t->b && i * t->b + c < t->n; c++)
+					acc[r] += U[r * t->b + c] * x[i * t->b + c];
+				x[g] = (y[r] - acc[r]) / U[r * t->b + r];
+			}
+			release(f);
+		}
+	}
+	free(y);
+	return ALG_OK;
+}
+
+/* Solve the regular system given by the augmented n x (n+1) matrix,
+ * read from the stream as text or as a binary frame (as in le -B),
+ * out of core, with square tiles of the given size. The memory used
+ * is about 8 n tile bytes, plus the solution, which is left in the
+ * workspace of the context, valid until its next use.
+ * The tile file goes into TMPDIR, or /tmp.
+ * Return ALG_OK or an error code. */
+int
+oocsolve(struct alg *ctx, FILE *in, int binary, long tile, int jobs,
+	struct linsol *sol)
+{
+	struct tiles t;
+	struct fetch f;
+	char path[PATH_MAX];
+	const char *tmp;
+	double *P = NULL, *x, *a;
+	long *piv = NULL, i, j, k;
+	int e, started = 0;
+
+	if (NULL == ctx || NULL == in || NULL == sol || tile < 1 || jobs < 1)
+		return ALG_EINVAL;
+	memset(&t, 0, sizeof(struct tiles));
+	memset(&f, 0, sizeof(struct fetch));
+	if (NULL == (tmp = getenv("TMPDIR")) || '\0' == *tmp)
+		tmp = "/tmp";
+	if ((size_t) snprintf(path, sizeof(path), "%s/le.XXXXXXXXXX", tmp)
+	    >= sizeof(path) || -1 == (t.fd = mkstemp(path)))
+		return ALG_EIO;
+	unlink(path);
+
+	if (ALG_OK != (e = mktiles(&t, in, binary, tile)))
+		goto done;
+	if (ALG_OK != (e = algwork(ctx, t.n * sizeof(double))))
+		goto done;
+	x = algtake(ctx, t.n * sizeof(double));
+	if (NULL == (P = calloc(t.R * TILE(&t), sizeof(double)))
+	||  NULL == (piv = calloc(t.n, sizeof(long)))
+	||  NULL == (f.buf = calloc(NBUF * TILE(&t), sizeof(double)))) {
+		e = ALG_ENOMEM;
+		goto done;
+	}
+	f.t = &t;
+	pthread_mutex_init(&f.lock, NULL);
+	pthread_cond_init(&f.cond, NULL);
+	started = 1;
+	/* read the tiles as they are needed without the thread */
+	f.sync = 0 != pthread_create(&f.tid, NULL, prefetch, &f);
+
+	PROF_START(ST_ELIM);
+	for (j = 0; j < t.C && ALG_OK == e; j++) {
+		for (i = 0; i < t.R; i++) {
+			if (NULL == (a = take(&f))) {
+				e = f.err;
+				break;
+			}
+			memcpy(P + i * TILE(&t), a, TILE(&t) * sizeof(double));
+			release(&f);
+		}
+		for (k = 0; ALG_OK == e && k < j && k < t.R; k++)
+			e = update(&t, &f, P, k, piv, jobs);
+		if (ALG_OK == e && j < t.R)
+			e = factor(&t, P, j, piv);
+		for (i = 0; ALG_OK == e && i < t.R; i++)
+			e = wrtile(&t, i, j, P + i * TILE(&t));
+		written(&f, j);
+	}
+	PROF_STOP(ST_ELIM);
+	if (ALG_OK != e)
+		goto done;
+
+	PROF_START(ST_BACKSUB);
+	e = backsub(&t, &f, x);
+	PROF_STOP(ST_BACKSUB);
+	if (ALG_OK == e) {
+		memset(sol, 0, sizeof(struct linsol));
+		sol->len = t.n;
+		sol->par = x;
+	}
+done:
+	if (started) {
+		pthread_mutex_lock(&f.lock);
+		f.stop = 1;
+		pthread_cond_broadcast(&f.cond);
+		pthread_mutex_unlock(&f.lock);
+		if (!f.sync)
+			pthread_join(f.tid, NULL);
+		pthread_mutex_destroy(&f.lock);
+		pthread_cond_destroy(&f.cond);
+	}
+	close(t.fd);
+	free(f.buf);
+	free(piv);
+	free(P);
+	return e;
+}
@@ -0,0 +1,11 @@
+#ifndef _ALGEBRA_OOC_H_
+#define _ALGEBRA_OOC_H_
+
+#include <stdio.h>
+
+#include "algebra.h"
+#include "lineq.h"
+
+int	oocsolve(struct alg*, FILE*, int, long, int, struct linsol*);
+
+#endif
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <time.h>
+#include <err.h>
+
+#include "config.h"
+#include "prof.h"
+
+#if WITH_PROF
+
+static const char *stages[ST_MAX] = {
+	"parse", "elim", "backsub", "fit", "mult", "output"
+};
+
+static const char *counters[CT_MAX] = {
+	"flops", "pivots", "rows", "allocs", "bytes"
+};
+
+struct prof prof;
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void
+profon(void)
+{
+	prof.on = 1;
+}
+
+void
+profstart(enum stage s)
+{
+	prof.start[s] = now();
+	prof.calls[s]++;
+}
+
+void
+profstop(enum stage s)
+{
+	prof.time[s] += now() - prof.start[s];
+}
+
+/* Print the per-stage breakdown on stderr, as JSON if asked to. */
+void
+prprof(int json)
+{
+	int i;
+	if (json) {
+		fprintf(stderr, "{\"stages\": {");
+		for (i = 0; i < ST_MAX; i++)
+			fprintf(stderr, "%s\"%s\": {\"calls\": %ld, "
+			    "\"seconds\": %.9f}", i ? ", " : "",
+			    stages[i], prof.calls[i], prof.time[i]);
+		fprintf(stderr, "}, \"counters\": {");
+		for (i = 0; i < CT_MAX; i++)
+			fprintf(stderr, "%s\"%s\": %llu", i ? ", " : "",
+			    counters[i], prof.count[i]);
+		fprintf(stderr, "}}\n");
+		return;
+	}
+	fprintf(stderr, "%-8s %10s %12s\n", "stage", "calls", "seconds");
+	for (i = 0; i < ST_MAX; i++)
+		if (prof.calls[i])
+			fprintf(stderr, "%-8s %10ld %12.6f\n",
+			    stages[i], prof.calls[i], prof.time[i]);
+	for (i = 0; i < CT_MAX; i++)
+		fprintf(stderr, "%-8s %23llu\n", counters[i], prof.count[i]);
+}
+
+#else
+
+void
+profon(void)
+{
+}
+
+void
+prprof(int json)
+{
+	warnx("Compiled without WITH_PROF, no timing to report");
+}
+
+#endif
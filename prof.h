@@ -0,0 +1,59 @@
+#ifndef _ALGEBRA_PROF_H_
+#define _ALGEBRA_PROF_H_
+
+/* Timers and counters around the stages of the computation.
+ * With WITH_PROF defined to 0, all of this compiles to nothing.
+ * They are global and not thread safe, so they stay off
+ * until a front end turns them on with profon(). */
+
+enum stage {
+	ST_PARSE,	/* reading the input */
+	ST_ELIM,	/* the elimination */
+	ST_BACKSUB,	/* the back substitution */
+	ST_FIT,		/* composing the lsq matrices */
+	ST_MULT,	/* multiplying matrices */
+	ST_OUTPUT,	/* evaluating and printing the results */
+	ST_MAX
+};
+
+enum counter {
+	CT_FLOPS,	/* floating point operations */
+	CT_PIVOTS,	/* pivots found */
+	CT_ROWS,	/* rows eliminated */
+	CT_ALLOCS,	/* memory allocations */
+	CT_BYTES,	/* bytes parsed */
+	CT_MAX
+};
+
+#if WITH_PROF
+
+struct prof {
+	int			on;
+	double			start[ST_MAX];
+	double			time[ST_MAX];
+	long			calls[ST_MAX];
+	unsigned long long	count[CT_MAX];
+};
+
+extern struct prof prof;
+
+void	profstart(enum stage);
+void	profstop(enum stage);
+
+#define PROF_START(s)		(prof.on ? profstart(s) : (void) 0)
+#define PROF_STOP(s)		(prof.on ? profstop(s) : (void) 0)
+#define PROF_COUNT(c, n) \
+	(prof.on ? (void) (prof.count[(c)] += (n)) : (void) 0)
+
+#else
+
+#define PROF_START(s)		((void) 0)
+#define PROF_STOP(s)		((void) 0)
+#define PROF_COUNT(c, n)	((void) 0)
+
+#endif
+
+void	profon(void);
+void	prprof(int);
+
+#endif
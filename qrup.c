@@ -0,0 +1,603 @@
+/* Keep the QR factorization of a system of linear equations up to date
+ * as equations are added, removed or changed, instead of eliminating
+ * the whole system again. The factorization is that of the augmented
+ * matrix [A b] = Q R, with the orthogonal Q' kept explicitly, so each
+ * change is a sequence of Givens rotations of the rows of Q' and R
+ * (Golub and Van Loan, 12.5): a new equation is rotated into R;
+ * a rank-one change u v' takes w = Q'u, rotates w into its first entry
+ * from the bottom up, which leaves R upper Hessenberg, adds w v' to the
+ * first row and rotates R back to a triangle; removing an equation
+ * rotates its row of Q into the first entry the same way and drops
+ * the first row of R and the first column of Q. Each of them takes
+ * O(m^2 + n^2) operations for m equations in n columns.
+ * Solving the system is a back substitution in R, which takes O(n^2)
+ * operations as long as its diagonal has no zeros; each zero there
+ * is a column without a pivot, and the rows below it are rotated
+ * up a step first, so R becomes a row echelon form.
+ * The rounding errors of the changes add up in R, so a bound on them
+ * is kept for each column; an entry of R within its bound may be
+ * a zero or not, and [A b], which is kept as well, is then factored
+ * again from scratch to tell. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <float.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "matrix.h"
+#include "lineq.h"
+#include "qrup.h"
+#include "prof.h"
+
+#define MIN(x,y) (((x) < (y)) ? (x) : (y))
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
+
+#define QROW(qr, i)	((qr)->q + (i) * (qr)->max)
+#define RROW(qr, i)	((qr)->r + (i) * (qr)->n)
+#define AROW(qr, i)	((qr)->a + (i) * (qr)->n)
+
+/* The rounding of a pass of rotations through a column of R,
+ * relative to its norm: each of at most m + n rotations is exact
+ * up to a few units in the last place of the two rows it takes. */
+#define ROUND(qr)	(4 * DBL_EPSILON * ((qr)->m + (qr)->n))
+
+/* Set up an empty factorization of a system with n columns,
+ * the right hand side included. Return ALG_OK or an error code;
+ * on success, the caller releases it with qrfree(). */
+int
+qrinit(struct qrup *qr, long n)
+{
+	if (NULL == qr || n < 2 || (size_t) n > SIZE_MAX / sizeof(double) / n)
+		return ALG_EINVAL;
+	memset(qr, 0, sizeof(struct qrup));
+	qr->n = n;
+	qr->fresh = 1;
+	if (NULL == (qr->r = calloc((n + 1) * n, sizeof(double)))
+	||  NULL == (qr->w = calloc(2 * n, sizeof(double)))
+	||  NULL == (qr->c = calloc(n, sizeof(double)))
+	||  NULL == (qr->e = calloc(n, sizeof(double)))) {
+		qrfree(qr);
+		return ALG_ENOMEM;
+	}
+	PROF_COUNT(CT_ALLOCS, 4);
+	return ALG_OK;
+}
+
+void
+qrfree(struct qrup *qr)
+{
+	if (NULL == qr)
+		return;
+	free(qr->q);
+	free(qr->r);
+	free(qr->a);
+	free(qr->w);
+	free(qr->c);
+	free(qr->e);
+	memset(qr, 0, sizeof(struct qrup));
+}
+
+/* Make room for at least need equations. Q' is quadratic
+ * in the room, so it grows by a quarter at a time. */
+static int
+grow(struct qrup *qr, long need)
+{
+	double *q, *a, *w;
+	long max, i;
+	if (need <= qr->max)
+		return ALG_OK;
+	if ((max = qr->max + qr->max / 4 + 16) < need)
+		max = need;
+	if ((size_t) max > SIZE_MAX / sizeof(double) / max)
+		return ALG_ENOMEM;
+	if (NULL == (q = calloc((size_t) max * max, sizeof(double))))
+		return ALG_ENOMEM;
+	if (NULL == (a = reallocarray(qr->a, max, qr->n * sizeof(double)))) {
+		free(q);
+		return ALG_ENOMEM;
+	}
+	qr->a = a;
+	if (NULL == (w = reallocarray(qr->w, 2 * (max + qr->n),
+	    sizeof(double)))) {
+		free(q);
+		return ALG_ENOMEM;
+	}
+	PROF_COUNT(CT_ALLOCS, 3);
+	for (i = 0; i < qr->m; i++)
+		memcpy(q + i * max, QROW(qr, i), qr->m * sizeof(double));
+	free(qr->q);
+	qr->q = q;
+	qr->w = w;
+	qr->max = max;
+	return ALG_OK;
+}
+
+/* The rotation taking (a, b) to (h, 0). */
+static void
+givens(double a, double b, double *c, double *s)
+{
+	double h;
+	if (0 == b) {
+		*c = 1;
+		*s = 0;
+		return;
+	}
+	h = hypot(a, b);
+	*c = a / h;
+	*s = b / h;
+}
+
+static void
+rot(double *x, double *y, long len, double c, double s)
+{
+	double t;
+	long j;
+	for (j = 0; j < len; j++) {
+		t = c * x[j] + s * y[j];
+		y[j] = c * y[j] - s * x[j];
+		x[j] = t;
+	}
+}
+
+/* Rotate the m entries of w into the first one from the bottom up,
+ * rotating the rows of Q' and R along; R becomes upper Hessenberg,
+ * its spare row taking the entry below the last diagonal one. */
+static void
+hessen(struct qrup *qr, double *w)
+{
+	double c, s;
+	long j, m = qr->m, n = qr->n;
+	for (j = m - 2; j >= 0; j--) {
+		if (0 == w[j + 1])
+			continue;
+		givens(w[j], w[j + 1], &c, &s);
+		w[j] = c * w[j] + s * w[j + 1];
+		w[j + 1] = 0;
+		rot(QROW(qr, j), QROW(qr, j + 1), m, c, s);
+		if (j < n)
+			rot(RROW(qr, j) + j, RROW(qr, j + 1) + j, n - j, c, s);
+	}
+	PROF_COUNT(CT_FLOPS, 6ULL * m * (m + n));
+}
+
+/* Rotate the upper Hessenberg R back into a triangle. */
+static void
+triang(struct qrup *qr)
+{
+	double c, s, *A, *B;
+	long j, m = qr->m, n = qr->n;
+	for (j = 0; j < n && j + 1 < m; j++) {
+		A = RROW(qr, j);
+		B = RROW(qr, j + 1);
+		if (0 == B[j])
+			continue;
+		givens(A[j], B[j], &c, &s);
+		rot(A + j, B + j, n - j, c, s);
+		B[j] = 0;
+		rot(QROW(qr, j), QROW(qr, j + 1), m, c, s);
+	}
+	PROF_COUNT(CT_FLOPS, 6ULL * MIN(m, n) * (m + n));
+}
+
+/* The bound on the rounding in the j-th column of R: that of
+ * a factorization from scratch, or the one the changes added up to. */
+static double
+bound(const struct qrup *qr, long j)
+{
+	return qr->fresh ? ROUND(qr) * qr->c[j] : qr->e[j];
+}
+
+/* Note a change made to the factorization other than a new equation:
+ * the new norms of the columns, and the rounding it may have left.
+ * The rotations take the columns of R as they were and as they are,
+ * and a rank-one change adds w0 v to the first row on the way,
+ * so the error each adds to a column is within ROUND of the largest
+ * of those; v is NULL for other changes. The bounds add up. */
+static void
+scale(struct qrup *qr, const double *v, double w0)
+{
+	double *R, *t, big;
+	long i, j, n = qr->n;
+	t = qr->w + qr->max + n;
+	memset(t, 0, n * sizeof(double));
+	for (i = 0; i < MIN(qr->m, n); i++)
+		for (R = RROW(qr, i), j = i; j < n; j++)
+			t[j] += R[j] * R[j];
+	for (j = 0; j < n; j++) {
+		t[j] = sqrt(t[j]);
+		big = MAX(qr->c[j], t[j]);
+		if (v)
+			big = MAX(big, fabs(w0 * v[j]));
+		qr->e[j] = bound(qr, j) + ROUND(qr) * big;
+		qr->c[j] = t[j];
+	}
+	qr->fresh = 0;
+	PROF_COUNT(CT_FLOPS, 1ULL * n * n);
+}
+
+/* Change [A b] by u v', given w = Q'u; this overwrites w. */
+static void
+update(struct qrup *qr, double *w, const double *v)
+{
+	double w0;
+	long c;
+	PROF_START(ST_ELIM);
+	hessen(qr, w);
+	for (w0 = w[0], c = 0; c < qr->n; c++)
+		qr->r[c] += w0 * v[c];
+	triang(qr);
+	scale(qr, v, w0);
+	PROF_STOP(ST_ELIM);
+}
+
+/* Rotate the i-th row of [A b], i being the number of equations,
+ * into R against the diagonal, making it an equation. */
+static void
+fold(struct qrup *qr, const double *row)
+{
+	double c, s, *a, *R;
+	long i, j, n;
+	i = qr->m;
+	n = qr->n;
+	a = qr->w;
+	memcpy(a, row, n * sizeof(double));
+	/* Q' gets a row and a column of the identity */
+	for (j = 0; j < i; j++)
+		QROW(qr, j)[i] = 0;
+	memset(QROW(qr, i), 0, i * sizeof(double));
+	QROW(qr, i)[i] = 1;
+	for (j = 0; j < MIN(i, n); j++) {
+		if (0 == a[j])
+			continue;
+		R = RROW(qr, j);
+		givens(R[j], a[j], &c, &s);
+		rot(R + j, a + j, n - j, c, s);
+		a[j] = 0;
+		rot(QROW(qr, j), QROW(qr, i), i + 1, c, s);
+	}
+	/* the rest is a new row of R, or zero */
+	if (i < n)
+		memcpy(RROW(qr, i), a, n * sizeof(double));
+	qr->m++;
+	/* the norms of the columns grow by the row, no more */
+	for (j = 0; j < n; j++) {
+		qr->c[j] = hypot(qr->c[j], row[j]);
+		qr->e[j] += ROUND(qr) * qr->c[j];
+	}
+	PROF_COUNT(CT_FLOPS, 6ULL * MIN(i, n) * (i + n));
+}
+
+/* Factor [A b] again from scratch, leaving the rounding
+ * of the changes behind. */
+static void
+refactor(struct qrup *qr)
+{
+	long i, m = qr->m, n = qr->n;
+	PROF_START(ST_ELIM);
+	memset(qr->r, 0, (n + 1) * n * sizeof(double));
+	memset(qr->c, 0, n * sizeof(double));
+	memset(qr->e, 0, n * sizeof(double));
+	for (qr->m = 0, i = 0; i < m; i++)
+		fold(qr, AROW(qr, i));
+	qr->fresh = 1;
+	PROF_STOP(ST_ELIM);
+}
+
+/* Add the equation given by n numbers, the right hand side last,
+ * rotating it into R against the diagonal.
+ * Return ALG_OK or an error code. */
+int
+qradd(struct qrup *qr, const double *row)
+{
+	int e;
+	if (NULL == qr || NULL == row)
+		return ALG_EINVAL;
+	if (ALG_OK != (e = grow(qr, qr->m + 1)))
+		return e;
+	PROF_START(ST_ELIM);
+	memcpy(AROW(qr, qr->m), row, qr->n * sizeof(double));
+	fold(qr, AROW(qr, qr->m));
+	PROF_STOP(ST_ELIM);
+	return ALG_OK;
+}
+
+/* Remove the k-th equation, counting from zero: with its row of Q
+ * rotated into the first entry, the first row of Q' is the k-th row
+ * of the identity, and R with its first row dropped is a triangle.
+ * Return ALG_OK or an error code. */
+int
+qrdel(struct qrup *qr, long k)
+{
+	double *w;
+	long i, j, m, n;
+	if (NULL == qr || k < 0 || k >= qr->m)
+		return ALG_EINVAL;
+	m = qr->m;
+	n = qr->n;
+	w = qr->w;
+	for (j = 0; j < m; j++)
+		w[j] = QROW(qr, j)[k];
+	PROF_START(ST_ELIM);
+	hessen(qr, w);
+	for (i = 1; i < m; i++) {
+		memmove(QROW(qr, i - 1), QROW(qr, i), k * sizeof(double));
+		memmove(QROW(qr, i - 1) + k, QROW(qr, i) + k + 1,
+		    (m - 1 - k) * sizeof(double));
+	}
+	memmove(RROW(qr, 0), RROW(qr, 1), n * n * sizeof(double));
+	memset(RROW(qr, n), 0, n * sizeof(double));
+	memmove(AROW(qr, k), AROW(qr, k + 1), (m - 1 - k) * n * sizeof(double));
+	qr->m--;
+	scale(qr, NULL, 0);
+	PROF_STOP(ST_ELIM);
+	return ALG_OK;
+}
+
+/* Change [A b] by u v', with m numbers in u and n in v. */
+static void
+rank1(struct qrup *qr, const double *u, const double *v)
+{
+	double *w = qr->w;
+	long j, i;
+	for (j = 0; j < qr->m; j++) {
+		for (w[j] = 0, i = 0; i < qr->m; i++)
+			w[j] += QROW(qr, j)[i] * u[i];
+		for (i = 0; i < qr->n; i++)
+			AROW(qr, j)[i] += u[j] * v[i];
+	}
+	PROF_COUNT(CT_FLOPS, 2ULL * qr->m * (qr->m + qr->n));
+	update(qr, w, v);
+}
+
+/* Replace the k-th equation with the given n numbers: a rank-one
+ * change by the k-th unit vector times the difference of the rows,
+ * given by the k-th column of Q'.
+ * Return ALG_OK or an error code. */
+int
+qrrow(struct qrup *qr, long k, const double *row)
+{
+	double *w, *v;
+	long j, c;
+	if (NULL == qr || NULL == row || k < 0 || k >= qr->m)
+		return ALG_EINVAL;
+	w = qr->w;
+	v = qr->w + qr->max;
+	for (c = 0; c < qr->n; c++)
+		v[c] = row[c] - AROW(qr, k)[c];
+	for (j = 0; j < qr->m; j++)
+		w[j] = QROW(qr, j)[k];
+	memcpy(AROW(qr, k), row, qr->n * sizeof(double));
+	update(qr, w, v);
+	return ALG_OK;
+}
+
+/* Replace the right hand side with the given m numbers:
+ * a rank-one change by their difference times the last unit vector.
+ * Return ALG_OK or an error code. */
+int
+qrrhs(struct qrup *qr, const double *b)
+{
+	double *u, *v;
+	long i;
+	if (NULL == qr || NULL == b || 0 == qr->m)
+		return ALG_EINVAL;
+	v = qr->w + qr->max;
+	u = v + qr->n;
+	for (i = 0; i < qr->m; i++)
+		u[i] = b[i] - AROW(qr, i)[qr->n - 1];
+	memset(v, 0, qr->n * sizeof(double));
+	v[qr->n - 1] = 1;
+	rank1(qr, u, v);
+	return ALG_OK;
+}
+
+/* Change [A b] by u v', with m numbers in u and n in v.
+ * Return ALG_OK or an error code. */
+int
+qrrank1(struct qrup *qr, const double *u, const double *v)
+{
+	if (NULL == qr || NULL == u || NULL == v || 0 == qr->m)
+		return ALG_EINVAL;
+	rank1(qr, u, v);
+	return ALG_OK;
+}
+
+/* Bring a copy of R to a row echelon form, filling in the pivot
+ * columns; an entry counts as zero if it is within the bound on
+ * the rounding of its column. That is the rounding of the column
+ * itself and of the pivot columns before it, times its coefficients
+ * in them, which are estimated as the ratio of the norm of a column
+ * to its pivot, added up. A column without a pivot leaves the rows
+ * below it a step off the diagonal; those are rotated up a step
+ * as the column after it is reached.
+ * Return the number of pivots; zero is set if a column has none. */
+static long
+stair(const struct qrup *qr, double *a, long rows, long *piv, int *zero)
+{
+	double *A, *B, c, s, k;
+	long r, i, j, n = qr->n;
+	PROF_START(ST_ELIM);
+	memcpy(a, qr->r, rows * n * sizeof(double));
+	for (k = 1, *zero = 0, r = 0, j = 0; j < n && r < rows; j++) {
+		/* rows r to j may have entries in this column */
+		for (i = MIN(j, rows - 1); i > r; i--) {
+			A = a + (i - 1) * n;
+			B = a + i * n;
+			if (0 == B[j])
+				continue;
+			givens(A[j], B[j], &c, &s);
+			rot(A + j, B + j, n - j, c, s);
+			B[j] = 0;
+			PROF_COUNT(CT_FLOPS, 6ULL * (n - j));
+		}
+		if (fabs(a[r * n + j]) <= k * bound(qr, j)) {
+			a[r * n + j] = 0;
+			*zero = 1;
+			continue;
+		}
+		k += qr->c[j] / fabs(a[r * n + j]);
+		PROF_COUNT(CT_PIVOTS, 1);
+		piv[r++] = j;
+	}
+	PROF_STOP(ST_ELIM);
+	return r;
+}
+
+/* Solve the system as it stands by back substitution in a copy of R
+ * in the workspace of the context; R has the same solutions, and
+ * the corner of R is the norm of the residual, which makes a pivot
+ * on the right hand side if the system has no solution.
+ * A pivot is beyond the rounding, but an entry within it may be
+ * a zero or not: unless R is factored from scratch, it is then
+ * factored again from [A b], and the zeros are those of the new R.
+ * Fill in the rank of A and gcol, as past the last pivot, as well.
+ * The solution lives in the workspace, valid until its next use.
+ * Return ALG_OK or an error code. */
+int
+qrsolve(struct alg *ctx, struct qrup *qr, struct linsol *sol)
+{
+	double *a, *A, *x, *buf, t;
+	long rows, len, n, r, i, j, k, f, g, *piv;
+	int e, zero;
+	if (NULL == ctx || NULL == qr || NULL == sol || 0 == qr->m)
+		return ALG_EINVAL;
+	n = qr->n;
+	len = n - 1;
+	rows = MIN(qr->m, n);
+	if (ALG_OK != (e = algwork(ctx, ALGSIZE(rows * n * sizeof(double))
+	    + LINBUF(n) * sizeof(double))))
+		return e;
+	a = algtake(ctx, rows * n * sizeof(double));
+	buf = algtake(ctx, LINBUF(n) * sizeof(double));
+	/* past the solution, which has at most n * (n-1) numbers */
+	piv = (long*) (buf + (size_t) n * n);
+	r = stair(qr, a, rows, piv, &zero);
+	if (zero && 0 == qr->fresh) {
+		refactor(qr);
+		r = stair(qr, a, rows, piv, &zero);
+	}
+	qr->gcol = r ? piv[r - 1] + 1 : 0;
+	qr->rank = qr->gcol < n ? r : r - 1;
+	memset(sol, 0, sizeof(struct linsol));
+	sol->len = len;
+	if (qr->gcol >= n)
+		return ALG_OK;
+	PROF_START(ST_BACKSUB);
+	sol->par = x = buf;
+	memset(x, 0, len * sizeof(double));
+	for (k = r - 1; k >= 0; k--) {
+		A = a + k * n;
+		for (t = A[len], j = piv[k] + 1; j < len; j++)
+			t -= A[j] * x[j];
+		x[piv[k]] = t ? t / A[piv[k]] : 0;
+	}
+	PROF_COUNT(CT_FLOPS, 1ULL * r * n);
+	if (0 == (sol->dim = len - r)) {
+		PROF_STOP(ST_BACKSUB);
+		return ALG_OK;
+	}
+	sol->hom = buf + len;
+	memset(sol->hom, 0, sol->dim * len * sizeof(double));
+	/* the columns without a pivot, the last one first */
+	for (g = 0, f = len - 1, k = r - 1; f >= 0; f--) {
+		if (k >= 0 && piv[k] == f) {
+			k--;
+			continue;
+		}
+		x = sol->hom + g++ * len;
+		x[f] = 1;
+		for (i = k; i >= 0; i--) {
+			A = a + i * n;
+			for (t = 0, j = piv[i] + 1; j <= f; j++)
+				t -= A[j] * x[j];
+			x[piv[i]] = t ? t / A[piv[i]] : 0;
+		}
+		PROF_COUNT(CT_FLOPS, 1ULL * (k + 1) * n);
+	}
+	PROF_STOP(ST_BACKSUB);
+	return ALG_OK;
+}
+
+/* Write the factorization: the number of equations and of columns
+ * and whether it is factored from scratch, as 64-bit integers,
+ * then Q', the top rows of R and [A b], row by row, the norms
+ * of the columns and the bounds on their rounding, as doubles,
+ * all in the byte order of the host.
+ * Return ALG_OK or ALG_EIO. */
+int
+qrsave(FILE *fp, const struct qrup *qr)
+{
+	int64_t hdr[3];
+	long i;
+	if (NULL == fp || NULL == qr)
+		return ALG_EINVAL;
+	PROF_START(ST_OUTPUT);
+	hdr[0] = qr->m;
+	hdr[1] = qr->n;
+	hdr[2] = qr->fresh;
+	fwrite(hdr, sizeof(int64_t), 3, fp);
+	for (i = 0; i < qr->m; i++)
+		fwrite(QROW(qr, i), sizeof(double), qr->m, fp);
+	fwrite(qr->r, sizeof(double), MIN(qr->m, qr->n) * qr->n, fp);
+	fwrite(qr->a, sizeof(double), qr->m * qr->n, fp);
+	fwrite(qr->c, sizeof(double), qr->n, fp);
+	fwrite(qr->e, sizeof(double), qr->n, fp);
+	PROF_STOP(ST_OUTPUT);
+	return ferror(fp) ? ALG_EIO : ALG_OK;
+}
+
+/* Read a factorization written by qrsave() into an uninitialized qr.
+ * Return ALG_OK or an error code; on success, the caller
+ * releases it with qrfree(). */
+int
+qrload(FILE *fp, struct qrup *qr)
+{
+	int64_t hdr[3];
+	size_t len;
+	long i;
+	int e;
+	if (NULL == fp || NULL == qr)
+		return ALG_EINVAL;
+	if (3 != fread(hdr, sizeof(int64_t), 3, fp))
+		return ferror(fp) ? ALG_EIO : ALG_EPARSE;
+	if (hdr[0] < 0 || hdr[0] > LONG_MAX || hdr[1] > LONG_MAX
+	|| (0 != hdr[2] && 1 != hdr[2]))
+		return ALG_EPARSE;
+	if (ALG_OK != (e = qrinit(qr, hdr[1])))
+		return e;
+	if (ALG_OK != (e = grow(qr, hdr[0]))) {
+		qrfree(qr);
+		return e;
+	}
+	qr->m = hdr[0];
+	qr->fresh = hdr[2];
+	PROF_START(ST_PARSE);
+	for (i = 0, e = ALG_OK; i < qr->m && ALG_OK == e; i++)
+		if ((size_t) qr->m != fread(QROW(qr, i), sizeof(double),
+		    qr->m, fp))
+			e = ALG_EPARSE;
+	len = MIN(qr->m, qr->n) * qr->n;
+	if (ALG_OK == e && len != fread(qr->r, sizeof(double), len, fp))
+		e = ALG_EPARSE;
+	len = qr->m * qr->n;
+	if (ALG_OK == e && len != fread(qr->a, sizeof(double), len, fp))
+		e = ALG_EPARSE;
+	len = qr->n;
+	if (ALG_OK == e && (len != fread(qr->c, sizeof(double), len, fp)
+	||  len != fread(qr->e, sizeof(double), len, fp)))
+		e = ALG_EPARSE;
+	if (ALG_EPARSE == e && ferror(fp))
+		e = ALG_EIO;
+	PROF_COUNT(CT_BYTES, 3 * sizeof(int64_t) + (qr->m * qr->m
+	    + MIN(qr->m, qr->n) * qr->n + (qr->m + 2) * qr->n)
+	    * sizeof(double));
+	PROF_STOP(ST_PARSE);
+	if (ALG_OK != e)
+		qrfree(qr);
+	return e;
+}
@@ -0,0 +1,39 @@
+#ifndef _ALGEBRA_QRUP_H_
+#define _ALGEBRA_QRUP_H_
+
+#include <stdio.h>
+
+#include "algebra.h"
+#include "lineq.h"
+
+/* The QR factorization of the augmented matrix [A b] of a system
+ * of m equations, kept up to date as the equations change:
+ * Q' is kept explicitly, and R as its top n rows, upper triangular,
+ * with a row to spare for the updates; [A b] is kept as well. */
+struct qrup {
+	long	 m;	/* equations */
+	long	 n;	/* columns, the right hand side included */
+	long	 max;	/* equations there is room for */
+	double	*q;	/* Q', m rows of m numbers, max apart */
+	double	*r;	/* R, n + 1 rows of n numbers */
+	double	*a;	/* [A b], m rows of n numbers */
+	double	*w;	/* scratch, 2 max + 2 n numbers */
+	double	*c;	/* the norms of the columns of R */
+	double	*e;	/* the bounds on the rounding in them */
+	int	 fresh;	/* R is factored from scratch, with no changes since */
+	long	 rank;	/* of A, as of the last qrsolve() */
+	long	 gcol;	/* as left by the elimination then */
+};
+
+int	qrinit(struct qrup*, long);
+void	qrfree(struct qrup*);
+int	qradd(struct qrup*, const double*);
+int	qrdel(struct qrup*, long);
+int	qrrow(struct qrup*, long, const double*);
+int	qrrhs(struct qrup*, const double*);
+int	qrrank1(struct qrup*, const double*, const double*);
+int	qrsolve(struct alg*, struct qrup*, struct linsol*);
+int	qrsave(FILE*, const struct qrup*);
+int	qrload(FILE*, struct qrup*);
+
+#endif
@@ -0,0 +1,375 @@
+/* Replay random sequences of changes to a system of linear equations
+ * through the updated QR factorization of qrup.c and check each state
+ * against a fresh solve: the rank and the pivots against exact
+ * elimination of the integer system modulo a prime, the solutions
+ * against the equations themselves, and a factorization saved
+ * and loaded back against the one it was saved from. */
+
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <err.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "lineq.h"
+#include "qrup.h"
+
+extern const char* __progname;
+
+#define PRIME	2147483647LL
+#define MAXROWS	10
+#define MAXCOLS	8
+
+int vflag = 0;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-v] [-n runs] [-s seed]\n", __progname);
+}
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, so that the sequences are the same everywhere */
+static long
+rnd(long lo, long hi)
+{
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return lo + (long) ((seed * 0x2545f4914f6cdd1dULL >> 11)
+	    % (uint64_t) (hi - lo + 1));
+}
+
+/* The system as the changes leave it, in integers. */
+struct sys {
+	long	m;
+	long	n;
+	long	a[MAXROWS][MAXCOLS];
+};
+
+static long long
+inv(long long x)
+{
+	long long r = 1, e = PRIME - 2;
+	for (x %= PRIME; e; e >>= 1, x = x * x % PRIME)
+		if (e & 1)
+			r = r * x % PRIME;
+	return r;
+}
+
+/* Eliminate [A b] modulo the prime; return the number of pivots
+ * and fill in the column past the last one. */
+static long
+exact(const struct sys *s, long *gcol)
+{
+	long long a[MAXROWS][MAXCOLS], p, f;
+	long r, i, j, k;
+	for (i = 0; i < s->m; i++)
+		for (j = 0; j < s->n; j++)
+			a[i][j] = ((s->a[i][j] % PRIME) + PRIME) % PRIME;
+	for (*gcol = 0, r = 0, j = 0; j < s->n && r < s->m; j++) {
+		for (i = r; i < s->m && 0 == a[i][j]; i++)
+			;
+		if (i == s->m)
+			continue;
+		for (k = 0; k < s->n; k++) {
+			p = a[r][k];
+			a[r][k] = a[i][k];
+			a[i][k] = p;
+		}
+		p = inv(a[r][j]);
+		for (i = r + 1; i < s->m; i++) {
+			f = a[i][j] * p % PRIME;
+			for (k = j; k < s->n; k++)
+				a[i][k] = ((a[i][k] - f * a[r][k]) % PRIME
+				    + PRIME) % PRIME;
+		}
+		r++;
+		*gcol = j + 1;
+	}
+	return r;
+}
+
+/* A row of small numbers, a copy of another row,
+ * or a combination of two of them. */
+static void
+mkrow(const struct sys *s, double *row)
+{
+	long i, k, c, d, j;
+	int how = s->m ? rnd(0, 2) : 0;
+	i = rnd(0, s->m ? s->m - 1 : 0);
+	k = rnd(0, s->m ? s->m - 1 : 0);
+	c = rnd(-2, 2);
+	d = rnd(-2, 2);
+	for (j = 0; j < s->n; j++)
+		switch (how) {
+		case 0:
+			row[j] = rnd(-4, 4);
+			break;
+		case 1:
+			row[j] = s->a[i][j];
+			break;
+		default:
+			row[j] = c * s->a[i][j] + d * s->a[k][j];
+			break;
+		}
+}
+
+static int
+small(const double *row, long n)
+{
+	long j;
+	for (j = 0; j < n; j++)
+		if (fabs(row[j]) > 1000)
+			return 0;
+	return 1;
+}
+
+/* Check the solution found against the equations. */
+static int
+check(const struct sys *s, const struct linsol *sol)
+{
+	double r, t, big;
+	long i, j, g, len = s->n - 1;
+	for (i = 0; i < s->m; i++) {
+		for (r = -s->a[i][len], big = fabs(r), j = 0; j < len; j++) {
+			t = s->a[i][j] * sol->par[j];
+			r += t;
+			big += fabs(t);
+		}
+		if (fabs(r) > 1e-8 * (1 + big))
+			return 0;
+		for (g = 0; g < sol->dim; g++) {
+			for (r = 0, big = 0, j = 0; j < len; j++) {
+				t = s->a[i][j] * sol->hom[g * len + j];
+				r += t;
+				big += fabs(t);
+			}
+			if (fabs(r) > 1e-8 * (1 + big))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/* Solve the factorization and compare with the exact system;
+ * return the number of mismatches. */
+static int
+compare(struct alg *ctx, struct qrup *qr, const struct sys *s,
+	const char *what)
+{
+	struct linsol sol;
+	long rank, gcol;
+	int e;
+	if (0 == s->m)
+		return 0;
+	if (ALG_OK != (e = qrsolve(ctx, qr, &sol)))
+		errx(1, "qrsolve: %s", algerr(e));
+	rank = exact(s, &gcol);
+	if (gcol == s->n)
+		rank--;
+	if (qr->rank != rank || qr->gcol != gcol) {
+		warnx("after %s: rank %ld, gcol %ld; exact %ld %ld",
+		    what, qr->rank, qr->gcol, rank, gcol);
+		return 1;
+	}
+	if (gcol < s->n && !check(s, &sol)) {
+		warnx("after %s: the solution does not solve the system",
+		    what);
+		return 1;
+	}
+	return 0;
+}
+
+/* Save the factorization and load it back in its stead;
+ * return the number of mismatches. */
+static int
+reload(struct alg *ctx, struct qrup *qr, const struct sys *s)
+{
+	struct qrup new;
+	long rank, gcol;
+	FILE *fp;
+	int e, bad;
+	if (NULL == (fp = tmpfile()))
+		err(1, "tmpfile");
+	if (ALG_OK != (e = qrsave(fp, qr)))
+		errx(1, "qrsave: %s", algerr(e));
+	rewind(fp);
+	if (ALG_OK != (e = qrload(fp, &new)))
+		errx(1, "qrload: %s", algerr(e));
+	fclose(fp);
+	if (ALG_OK != (e = qrsolve(ctx, qr, &(struct linsol){0})))
+		errx(1, "qrsolve: %s", algerr(e));
+	rank = qr->rank;
+	gcol = qr->gcol;
+	qrfree(qr);
+	*qr = new;
+	if (0 != (bad = compare(ctx, qr, s, "w and l")))
+		return bad;
+	if (qr->rank != rank || qr->gcol != gcol) {
+		warnx("loaded: rank %ld, gcol %ld; saved %ld %ld",
+		    qr->rank, qr->gcol, rank, gcol);
+		return 1;
+	}
+	return 0;
+}
+
+/* One sequence of changes to a system with n columns;
+ * return the number of mismatches. */
+static int
+run(struct alg *ctx, long n, long len)
+{
+	struct qrup qr;
+	struct sys s;
+	double row[MAXCOLS], u[MAXROWS], v[MAXCOLS];
+	char what[8];
+	long i, j, k, c, step;
+	int e, bad = 0;
+	memset(&s, 0, sizeof(struct sys));
+	s.n = n;
+	if (ALG_OK != (e = qrinit(&qr, n)))
+		errx(1, "qrinit: %s", algerr(e));
+	for (step = 0; step < len; step++) {
+		switch (c = "aaabcdduuw"[rnd(0, 9)]) {
+		case 'a':
+			if (s.m == MAXROWS)
+				continue;
+			mkrow(&s, row);
+			if (!small(row, n))
+				continue;
+			if (ALG_OK != (e = qradd(&qr, row)))
+				errx(1, "qradd: %s", algerr(e));
+			for (j = 0; j < n; j++)
+				s.a[s.m][j] = row[j];
+			s.m++;
+			break;
+		case 'c':
+			if (0 == s.m)
+				continue;
+			k = rnd(0, s.m - 1);
+			mkrow(&s, row);
+			if (!small(row, n))
+				continue;
+			if (ALG_OK != (e = qrrow(&qr, k, row)))
+				errx(1, "qrrow: %s", algerr(e));
+			for (j = 0; j < n; j++)
+				s.a[k][j] = row[j];
+			break;
+		case 'd':
+			if (0 == s.m)
+				continue;
+			k = rnd(0, s.m - 1);
+			if (ALG_OK != (e = qrdel(&qr, k)))
+				errx(1, "qrdel: %s", algerr(e));
+			memmove(s.a[k], s.a[k + 1],
+			    (s.m - 1 - k) * sizeof(s.a[0]));
+			s.m--;
+			break;
+		case 'b':
+			if (0 == s.m)
+				continue;
+			/* consistent or not, as it comes */
+			for (j = 0; j < n - 1; j++)
+				v[j] = rnd(-3, 3);
+			for (i = 0; i < s.m; i++) {
+				for (u[i] = 0, j = 0; j < n - 1; j++)
+					u[i] += s.a[i][j] * v[j];
+				if (0 == rnd(0, 3))
+					u[i] += rnd(-1, 1);
+				if (fabs(u[i]) > 1000)
+					break;
+			}
+			if (i < s.m)
+				continue;
+			if (ALG_OK != (e = qrrhs(&qr, u)))
+				errx(1, "qrrhs: %s", algerr(e));
+			for (i = 0; i < s.m; i++)
+				s.a[i][n - 1] = u[i];
+			break;
+		case 'u':
+			if (0 == s.m)
+				continue;
+			/* make a row a copy of another, or change it a bit */
+			memset(u, 0, sizeof(u));
+			i = rnd(0, s.m - 1);
+			k = rnd(0, s.m - 1);
+			u[i] = 1;
+			for (j = 0; j < n; j++)
+				v[j] = rnd(0, 1) ? s.a[k][j] - s.a[i][j]
+				    : rnd(-1, 1);
+			for (j = 0; j < n; j++)
+				row[j] = s.a[i][j] + v[j];
+			if (!small(row, n))
+				continue;
+			if (ALG_OK != (e = qrrank1(&qr, u, v)))
+				errx(1, "qrrank1: %s", algerr(e));
+			for (j = 0; j < n; j++)
+				s.a[i][j] += v[j];
+			break;
+		case 'w':
+			if (0 == s.m)
+				continue;
+			bad += reload(ctx, &qr, &s);
+			break;
+		}
+		snprintf(what, sizeof(what), "%c", (int) c);
+		bad += compare(ctx, &qr, &s, what);
+		if (bad)
+			break;
+	}
+	qrfree(&qr);
+	return bad;
+}
+
+int
+main(int argc, char** argv)
+{
+	struct alg ctx;
+	const char *errstr;
+	long runs = 1000, r;
+	int c, bad = 0;
+	while ((c = getopt(argc, argv, "n:s:v")) != -1) switch (c) {
+		case 'n':
+			runs = strtonum(optarg, 1, LONG_MAX, &errstr);
+			if (errstr)
+				errx(1, "runs: %s", errstr);
+			break;
+		case 's':
+			seed = strtonum(optarg, 1, LLONG_MAX, &errstr);
+			if (errstr)
+				errx(1, "seed: %s", errstr);
+			break;
+		case 'v':
+			vflag = 1;
+			break;
+		default:
+			usage();
+			return 1;
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc) {
+		usage();
+		return 1;
+	}
+	alginit(&ctx, NULL, 0);
+	for (r = 0; r < runs; r++) {
+		if (vflag)
+			fprintf(stderr, "run %ld\n", r);
+		if (run(&ctx, rnd(2, MAXCOLS), 60)) {
+			warnx("run %ld failed", r);
+			bad++;
+		}
+	}
+	algfree(&ctx);
+	if (vflag || bad)
+		fprintf(stderr, "%d of %ld runs failed\n", bad, runs);
+	return bad ? 1 : 0;
+}
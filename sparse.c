@@ -0,0 +1,170 @@
+/* Sparse matrices, read in the coordinate format of Matrix Market. */
+
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "sparse.h"
+#include "prof.h"
+
+struct entry {
+	long	r;
+	long	c;
+	double	v;
+};
+
+static int
+cmpent(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+	if (x->r != y->r)
+		return x->r < y->r ? -1 : 1;
+	if (x->c != y->c)
+		return x->c < y->c ? -1 : 1;
+	return 0;
+}
+
+/* Read the next line that is not a comment or blank.
+ * Return its length, or -1 at the end. */
+static ssize_t
+nextline(FILE *fp, char **line, size_t *size)
+{
+	ssize_t len;
+	while ((len = getline(line, size, fp)) != -1) {
+		PROF_COUNT(CT_BYTES, len);
+		if ('%' != **line && (size_t) len != strspn(*line, " \t\r\n"))
+			break;
+	}
+	return len;
+}
+
+/* Sort the entries into the rows of the matrix,
+ * summing up the duplicates. */
+static int
+mkcsr(struct entry *e, long k, struct csr *a)
+{
+	long i, j;
+	qsort(e, k, sizeof(struct entry), cmpent);
+	for (i = 0, j = -1; i < k; i++) {
+		if (j >= 0 && e[j].r == e[i].r && e[j].c == e[i].c)
+			e[j].v += e[i].v;
+		else
+			e[++j] = e[i];
+	}
+	a->nnz = j + 1;
+	if (NULL == (a->ptr = calloc(a->n + 1, sizeof(long)))
+	||  NULL == (a->col = calloc(a->nnz ? a->nnz : 1, sizeof(long)))
+	||  NULL == (a->val = calloc(a->nnz ? a->nnz : 1, sizeof(double))))
+		return ALG_ENOMEM;
+	PROF_COUNT(CT_ALLOCS, 3);
+	for (i = 0; i < a->nnz; i++) {
+		a->ptr[e[i].r + 1]++;
+		a->col[i] = e[i].c;
+		a->val[i] = e[i].v;
+	}
+	for (i = 0; i < a->n; i++)
+		a->ptr[i + 1] += a->ptr[i];
+	return ALG_OK;
+}
+
+/* Read a system of n equations in the coordinate format
+ * of Matrix Market: a header line, comments starting with '%',
+ * a line with the number of rows, columns and entries,
+ * and a line with the row, the column and the value of each entry,
+ * counted from 1. The matrix has n + 1 columns, the last one being
+ * the right hand side. With the symmetric qualifier, only the lower
+ * or the upper triangle of the first n columns is given.
+ * Return ALG_OK or an error code; on success, the caller frees
+ * the matrix with freecsr(). */
+int
+readcsr(FILE *fp, struct csr *a)
+{
+	struct entry *ent = NULL;
+	char obj[16], fmt[16], field[16], sym[16];
+	char *line = NULL;
+	size_t size = 0;
+	long rows, cols, nnz, r, c, i, k = 0;
+	double v;
+	int e = ALG_EPARSE, symm;
+
+	if (NULL == fp || NULL == a)
+		return ALG_EINVAL;
+	memset(a, 0, sizeof(struct csr));
+	PROF_START(ST_PARSE);
+	if (-1 == getline(&line, &size, fp))
+		goto done;
+	PROF_COUNT(CT_BYTES, strlen(line));
+	if (4 != sscanf(line, "%%%%MatrixMarket %15s %15s %15s %15s",
+	    obj, fmt, field, sym)
+	||  strcasecmp(obj, "matrix") || strcasecmp(fmt, "coordinate")
+	||  (strcasecmp(field, "real") && strcasecmp(field, "integer"))
+	||  (strcasecmp(sym, "general") && strcasecmp(sym, "symmetric")))
+		goto done;
+	symm = 0 == strcasecmp(sym, "symmetric");
+	if (-1 == nextline(fp, &line, &size)
+	||  3 != sscanf(line, "%ld %ld %ld", &rows, &cols, &nnz)
+	||  rows < 1 || nnz < 0)
+		goto done;
+	if (cols != rows + 1) {
+		e = ALG_ESHAPE;
+		goto done;
+	}
+	a->n = rows;
+	if (nnz > (long) (SIZE_MAX / sizeof(struct entry) / 2)
+	||  NULL == (ent = calloc(symm ? 2 * nnz + 1 : nnz + 1,
+	    sizeof(struct entry)))
+	||  NULL == (a->rhs = calloc(rows, sizeof(double)))) {
+		e = ALG_ENOMEM;
+		goto done;
+	}
+	PROF_COUNT(CT_ALLOCS, 2);
+	for (i = 0; i < nnz; i++) {
+		if (-1 == nextline(fp, &line, &size)) {
+			e = ferror(fp) ? ALG_EIO : ALG_EPARSE;
+			goto done;
+		}
+		if (3 != sscanf(line, "%ld %ld %lf", &r, &c, &v)
+		||  r < 1 || r > rows || c < 1 || c > cols)
+			goto done;
+		r--;
+		c--;
+		if (c == rows) {
+			a->rhs[r] += v;
+			continue;
+		}
+		ent[k].r = r;
+		ent[k].c = c;
+		ent[k++].v = v;
+		if (symm && r != c) {
+			ent[k].r = c;
+			ent[k].c = r;
+			ent[k++].v = v;
+		}
+	}
+	e = mkcsr(ent, k, a);
+done:
+	PROF_STOP(ST_PARSE);
+	if (ALG_OK != e)
+		freecsr(a);
+	free(line);
+	free(ent);
+	return e;
+}
+
+/* Free the arrays allocated by readcsr().
+ * The matrix structure itself belongs to the caller. */
+void
+freecsr(struct csr *a)
+{
+	if (NULL == a)
+		return;
+	free(a->ptr);
+	free(a->col);
+	free(a->val);
+	free(a->rhs);
+	memset(a, 0, sizeof(struct csr));
+}
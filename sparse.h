@@ -0,0 +1,22 @@
+#ifndef _ALGEBRA_SPARSE_H_
+#define _ALGEBRA_SPARSE_H_
+
+#include <stdio.h>
+
+#include "algebra.h"
+
+/* A square sparse matrix in the compressed row format,
+ * with the right hand side of the system kept aside. */
+struct csr {
+	long	 n;	/* equations and unknowns */
+	long	 nnz;	/* nonzero entries */
+	long	*ptr;	/* where each row starts, n + 1 of them */
+	long	*col;	/* the column of each entry, ascending in a row */
+	double	*val;	/* and its value */
+	double	*rhs;	/* the right hand side, n numbers */
+};
+
+int	readcsr(FILE*, struct csr*);
+void	freecsr(struct csr*);
+
+#endif
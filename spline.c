@@ -0,0 +1,279 @@
+/* The cubic smoothing spline: the function g minimizing
+ *
+ *	sum (y_i - g(x_i))^2 + lambda * integral g''(x)^2 dx
+ *
+ * over the data points, which is a natural cubic spline with knots
+ * at the distinct x_i. Following Reinsch, its second derivatives c
+ * at the inner knots solve (R + lambda Q' W^-1 Q) c = Q' y, where
+ * Q are the second divided differences, R the integrals of the hat
+ * functions and W the number of points at each knot; the values at
+ * the knots are then g = y - lambda W^-1 Q c. The matrix is positive
+ * definite with two diagonals on each side, so the LDL' factorization
+ * and the solution take time and space linear in the number of knots.
+ * Evaluating the spline is a binary search for the knot interval. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "fit.h"
+#include "spline.h"
+#include "prof.h"
+
+static int
+cmppt(const void *a, const void *b)
+{
+	const struct pt *p = a, *q = b;
+	return p->x < q->x ? -1 : p->x > q->x;
+}
+
+/* Fit the smoothing spline to the data; a zero lambda interpolates
+ * the mean of the values at each knot, and the spline approaches
+ * the least squares line as lambda grows. The data are sorted
+ * in the workspace if they are not sorted already. The spline lives
+ * in the workspace of the context, valid until its next use.
+ * Return ALG_OK or an error code. */
+int
+splfit(struct alg *ctx, const struct data *data, double lambda,
+	struct spline *spl)
+{
+	const struct pt *p;
+	struct pt *sorted;
+	double *x, *g, *c, *w, *a, *b, *e;
+	double h0, h1, h2, q;
+	long i, j, k, n;
+	size_t size;
+	int sort = 0, err;
+	if (NULL == ctx || NULL == data || NULL == spl
+	|| 0 == data->num || !(lambda >= 0))
+		return ALG_EINVAL;
+	n = data->num;
+	for (i = 1; i < n && !sort; i++)
+		sort = data->points[i].x < data->points[i-1].x;
+	if ((size_t) n > SIZE_MAX / 8 / sizeof(struct pt))
+		return ALG_ENOMEM;
+	size = 7 * ALGSIZE(n * sizeof(double))
+	    + (sort ? ALGSIZE(n * sizeof(struct pt)) : 0);
+	if (ALG_OK != (err = algwork(ctx, size)))
+		return err;
+	PROF_START(ST_FIT);
+	p = data->points;
+	if (sort) {
+		sorted = algtake(ctx, n * sizeof(struct pt));
+		memcpy(sorted, p, n * sizeof(struct pt));
+		qsort(sorted, n, sizeof(struct pt), cmppt);
+		p = sorted;
+	}
+	x = algtake(ctx, n * sizeof(double));
+	g = algtake(ctx, n * sizeof(double));
+	c = algtake(ctx, n * sizeof(double));
+	w = algtake(ctx, n * sizeof(double));
+	a = algtake(ctx, n * sizeof(double));
+	b = algtake(ctx, n * sizeof(double));
+	e = algtake(ctx, n * sizeof(double));
+	/* the points at the same knot */
+	for (i = 0, k = 0; i < n; i++) {
+		if (k && p[i].x == x[k-1]) {
+			g[k-1] += p[i].y;
+			w[k-1]++;
+			continue;
+		}
+		x[k] = p[i].x;
+		g[k] = p[i].y;
+		w[k++] = 1;
+	}
+	for (j = 0; j < k; j++)
+		g[j] /= w[j];
+	/* the diagonals of the system for the inner knots */
+	for (j = 1; j < k-1; j++) {
+		h0 = x[j] - x[j-1];
+		h1 = x[j+1] - x[j];
+		c[j] = (g[j+1] - g[j]) / h1 - (g[j] - g[j-1]) / h0;
+		a[j] = (h0 + h1) / 3 + lambda * (1 / (h0 * h0 * w[j-1])
+		    + (1 / h0 + 1 / h1) * (1 / h0 + 1 / h1) / w[j]
+		    + 1 / (h1 * h1 * w[j+1]));
+		if (j+1 < k-1) {
+			h2 = x[j+2] - x[j+1];
+			b[j] = h1 / 6 - lambda / h1 * ((1 / h0 + 1 / h1) / w[j]
+			    + (1 / h1 + 1 / h2) / w[j+1]);
+			if (j+2 < k-1)
+				e[j] = lambda / (h1 * h2 * w[j+1]);
+		}
+	}
+	PROF_COUNT(CT_FLOPS, 40ULL * k);
+	PROF_STOP(ST_FIT);
+	PROF_START(ST_ELIM);
+	/* L D L' in place: D in a, the two subdiagonals of L in b and e */
+	for (j = 1; j < k-1; j++) {
+		if (j > 1)
+			a[j] -= a[j-1] * b[j-1] * b[j-1];
+		if (j > 2)
+			a[j] -= a[j-2] * e[j-2] * e[j-2];
+		if (!(a[j] > 0)) {
+			PROF_STOP(ST_ELIM);
+			return ALG_ESING;
+		}
+		if (j > 1)
+			b[j] -= e[j-1] * a[j-1] * b[j-1];
+		b[j] /= a[j];
+		e[j] /= a[j];
+	}
+	PROF_COUNT(CT_FLOPS, 12ULL * k);
+	PROF_STOP(ST_ELIM);
+	PROF_START(ST_BACKSUB);
+	for (j = 2; j < k-1; j++)
+		c[j] -= b[j-1] * c[j-1] + (j > 2 ? e[j-2] * c[j-2] : 0);
+	for (j = 1; j < k-1; j++)
+		c[j] /= a[j];
+	for (j = k-3; j > 0; j--)
+		c[j] -= b[j] * c[j+1] + (j+2 < k-1 ? e[j] * c[j+2] : 0);
+	/* the values at the knots */
+	for (i = 0; i < k; i++) {
+		q = 0;
+		if (i > 0)
+			q += (c[i-1] - c[i]) / (x[i] - x[i-1]);
+		if (i < k-1)
+			q += (c[i+1] - c[i]) / (x[i+1] - x[i]);
+		g[i] -= lambda * q / w[i];
+	}
+	PROF_COUNT(CT_FLOPS, 14ULL * k);
+	PROF_STOP(ST_BACKSUB);
+	memset(spl, 0, sizeof(struct spline));
+	spl->n = k;
+	spl->x = x;
+	spl->g = g;
+	spl->c = c;
+	return ALG_OK;
+}
+
+/* Evaluate the spline at t, finding its knot interval
+ * by a binary search; past the ends, the spline is linear. */
+double
+spleval(const struct spline *s, double t)
+{
+	const double *x, *g, *c;
+	double h, u, v;
+	long lo, hi, i, n;
+	if (NULL == s || s->n < 1)
+		return NAN;
+	if (1 == (n = s->n))
+		return s->g[0];
+	x = s->x;
+	g = s->g;
+	c = s->c;
+	if (t <= x[0]) {
+		h = x[1] - x[0];
+		return g[0] + (t - x[0]) * ((g[1] - g[0]) / h - h * c[1] / 6);
+	}
+	if (t >= x[n-1]) {
+		h = x[n-1] - x[n-2];
+		return g[n-1] + (t - x[n-1])
+		    * ((g[n-1] - g[n-2]) / h + h * c[n-2] / 6);
+	}
+	for (lo = 0, hi = n-1; hi - lo > 1; ) {
+		i = lo + (hi - lo) / 2;
+		if (x[i] <= t)
+			lo = i;
+		else
+			hi = i;
+	}
+	h = x[hi] - x[lo];
+	u = t - x[lo];
+	v = x[hi] - t;
+	return (u * g[hi] + v * g[lo]) / h
+	    - u * v / 6 * ((1 + u / h) * c[hi] + (1 + v / h) * c[lo]);
+}
+
+/* Write the spline as a line per knot: the knot, the value
+ * and the second derivative, exactly enough to be read back
+ * by splread(). Return ALG_OK or ALG_EIO. */
+int
+splwrite(FILE *fp, const struct spline *s)
+{
+	long i;
+	if (NULL == fp || NULL == s || s->n < 1)
+		return ALG_EINVAL;
+	PROF_START(ST_OUTPUT);
+	for (i = 0; i < s->n; i++)
+		fprintf(fp, "% .17e % .17e % .17e\n", s->x[i], s->g[i], s->c[i]);
+	PROF_STOP(ST_OUTPUT);
+	return ferror(fp) ? ALG_EIO : ALG_OK;
+}
+
+static int
+grow(double **a, size_t n)
+{
+	double *new;
+	if (NULL == (new = reallocarray(*a, n, sizeof(double))))
+		return ALG_ENOMEM;
+	PROF_COUNT(CT_ALLOCS, 1);
+	*a = new;
+	return ALG_OK;
+}
+
+/* Read a spline written by splwrite(), skipping blank lines.
+ * Return ALG_OK or an error code; on success, the caller
+ * frees the spline with freespl(). */
+int
+splread(FILE *fp, struct spline *s)
+{
+	char *line = NULL;
+	size_t size = 0, max = 0;
+	ssize_t len;
+	double x, g, c;
+	int e = ALG_OK;
+	if (NULL == fp || NULL == s)
+		return ALG_EINVAL;
+	memset(s, 0, sizeof(struct spline));
+	s->own = 1;
+	PROF_START(ST_PARSE);
+	while ((len = getline(&line, &size, fp)) != -1) {
+		PROF_COUNT(CT_BYTES, len);
+		if ((size_t) len == strspn(line, " \t\r\n"))
+			continue;
+		if (3 != sscanf(line, "%le %le %le", &x, &g, &c)) {
+			e = ALG_EPARSE;
+			break;
+		}
+		if (s->n && !(x > s->x[s->n-1])) {
+			e = ALG_EINVAL;
+			break;
+		}
+		if ((size_t) s->n == max) {
+			max = max ? 2 * max : 1024;
+			if (ALG_OK != (e = grow(&s->x, max))
+			||  ALG_OK != (e = grow(&s->g, max))
+			||  ALG_OK != (e = grow(&s->c, max)))
+				break;
+		}
+		s->x[s->n] = x;
+		s->g[s->n] = g;
+		s->c[s->n++] = c;
+	}
+	if (ALG_OK == e && ferror(fp))
+		e = ALG_EIO;
+	if (ALG_OK == e && 0 == s->n)
+		e = ALG_EPARSE;
+	PROF_STOP(ST_PARSE);
+	free(line);
+	if (ALG_OK != e)
+		freespl(s);
+	return e;
+}
+
+/* Free the arrays allocated by splread(); a spline
+ * fitted by splfit() lives in the workspace. */
+void
+freespl(struct spline *s)
+{
+	if (NULL == s || 0 == s->own)
+		return;
+	free(s->x);
+	free(s->g);
+	free(s->c);
+	memset(s, 0, sizeof(struct spline));
+}
@@ -0,0 +1,25 @@
+#ifndef _ALGEBRA_SPLINE_H_
+#define _ALGEBRA_SPLINE_H_
+
+#include <stdio.h>
+
+#include "algebra.h"
+#include "fit.h"
+
+/* A natural cubic spline, given by its values and second derivatives
+ * at the knots; it continues as a straight line past the ends. */
+struct spline {
+	long	 n;	/* knots */
+	double	*x;	/* the knots, ascending */
+	double	*g;	/* the values there */
+	double	*c;	/* and the second derivatives */
+	int	 own;	/* allocated by splread(), for freespl() */
+};
+
+int	splfit(struct alg*, const struct data*, double, struct spline*);
+double	spleval(const struct spline*, double);
+int	splwrite(FILE*, const struct spline*);
+int	splread(FILE*, struct spline*);
+void	freespl(struct spline*);
+
+#endif
@@ -0,0 +1,374 @@
+/* Solve a tall overdetermined system in the least squares sense,
+ * reading its augmented matrix [A b] as a stream of rows. The rows
+ * come in blocks of a fixed size; each thread takes every jobs-th block,
+ * parses it and folds it into a triangle of its own by Householder
+ * reflections, so that only the triangles and the blocks in flight
+ * are ever in memory. At the end, the triangles are merged pairwise
+ * in a tree (TSQR). The triangle R of [A b] holds the triangle of A,
+ * Q'b next to it, and the norm of the residual in the corner,
+ * so the solution is a back substitution away.
+ * Which block goes to which thread does not depend on the timing,
+ * so the result only depends on the number of threads. */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "config.h"
+#include "algebra.h"
+#include "lineq.h"
+#include "tsqr.h"
+#include "prof.h"
+
+/* A block has about this many bytes of numbers. */
+#define BLOCKBYTES	131072
+
+/* Let this many blocks per thread be read ahead. */
+#define AHEAD		4
+
+#define MAXJOBS		256
+
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
+
+struct block {
+	long	 seq;	/* the number of the block, -1 if free */
+	long	 rows;
+	char	*text;	/* the rows as text, left to the workers */
+	size_t	 tlen;
+	size_t	 tsize;
+};
+
+struct stream {
+	pthread_mutex_t	 lock;
+	pthread_cond_t	 cond;
+	struct block	 ring[AHEAD * MAXJOBS];
+	long		 nring;
+	long		 head;	/* blocks read */
+	long		 n;	/* columns of [A b] */
+	long		 rows;	/* rows of a block */
+	int		 jobs;
+	int		 eof;
+	int		 err;
+};
+
+struct qrjob {
+	struct stream		*s;
+	long			 id;
+	double			*R;	/* n x n, the upper triangle used */
+	double			*blk;	/* a block of rows, parsed */
+	double			*w;	/* n numbers */
+	unsigned long long	 flops;
+};
+
+/* The bytes of workspace for the solution and the jobs. */
+#define QRWORK(n, rows, jobs) \
+	(ALGSIZE((n) * sizeof(double)) + (size_t) (jobs) \
+	* (ALGSIZE((n) * (n) * sizeof(double)) \
+	+ ALGSIZE((rows) * (n) * sizeof(double)) \
+	+ ALGSIZE((n) * sizeof(double))))
+
+/* Bring the rows of blk under the triangle R, both n wide, into R
+ * by Householder reflections, one for each column. The reflection
+ * of column j only involves the row j of R, as the rows below it
+ * are zero there, and the vector it keeps in column j of blk.
+ * Return the number of flops. */
+static unsigned long long
+house(double *R, double *blk, long rows, long n, double *w)
+{
+	double *b, *r, alpha, beta, norm, tau, v;
+	long i, j, c;
+	for (j = 0; j < n; j++) {
+		for (norm = 0, i = 0, b = blk + j; i < rows; i++, b += n)
+			norm += *b * *b;
+		if (0 == norm)
+			continue;
+		r = R + j * n;
+		alpha = r[j];
+		beta = sqrt(alpha * alpha + norm);
+		if (alpha >= 0)
+			beta = -beta;
+		tau = (beta - alpha) / beta;
+		v = 1 / (alpha - beta);
+		for (c = j + 1; c < n; c++)
+			w[c] = r[c];
+		for (i = 0, b = blk; i < rows; i++, b += n) {
+			b[j] *= v;
+			for (c = j + 1; c < n; c++)
+				w[c] += b[j] * b[c];
+		}
+		for (c = j + 1; c < n; c++) {
+			w[c] *= tau;
+			r[c] -= w[c];
+		}
+		for (i = 0, b = blk; i < rows; i++, b += n)
+			for (c = j + 1; c < n; c++)
+				b[c] -= b[j] * w[c];
+		r[j] = beta;
+	}
+	return 4ULL * rows * n * n;
+}
+
+/* Parse the rows of the block, n numbers each.
+ * Return ALG_OK or an error code. */
+static int
+parse(const struct block *b, double *blk, long n)
+{
+	const char *p;
+	char *end;
+	long r, c;
+	for (p = b->text, r = 0; r < b->rows; r++, blk += n) {
+		for (c = 0; c < n; c++, p = end) {
+			blk[c] = strtod(p, &end);
+			if (end == p)
+				return strchr("\n", *(p + strspn(p, " \t\r")))
+				    ? ALG_ESHAPE : ALG_EPARSE;
+		}
+		p += strspn(p, " \t\r");
+		if ('\n' != *p && '\0' != *p) {
+			strtod(p, &end);
+			return end == p ? ALG_EPARSE : ALG_ESHAPE;
+		}
+		if ('\n' == *p)
+			p++;
+	}
+	return ALG_OK;
+}
+
+/* Parse the block and fold it into the triangle of the job,
+ * setting the block free. */
+static void
+fold(struct qrjob *q, struct block *b)
+{
+	struct stream *s = q->s;
+	int e;
+	if (ALG_OK == (e = parse(b, q->blk, s->n)))
+		q->flops += house(q->R, q->blk, b->rows, s->n, q->w);
+	pthread_mutex_lock(&s->lock);
+	if (ALG_OK != e)
+		s->err = e;
+	b->seq = -1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* Take every jobs-th block, parse it and fold it into our triangle. */
+static void*
+qrwork(void *arg)
+{
+	struct qrjob *q = arg;
+	struct stream *s = q->s;
+	struct block *b;
+	long seq;
+	for (seq = q->id; ; seq += s->jobs) {
+		pthread_mutex_lock(&s->lock);
+		while (ALG_OK == s->err && 0 == s->eof && s->head <= seq)
+			pthread_cond_wait(&s->cond, &s->lock);
+		if (ALG_OK != s->err || s->head <= seq) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		b = &s->ring[seq % s->nring];
+		pthread_mutex_unlock(&s->lock);
+		fold(q, b);
+	}
+	return NULL;
+}
+
+/* Append a line to the text of the block. */
+static int
+append(struct block *b, const char *line, size_t len)
+{
+	char *t;
+	size_t size;
+	if (b->tlen + len + 1 > b->tsize) {
+		for (size = b->tsize ? b->tsize : BLOCKBYTES;
+		    size < b->tlen + len + 1; size *= 2)
+			;
+		if (NULL == (t = realloc(b->text, size)))
+			return ALG_ENOMEM;
+		PROF_COUNT(CT_ALLOCS, 1);
+		b->text = t;
+		b->tsize = size;
+	}
+	memcpy(b->text + b->tlen, line, len);
+	b->tlen += len;
+	b->text[b->tlen] = '\0';
+	return ALG_OK;
+}
+
+/* Read the blocks into the ring until the end of the input,
+ * the first line being read already. The blocks of a job
+ * no thread could be had for are folded here as they come. */
+static int
+rdblocks(struct stream *s, struct qrjob *job, const int *made, FILE *in,
+	char **line, size_t *size, ssize_t len)
+{
+	struct block *b;
+	long seq;
+	int e = ALG_OK;
+	for (seq = 0; ALG_OK == e && len != -1; seq++) {
+		b = &s->ring[seq % s->nring];
+		pthread_mutex_lock(&s->lock);
+		while (ALG_OK == s->err && -1 != b->seq)
+			pthread_cond_wait(&s->cond, &s->lock);
+		e = s->err;
+		pthread_mutex_unlock(&s->lock);
+		if (ALG_OK != e)
+			break;
+		b->tlen = 0;
+		b->rows = 0;
+		do {
+			if ((size_t) len == strspn(*line, " \t\r\n"))
+				continue;
+			PROF_COUNT(CT_BYTES, len);
+			if (ALG_OK != (e = append(b, *line, len)))
+				break;
+			if ('\n' != (*line)[len - 1]
+			&& ALG_OK != (e = append(b, "\n", 1)))
+				break;
+			b->rows++;
+		} while (b->rows < s->rows
+		    && (len = getline(line, size, in)) != -1);
+		if (b->rows == s->rows && len != -1)
+			len = getline(line, size, in);
+		if (0 == b->rows)
+			break;
+		pthread_mutex_lock(&s->lock);
+		b->seq = seq;
+		s->head++;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		if (!made[seq % s->jobs])
+			fold(&job[seq % s->jobs], b);
+	}
+	if (ALG_OK == e && ferror(in))
+		e = ALG_EIO;
+	pthread_mutex_lock(&s->lock);
+	if (ALG_OK == s->err)
+		s->err = e;
+	s->eof = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	return e;
+}
+
+/* Find the least squares solution of the system read from the stream,
+ * a row of [A b] on each line, on the given number of threads;
+ * the first line tells the number of columns. The solution lives
+ * in the workspace of the context, valid until its next use,
+ * and resid gets the norm of the residual b - Ax. Return ALG_OK
+ * or an error code; ALG_ESING if the columns of A are dependent
+ * within the rounding. */
+int
+tsqr(struct alg *ctx, FILE *in, int jobs, struct linsol *sol, double *resid)
+{
+	struct stream s;
+	struct qrjob job[MAXJOBS];
+	pthread_t tid[MAXJOBS];
+	int made[MAXJOBS];
+	char *line = NULL, *p, *end;
+	size_t size = 0;
+	ssize_t len;
+	double *x, *r, u, max = 0;
+	long n, i, j, t;
+	int e;
+
+	if (NULL == ctx || NULL == in || NULL == sol || NULL == resid
+	|| jobs < 1)
+		return ALG_EINVAL;
+	if (jobs > MAXJOBS)
+		jobs = MAXJOBS;
+	PROF_START(ST_PARSE);
+	/* the first row tells the size */
+	while ((len = getline(&line, &size, in)) != -1
+	&& (size_t) len == strspn(line, " \t\r\n"))
+		;
+	for (p = line, n = 0; len != -1; n++, p = end) {
+		strtod(p, &end);
+		if (end == p)
+			break;
+	}
+	PROF_STOP(ST_PARSE);
+	if (n < 2) {
+		free(line);
+		return -1 == len ? ALG_EIO : n ? ALG_ESHAPE : ALG_EPARSE;
+	}
+
+	memset(&s, 0, sizeof(struct stream));
+	s.n = n;
+	s.rows = MAX(n, (long) (BLOCKBYTES / n / sizeof(double)));
+	s.jobs = jobs;
+	s.nring = AHEAD * jobs;
+	e = (size_t) n > SIZE_MAX / sizeof(double) / MAXJOBS / (n + s.rows + 2)
+	    ? ALG_ENOMEM : algwork(ctx, QRWORK(n, s.rows, jobs));
+	if (ALG_OK != e) {
+		free(line);
+		return e;
+	}
+	x = algtake(ctx, n * sizeof(double));
+	for (t = 0; t < jobs; t++) {
+		job[t].s = &s;
+		job[t].id = t;
+		job[t].R = algtake(ctx, n * n * sizeof(double));
+		job[t].blk = algtake(ctx, s.rows * n * sizeof(double));
+		job[t].w = algtake(ctx, n * sizeof(double));
+		job[t].flops = 0;
+	}
+	for (i = 0; i < s.nring; i++)
+		s.ring[i].seq = -1;
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+
+	PROF_START(ST_ELIM);
+	for (t = 0; t < jobs; t++)
+		made[t] = !pthread_create(&tid[t], NULL, qrwork, &job[t]);
+	e = rdblocks(&s, job, made, in, &line, &size, len);
+	for (t = 0; t < jobs; t++)
+		if (made[t])
+			pthread_join(tid[t], NULL);
+	if (ALG_OK == e)
+		e = s.err;
+	free(line);
+	for (i = 0; i < s.nring; i++)
+		free(s.ring[i].text);
+	pthread_mutex_destroy(&s.lock);
+	pthread_cond_destroy(&s.cond);
+	if (ALG_OK != e) {
+		PROF_STOP(ST_ELIM);
+		return e;
+	}
+	/* merge the triangles pairwise */
+	for (i = 1; i < jobs; i *= 2)
+		for (t = 0; t + i < jobs; t += 2 * i)
+			job[t].flops += house(job[t].R, job[t + i].R, n, n,
+			    job[t].w);
+	for (t = 0; t < jobs; t++)
+		PROF_COUNT(CT_FLOPS, job[t].flops);
+	PROF_STOP(ST_ELIM);
+
+	/* back substitution with the triangle of A */
+	PROF_START(ST_BACKSUB);
+	r = job[0].R;
+	for (i = 0; i < n - 1; i++)
+		max = MAX(max, fabs(r[i * n + i]));
+	for (i = n - 2; i >= 0; i--) {
+		if (!(fabs(r[i * n + i]) > (n - 1) * DBL_EPSILON * max)) {
+			PROF_STOP(ST_BACKSUB);
+			return ALG_ESING;
+		}
+		for (u = r[i * n + n - 1], j = i + 1; j < n - 1; j++)
+			u -= r[i * n + j] * x[j];
+		x[i] = u / r[i * n + i];
+	}
+	PROF_COUNT(CT_FLOPS, (unsigned long long) n * n);
+	PROF_STOP(ST_BACKSUB);
+	memset(sol, 0, sizeof(struct linsol));
+	sol->len = n - 1;
+	sol->par = x;
+	*resid = fabs(r[n * n - 1]);
+	return ALG_OK;
+}
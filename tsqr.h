@@ -0,0 +1,11 @@
+#ifndef _ALGEBRA_TSQR_H_
+#define _ALGEBRA_TSQR_H_
+
+#include <stdio.h>
+
+#include "algebra.h"
+#include "lineq.h"
+
+int	tsqr(struct alg*, FILE*, int, struct linsol*, double*);
+
+#endif